@@ -55,6 +55,110 @@
  */
 static WaitressHandle_t fly_waith;
 
+/**
+ * Barfly Waitress handle used to fetch the album cover while fly_waith
+ * fetches the album explorer page.
+ */
+static WaitressHandle_t fly_cover_waith;
+
+/**
+ * Barfly Waitress handles used by BarFlyDownload(), one per segment.
+ */
+static WaitressHandle_t fly_download_waith[BAR_FLY_DOWNLOAD_SEGMENTS_MAX];
+
+/**
+ * A byte range of the audio file downloaded by BarFlyDownload().
+ */
+typedef struct BarFlySegment {
+	/**
+	 * The file descriptor of the audio file.
+	 */
+	int fd;
+
+	/**
+	 * The offset at which the next received byte is written.  Once it is
+	 * past last the segment is complete.
+	 */
+	size_t offset;
+
+	/**
+	 * The offset of the last byte of the segment.
+	 */
+	size_t last;
+
+	/**
+	 * The size of the whole file or 0 while it is not known yet.  Responses
+	 * that are not a part of a file of this size are rejected.
+	 */
+	size_t total;
+
+	/**
+	 * The handle downloading the segment.
+	 */
+	WaitressHandle_t const* waith;
+
+	/**
+	 * The Range header sent.
+	 */
+	char range[64];
+
+	/**
+	 * The result of the last request.
+	 */
+	WaitressReturn_t status;
+
+	/**
+	 * Set if the file could not be written or the server sent something
+	 * else than the requested range.
+	 */
+	bool failed;
+} BarFlySegment_t;
+
+
+/**
+ * Waitress callback writing the received data of a segment to the audio file.
+ *
+ * @param data The received data.
+ * @param size The size of the data in bytes.
+ * @param user_data Pointer to the BarFlySegment_t structure.
+ * @return WAITRESS_CB_RET_OK if the data was written, WAITRESS_CB_RET_ERR
+ * otherwise.
+ */
+static WaitressCbReturn_t _BarFlyDownloadSegmentCb(void* data, size_t size,
+		void* user_data);
+
+/**
+ * WaitressMulti_t callback storing the result of a segment's request.
+ *
+ * @param waith The handle that was used.
+ * @param status The result of the request.
+ * @param data Pointer to the BarFlySegment_t structure.
+ */
+static void _BarFlyDownloadSegmentDone(WaitressHandle_t* waith,
+		WaitressReturn_t status, void* data);
+
+/**
+ * Retrieves the album explorer page and the cover art at the same time.
+ *
+ * A failure to get the cover art is reported but does not make this function
+ * fail, *cover_art is left unchanged in that case.
+ *
+ * @param album_url The URL of the album explorer page.
+ * @param album_page A pointer to a buffer that upon success will contain the
+ * '\0' terminated album explorer page.  This buffer must be freed.
+ * @param cover_url The URL of the cover art or NULL if the cover art is not
+ * needed.
+ * @param cover_art A pointer to a buffer that will contain the cover art if it
+ * was fetched.  This buffer must be freed.
+ * @param cover_size A pointer to a size_t variable that will be set to the
+ * size of the cover art.
+ * @param settings Pointer to the application settings structure.
+ * @return If the album explorer page was fetched 0 is returned otherwise -1
+ * is returned.
+ */
+static int _BarFlyFetchAlbum(char const* album_url, char** album_page,
+		char const* cover_url, uint8_t** cover_art, size_t* cover_size,
+		BarSettings_t const* settings);
 
 /**
  * Retreives the contents served up by the given URL.
@@ -225,12 +329,154 @@ static int _BarFlyTagMp4Write(BarFly_t const* fly, uint8_t const* cover_art,
 static int _BarFlyTagWrite(BarFly_t const* fly, BarSettings_t const* settings);
 
 
+static WaitressCbReturn_t _BarFlyDownloadSegmentCb(void* data, size_t size,
+		void* user_data)
+{
+	WaitressCbReturn_t exit_status = WAITRESS_CB_RET_OK;
+	BarFlySegment_t* segment = user_data;
+	char const* buffer = data;
+	ssize_t written;
+
+	assert(segment != NULL);
+
+	/*
+	 * A server ignoring the Range header sends the whole file.  That's only
+	 * fine for the first request.
+	 */
+	if ((segment->total != 0) &&
+			((segment->waith->request.contentRangeTotal != segment->total) ||
+			 (size > segment->last + 1 - segment->offset))) {
+		goto error;
+	}
+
+	while (size > 0) {
+		written = pwrite(segment->fd, buffer, size, segment->offset);
+		if ((written == -1) && (errno == EINTR)) {
+			continue;
+		} else if (written <= 0) {
+			goto error;
+		}
+
+		buffer += written;
+		size -= written;
+		segment->offset += written;
+	}
+
+	goto end;
+
+error:
+	segment->failed = true;
+	exit_status = WAITRESS_CB_RET_ERR;
+
+end:
+	return exit_status;
+}
+
+static void _BarFlyDownloadSegmentDone(WaitressHandle_t* waith,
+		WaitressReturn_t status, void* data)
+{
+	BarFlySegment_t* segment = data;
+
+	assert(segment != NULL);
+
+	segment->status = status;
+
+	return;
+}
+
+static int _BarFlyFetchAlbum(char const* album_url, char** album_page,
+		char const* cover_url, uint8_t** cover_art, size_t* cover_size,
+		BarSettings_t const* settings)
+{
+	int exit_status = 0;
+	bool statusb;
+	WaitressMulti_t multi;
+	WaitressReturn_t status_page = WAITRESS_RET_ERR;
+	WaitressReturn_t status_cover = WAITRESS_RET_ERR;
+	char* tmp_page = NULL;
+	uint8_t* tmp_cover = NULL;
+	size_t tmp_cover_size = 0;
+
+	assert(album_url != NULL);
+	assert(album_page != NULL);
+	assert(cover_art != NULL);
+	assert(cover_size != NULL);
+	assert(settings != NULL);
+
+	/*
+	 * Queue up both requests and run them concurrently.
+	 */
+	WaitressMultiInit(&multi);
+
+	statusb = WaitressSetUrl(&fly_waith, album_url);
+	if (statusb) {
+		WaitressMultiAddBuf(&multi, &fly_waith, &tmp_page, NULL,
+				&status_page);
+	} else {
+		BarUiMsg(settings, MSG_INFO, "Invalid URL (%s).\n", album_url);
+	}
+
+	if (cover_url != NULL) {
+		statusb = WaitressSetUrl(&fly_cover_waith, cover_url);
+		if (statusb) {
+			WaitressMultiAddBuf(&multi, &fly_cover_waith, (char**)&tmp_cover,
+					&tmp_cover_size, &status_cover);
+		} else {
+			BarUiMsg(settings, MSG_INFO, "Invalid URL (%s).\n", cover_url);
+		}
+	}
+
+	WaitressMultiPerform(&multi);
+
+	/*
+	 * Hand over the cover art.  It is fetched again when the song is tagged
+	 * if this failed.
+	 */
+	if (cover_url != NULL) {
+		if ((status_cover == WAITRESS_RET_OK) && (tmp_cover != NULL)) {
+			*cover_art = tmp_cover;
+			*cover_size = tmp_cover_size;
+			tmp_cover = NULL;
+		} else {
+			BarUiMsg(settings, MSG_INFO, "Failed to fetch the URL contents "
+					"(url = %s, waitress status = %d).\n", cover_url,
+					status_cover);
+		}
+	}
+
+	if ((status_page != WAITRESS_RET_OK) || (tmp_page == NULL)) {
+		BarUiMsg(settings, MSG_INFO, "Failed to fetch the URL contents "
+				"(url = %s, waitress status = %d).\n", album_url, status_page);
+		goto error;
+	}
+
+	*album_page = tmp_page;
+	tmp_page = NULL;
+
+	goto end;
+
+error:
+	exit_status = -1;
+
+end:
+	if (tmp_page != NULL) {
+		free(tmp_page);
+	}
+
+	if (tmp_cover != NULL) {
+		free(tmp_cover);
+	}
+
+	return exit_status;
+}
+
 static int _BarFlyFetchURL(char const* url, uint8_t** buffer, size_t* size,
 		BarSettings_t const* settings)
 {
 	int exit_status = 0;
 	char status;
 	WaitressReturn_t status_waith;
+	WaitressTiming_t timing;
 	uint8_t* tmp_buffer = NULL;
 	size_t tmp_size;
 
@@ -250,8 +496,15 @@ static int _BarFlyFetchURL(char const* url, uint8_t** buffer, size_t* size,
 	status_waith = WaitressFetchBufEx(&fly_waith, (char**)&tmp_buffer,
 			&tmp_size);
 	if ((status_waith != WAITRESS_RET_OK) || (tmp_buffer == NULL)) {
+		/*
+		 * Tell how far the request got, phases are -1 if not reached.
+		 */
+		WaitressGetTiming(&fly_waith, &timing);
 		BarUiMsg(settings, MSG_INFO, "Failed to fetch the URL contents "
-				"(url = %s, waitress status = %d).\n", url, status_waith);
+				"(url = %s, waitress status = %d, connect = %ld ms, "
+				"first byte = %ld ms, received = %llu bytes).\n", url,
+				status_waith, timing.connect, timing.firstByte,
+				timing.bytesReceived);
 		goto error;
 	}
 
@@ -1056,15 +1309,19 @@ static int _BarFlyTagWrite(BarFly_t const* fly, BarSettings_t const* settings)
 	int exit_status = 0;
 	int status;
 	uint8_t* cover_art = NULL;
+	uint8_t const* tag_cover_art = NULL;
 	size_t cover_size = 0;
 
 	assert(fly != NULL);
 	assert(settings != NULL);
 
 	/*
-	 * Fetch the album cover.
+	 * Fetch the album cover unless BarFlyOpen() already did.
 	 */
-	if ((settings->embedCover) && (fly->cover_art_url != NULL)) {
+	if ((settings->embedCover) && (fly->cover_art != NULL)) {
+		tag_cover_art = fly->cover_art;
+		cover_size = fly->cover_size;
+	} else if ((settings->embedCover) && (fly->cover_art_url != NULL)) {
 		status = _BarFlyTagFetchCover(&cover_art, &cover_size,
 				fly->cover_art_url, settings);
 		if (status != 0) {
@@ -1072,18 +1329,21 @@ static int _BarFlyTagWrite(BarFly_t const* fly, BarSettings_t const* settings)
 					"the tag.\n");
 			exit_status = -1;
 		}
+		tag_cover_art = cover_art;
 	}
 
 	switch (fly->audio_format) {
 		#ifdef ENABLE_FAAD
 		case PIANO_AF_AACPLUS:
-			status = _BarFlyTagMp4Write(fly, cover_art, cover_size, settings);
+			status = _BarFlyTagMp4Write(fly, tag_cover_art, cover_size,
+					settings);
 			break;
 		#endif
 
 		#if defined ENABLE_MAD && defined ENABLE_ID3TAG
 		case PIANO_AF_MP3:
-			status = _BarFlyTagID3Write(fly, cover_art, cover_size, settings);
+			status = _BarFlyTagID3Write(fly, tag_cover_art, cover_size,
+					settings);
 			break;
 		#endif
 
@@ -1117,7 +1377,13 @@ end:
 
 void BarFlyFinalize(void)
 {
+	int i;
+
 	WaitressFree(&fly_waith);
+	WaitressFree(&fly_cover_waith);
+	for (i = 0; i < BAR_FLY_DOWNLOAD_SEGMENTS_MAX; i++) {
+		WaitressFree(&fly_download_waith[i]);
+	}
 
 	return;
 }
@@ -1161,17 +1427,206 @@ int BarFlyClose(BarFly_t* fly, BarSettings_t const* settings)
 		if (fly->cover_art_url != NULL) {
 			free(fly->cover_art_url);
 		}
+
+		/*
+		 * Free the cover art.
+		 */
+		if (fly->cover_art != NULL) {
+			free(fly->cover_art);
+		}
 	}
 
 	return exit_status;
 }
 
+int BarFlyDownload(BarFly_t* fly, char const* url, int cancel_fd,
+		WaitressReturn_t* status_waith, BarSettings_t const* settings)
+{
+	int exit_status = 0;
+	int status;
+	bool statusb;
+	int fd;
+	unsigned int i;
+	unsigned int round;
+	unsigned int segment_count;
+	unsigned int pending;
+	size_t total;
+	size_t received;
+	size_t segment_size;
+	size_t start;
+	size_t stop;
+	BarFlySegment_t segments[BAR_FLY_DOWNLOAD_SEGMENTS_MAX];
+	WaitressMulti_t multi;
+
+	assert(fly != NULL);
+	assert(url != NULL);
+	assert(status_waith != NULL);
+	assert(settings != NULL);
+
+	*status_waith = WAITRESS_RET_OK;
+
+	if (fly->completed) {
+		goto end;
+	} else if (fly->audio_file == NULL) {
+		/*
+		 * The file could not be opened, don't let the caller tag it.
+		 */
+		*status_waith = WAITRESS_RET_ERR;
+		goto end;
+	}
+	fd = fileno(fly->audio_file);
+
+	segment_count = settings->downloadSegments;
+	if (segment_count < 1) {
+		segment_count = 1;
+	} else if (segment_count > BAR_FLY_DOWNLOAD_SEGMENTS_MAX) {
+		segment_count = BAR_FLY_DOWNLOAD_SEGMENTS_MAX;
+	}
+
+	/*
+	 * Set up a handle for every segment.
+	 */
+	memset(segments, 0, sizeof(segments));
+	for (i = 0; i < segment_count; i++) {
+		statusb = WaitressSetUrl(&fly_download_waith[i], url);
+		if (!statusb) {
+			BarUiMsg(settings, MSG_INFO, "Invalid URL (%s).\n", url);
+			*status_waith = WAITRESS_RET_ERR;
+			goto error;
+		}
+		fly_download_waith[i].cancelFd = cancel_fd;
+		fly_download_waith[i].callback = _BarFlyDownloadSegmentCb;
+		fly_download_waith[i].data = &segments[i];
+		fly_download_waith[i].extraHeaders = segments[i].range;
+
+		segments[i].fd = fd;
+		segments[i].waith = &fly_download_waith[i];
+	}
+
+	/*
+	 * Request the beginning of the file.  The response tells the size of the
+	 * whole file unless the server ignores the Range header and sends all of
+	 * it.
+	 */
+	snprintf(segments[0].range, sizeof(segments[0].range),
+			"Range: bytes=0-%d\r\n", BAR_FLY_DOWNLOAD_PROBE_SIZE - 1);
+	*status_waith = WaitressFetchCall(&fly_download_waith[0]);
+	if (segments[0].failed) {
+		goto segment_error;
+	} else if (*status_waith != WAITRESS_RET_OK) {
+		goto error;
+	}
+
+	total = fly_download_waith[0].request.contentRangeTotal;
+	received = segments[0].offset;
+	if ((total == 0) || (received >= total)) {
+		goto end;
+	}
+
+	/*
+	 * Allocate the whole file, the segments are written out of order.
+	 */
+	status = posix_fallocate(fd, 0, total);
+	if (status != 0) {
+		BarUiMsg(settings, MSG_ERR, "Could not allocate the audio file "
+				"(%s) (%d:%s).\n", fly->audio_file_path, status,
+				strerror(status));
+		*status_waith = WAITRESS_RET_ERR;
+		goto error;
+	}
+
+	/*
+	 * Split the rest of the file.  Trailing segments may be empty for tiny
+	 * files.
+	 */
+	segment_size = (total - received + segment_count - 1) / segment_count;
+	for (i = 0; i < segment_count; i++) {
+		start = received + i * segment_size;
+		stop = start + segment_size;
+		if (start > total) {
+			start = total;
+		}
+		if (stop > total) {
+			stop = total;
+		}
+
+		segments[i].offset = start;
+		segments[i].last = stop - 1;
+		segments[i].total = total;
+		segments[i].failed = false;
+	}
+
+	/*
+	 * Download all segments concurrently.  Parts that could not be received
+	 * are requested again.
+	 */
+	for (round = 0; round < BAR_FLY_DOWNLOAD_ROUNDS; round++) {
+		WaitressMultiInit(&multi);
+		multi.cancelFd = cancel_fd;
+		pending = 0;
+
+		for (i = 0; i < segment_count; i++) {
+			if (segments[i].offset > segments[i].last) {
+				continue;
+			}
+
+			snprintf(segments[i].range, sizeof(segments[i].range),
+					"Range: bytes=%zu-%zu\r\n", segments[i].offset,
+					segments[i].last);
+			segments[i].status = WAITRESS_RET_ERR;
+			WaitressMultiAdd(&multi, &fly_download_waith[i],
+					_BarFlyDownloadSegmentDone, &segments[i]);
+			pending++;
+		}
+
+		if (pending == 0) {
+			break;
+		}
+
+		*status_waith = WaitressMultiPerform(&multi);
+		if (*status_waith != WAITRESS_RET_OK) {
+			goto error;
+		}
+
+		for (i = 0; i < segment_count; i++) {
+			if (segments[i].failed) {
+				goto segment_error;
+			}
+		}
+	}
+
+	/*
+	 * Report the first segment that is still incomplete.
+	 */
+	for (i = 0; i < segment_count; i++) {
+		if (segments[i].offset <= segments[i].last) {
+			*status_waith = (segments[i].status == WAITRESS_RET_OK) ?
+					WAITRESS_RET_PARTIAL_FILE : segments[i].status;
+			goto error;
+		}
+	}
+
+	goto end;
+
+segment_error:
+	BarUiMsg(settings, MSG_ERR, "Could not write the audio file or the server "
+			"sent an unexpected response (%s).\n", fly->audio_file_path);
+	*status_waith = WAITRESS_RET_ERR;
+
+error:
+	exit_status = -1;
+
+end:
+	return exit_status;
+}
+
 int BarFlyInit(BarSettings_t const* settings)
 {
 	char const* const PATH_SEPARATORS = "/";
 
 	int exit_status = 0;
 	int status;
+	int i;
 	bool statusb;
 	char* component;
 	char* path = NULL;
@@ -1184,6 +1639,10 @@ int BarFlyInit(BarSettings_t const* settings)
 	 * Initialize the Waitress handle.
 	 */
 	WaitressInit(&fly_waith);
+	WaitressInit(&fly_cover_waith);
+	for (i = 0; i < BAR_FLY_DOWNLOAD_SEGMENTS_MAX; i++) {
+		WaitressInit(&fly_download_waith[i]);
+	}
 
 	if (settings->controlProxy != NULL) {
 		proxy = settings->controlProxy;
@@ -1192,13 +1651,23 @@ int BarFlyInit(BarSettings_t const* settings)
 	}
 
 	if (proxy != NULL) {
-		statusb = WaitressSetProxy(&fly_waith, proxy);
+		statusb = WaitressSetProxy(&fly_waith, proxy) &&
+				WaitressSetProxy(&fly_cover_waith, proxy);
 		if (!statusb) {
 			BarUiMsg(settings, MSG_ERR, "Could not set proxy (proxy = '%s').\n",
 					proxy);
 		}
 	}
 
+	/*
+	 * The audio files are fetched like the player does.
+	 */
+	if (settings->proxy != NULL) {
+		for (i = 0; i < BAR_FLY_DOWNLOAD_SEGMENTS_MAX; i++) {
+			WaitressSetProxy(&fly_download_waith[i], settings->proxy);
+		}
+	}
+
 	/*
 	 * Create the audio file directory and change into it.
 	 */
@@ -1316,10 +1785,13 @@ int BarFlyOpen(BarFly_t* fly, PianoSong_t const* song,
 	}
 
 	/*
-	 * Get the album explorer page and extract the track and disc numbers.
+	 * Get the album explorer page and extract the track and disc numbers.  The
+	 * cover art is fetched at the same time if it is going to be embedded in
+	 * the tag.
 	 */
-	status = _BarFlyFetchURL(song->albumExplorerUrl, (uint8_t**)&buffer,
-			NULL, settings);
+	status = _BarFlyFetchAlbum(song->albumExplorerUrl, &buffer,
+			(settings->embedCover) ? output_fly.cover_art_url : NULL,
+			&output_fly.cover_art, &output_fly.cover_size, settings);
 	if (status != 0) {
 		BarUiMsg(settings, MSG_INFO, "Couldn't get the album explorer page.  "
 				"The track and disc numbers will not be added to the tag.\n");
@@ -1394,6 +1866,10 @@ end:
 		free(output_fly.cover_art_url);
 	}
 
+	if (output_fly.cover_art != NULL) {
+		free(output_fly.cover_art);
+	}
+
 	return exit_status;
 }
 
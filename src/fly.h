@@ -30,7 +30,9 @@
 
 #include <piano.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <waitress.h>
 
 #include "settings.h"
 
@@ -44,6 +46,23 @@
  */
 #define BAR_FLY_COPY_BLOCK_SIZE (100 * 1024)
 
+/**
+ * Maximum number of concurrent requests used by BarFlyDownload().
+ */
+#define BAR_FLY_DOWNLOAD_SEGMENTS_MAX WAITRESS_MULTI_SIZE
+
+/**
+ * Number of bytes requested by BarFlyDownload() to find out the size of the
+ * audio file.
+ */
+#define BAR_FLY_DOWNLOAD_PROBE_SIZE (256 * 1024)
+
+/**
+ * Number of times BarFlyDownload() requests parts of the audio file that
+ * could not be downloaded completely.
+ */
+#define BAR_FLY_DOWNLOAD_ROUNDS 3
+
 /**
  * The status of the recoding.
  */
@@ -117,6 +136,17 @@ typedef struct BarFly {
 	 */
 	char* cover_art_url;
 
+	/**
+	 * The cover art fetched by BarFlyOpen() or NULL if it has to be fetched
+	 * when the song is tagged.
+	 */
+	uint8_t* cover_art;
+
+	/**
+	 * The size of the cover art in bytes.
+	 */
+	size_t cover_size;
+
 	/**
 	 * The current status of the recording.
 	 */
@@ -136,6 +166,30 @@ typedef struct BarFly {
  */
 int BarFlyClose(BarFly_t* fly, BarSettings_t const* settings);
 
+/**
+ * Downloads the audio file without playing it.  The size of the file is
+ * requested first, then the rest of it is split into
+ * settings->downloadSegments parts which are downloaded concurrently using
+ * Range requests and written to the preallocated file.  If the server does
+ * not support Range requests the file is downloaded by the first request.
+ *
+ * The file has to be tagged with BarFlyTag() afterwards.  If the song was
+ * completed already nothing is done.  If the fly->audio_file variable is NULL
+ * nothing is done either, but status_waith is set to WAITRESS_RET_ERR.
+ *
+ * @param fly Pointer to the BarFly_t structure.
+ * @param url The URL of the audio file.
+ * @param cancel_fd The download is aborted as soon as this file descriptor
+ * becomes readable, -1 if unused.
+ * @param status_waith Set to the waitress status of the download,
+ * WAITRESS_RET_CB_ABORT if it was aborted.
+ * @param settings Pointer to the application settings structure.
+ * @return If the whole file was downloaded 0 is returned otherwise -1 is
+ * returned.
+ */
+int BarFlyDownload(BarFly_t* fly, char const* url, int cancel_fd,
+		WaitressReturn_t* status_waith, BarSettings_t const* settings);
+
 /**
  * Finalize the BarFly module.  Cleans up anything allocated by the
  * BarFlyInit() function.
@@ -22,13 +22,21 @@ THE SOFTWARE.
 */
 
 #include <string.h>
-#include <assert.h>
-#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 
 #include "crypt.h"
 
+static const char PianoHexDigits[] = "0123456789abcdef";
+
+/* hex digit values plus one, zero marks invalid characters */
+static const unsigned char PianoHexValues[256] = {
+		['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+		['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+		['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+		['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+		};
+
 /*	decrypt hex-encoded, blowfish-crypted string: decode 2 hex-encoded blocks,
  *	decrypt, byteswap
  *	@param gcrypt handle
@@ -38,22 +46,32 @@ THE SOFTWARE.
  */
 char *PianoDecryptString (gcry_cipher_hd_t h, const char * const input,
 		size_t * const retSize) {
+	const unsigned char * const hex = (const unsigned char *) input;
 	size_t inputLen = strlen (input);
 	gcry_error_t gret;
 	unsigned char *output;
 	size_t outputLen = inputLen/2;
 
-	assert (inputLen%2 == 0);
+	if (inputLen%2 != 0) {
+		return NULL;
+	}
 
-	output = calloc (outputLen+1, sizeof (*output));
+	if ((output = malloc (outputLen+1)) == NULL) {
+		return NULL;
+	}
 	/* hex decode */
 	for (size_t i = 0; i < outputLen; i++) {
-		char hex[3];
-		memcpy (hex, &input[i*2], 2);
-		hex[2] = '\0';
-		output[i] = strtol (hex, NULL, 16);
+		const unsigned char high = PianoHexValues[hex[i*2]],
+				low = PianoHexValues[hex[i*2+1]];
+		if (high == 0 || low == 0) {
+			free (output);
+			return NULL;
+		}
+		output[i] = (high-1) << 4 | (low-1);
 	}
+	output[outputLen] = '\0';
 
+	/* decrypt in place */
 	gret = gcry_cipher_decrypt (h, output, outputLen, NULL, 0);
 	if (gret) {
 		free (output);
@@ -65,34 +83,40 @@ char *PianoDecryptString (gcry_cipher_hd_t h, const char * const input,
 	return (char *) output;
 }
 
-/*	blowfish-encrypt/hex-encode string
+/*	blowfish-encrypt/hex-encode string; the string is encrypted in the upper
+ *	half of the output buffer and hex-encoded from there into the whole buffer
  *	@param gcrypt handle
  *	@param encrypt this
  *	@return encrypted, hex-encoded string
  */
 char *PianoEncryptString (gcry_cipher_hd_t h, const char *s) {
-	unsigned char *paddedInput, *hexOutput;
+	unsigned char *hexOutput, *paddedInput;
 	size_t inputLen = strlen (s);
 	/* blowfish expects two 32 bit blocks */
 	size_t paddedInputLen = (inputLen % 8 == 0) ? inputLen : inputLen + (8-inputLen%8);
 	gcry_error_t gret;
 
-	paddedInput = calloc (paddedInputLen+1, sizeof (*paddedInput));
+	if ((hexOutput = malloc (paddedInputLen*2+1)) == NULL) {
+		return NULL;
+	}
+	paddedInput = hexOutput + paddedInputLen;
 	memcpy (paddedInput, s, inputLen);
+	memset (paddedInput + inputLen, 0, paddedInputLen - inputLen);
 
 	gret = gcry_cipher_encrypt (h, paddedInput, paddedInputLen, NULL, 0);
 	if (gret) {
-		free (paddedInput);
+		free (hexOutput);
 		return NULL;
 	}
 
-	hexOutput = calloc (paddedInputLen*2+1, sizeof (*hexOutput));
+	/* byte i is read before output positions 2i and 2i+1 are written, which
+	 * never overtake the unread bytes */
 	for (size_t i = 0; i < paddedInputLen; i++) {
-		snprintf ((char * restrict) &hexOutput[i*2], 3, "%02x", paddedInput[i]);
+		const unsigned char c = paddedInput[i];
+		hexOutput[i*2] = PianoHexDigits[c >> 4];
+		hexOutput[i*2+1] = PianoHexDigits[c & 0xf];
 	}
-
-	free (paddedInput);
+	hexOutput[paddedInputLen*2] = '\0';
 
 	return (char *) hexOutput;
 }
-
@@ -0,0 +1,643 @@
+/*
+Copyright (c) 2013
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef __FreeBSD__
+#define _BSD_SOURCE /* required by strdup() */
+#define _DARWIN_C_SOURCE /* strdup() on OS X */
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "jsonstream.h"
+
+/*	stop decoding, every following call returns immediately
+ *	@param stream
+ */
+static void PianoJsonStreamFail (PianoJsonStream_t *s) {
+	s->error = true;
+	s->pos = s->end;
+}
+
+static void PianoJsonStreamSkipSpace (PianoJsonStream_t *s) {
+	while (*s->pos == ' ' || *s->pos == '\t' || *s->pos == '\n' ||
+			*s->pos == '\r') {
+		++s->pos;
+	}
+}
+
+/*	consume literal (true, false, null)
+ *	@param stream
+ *	@param literal
+ */
+static void PianoJsonStreamLiteral (PianoJsonStream_t *s, const char *literal) {
+	const size_t len = strlen (literal);
+
+	if (strncmp (s->pos, literal, len) == 0) {
+		s->pos += len;
+	} else {
+		PianoJsonStreamFail (s);
+	}
+}
+
+/*	parse four hex digits
+ *	@param input
+ *	@return value or -1 on error
+ */
+static long int PianoJsonStreamHex (const char *in) {
+	long int value = 0;
+
+	for (int i = 0; i < 4; i++) {
+		const char c = in[i];
+
+		value <<= 4;
+		if (c >= '0' && c <= '9') {
+			value |= c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			value |= c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			value |= c - 'A' + 10;
+		} else {
+			return -1;
+		}
+	}
+
+	return value;
+}
+
+/*	encode code point as utf-8
+ *	@param output buffer
+ *	@param code point
+ *	@return end of output
+ */
+static char *PianoJsonStreamUtf8 (char *out, unsigned long int c) {
+	if (c < 0x80) {
+		*out++ = c;
+	} else if (c < 0x800) {
+		*out++ = 0xc0 | (c >> 6);
+		*out++ = 0x80 | (c & 0x3f);
+	} else if (c < 0x10000) {
+		*out++ = 0xe0 | (c >> 12);
+		*out++ = 0x80 | ((c >> 6) & 0x3f);
+		*out++ = 0x80 | (c & 0x3f);
+	} else {
+		*out++ = 0xf0 | (c >> 18);
+		*out++ = 0x80 | ((c >> 12) & 0x3f);
+		*out++ = 0x80 | ((c >> 6) & 0x3f);
+		*out++ = 0x80 | (c & 0x3f);
+	}
+
+	return out;
+}
+
+/*	unescape string in place, the result is never longer than its escaped
+ *	form, so the closing quote can hold the terminating NUL
+ *	@param stream positioned at the opening quote
+ *	@return NUL-terminated string or NULL on error
+ */
+static char *PianoJsonStreamUnescape (PianoJsonStream_t *s) {
+	assert (*s->pos == '"');
+
+	char * const start = s->pos + 1;
+	char *in = start, *out = start;
+
+	while (*in != '"') {
+		if (*in == '\0') {
+			PianoJsonStreamFail (s);
+			return NULL;
+		} else if (*in != '\\') {
+			*out++ = *in++;
+			continue;
+		}
+
+		++in;
+		switch (*in) {
+			case '"':
+			case '\\':
+			case '/':
+				*out++ = *in++;
+				break;
+
+			case 'b':
+				*out++ = '\b';
+				++in;
+				break;
+
+			case 'f':
+				*out++ = '\f';
+				++in;
+				break;
+
+			case 'n':
+				*out++ = '\n';
+				++in;
+				break;
+
+			case 'r':
+				*out++ = '\r';
+				++in;
+				break;
+
+			case 't':
+				*out++ = '\t';
+				++in;
+				break;
+
+			case 'u': {
+				long int c = PianoJsonStreamHex (in+1);
+				if (c == -1) {
+					PianoJsonStreamFail (s);
+					return NULL;
+				}
+				in += 5;
+
+				/* surrogate pair */
+				if (c >= 0xd800 && c <= 0xdbff && in[0] == '\\' &&
+						in[1] == 'u') {
+					const long int low = PianoJsonStreamHex (in+2);
+					if (low >= 0xdc00 && low <= 0xdfff) {
+						c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+						in += 6;
+					}
+				}
+				if (c >= 0xd800 && c <= 0xdfff) {
+					/* unpaired surrogate */
+					c = 0xfffd;
+				}
+
+				out = PianoJsonStreamUtf8 (out, c);
+				break;
+			}
+
+			default:
+				PianoJsonStreamFail (s);
+				return NULL;
+		}
+	}
+
+	*out = '\0';
+	s->pos = in+1;
+
+	return start;
+}
+
+/*	initialize stream
+ *	@param stream
+ *	@param json text, modified while decoding
+ */
+void PianoJsonStreamInit (PianoJsonStream_t *s, char *buf) {
+	assert (s != NULL);
+	assert (buf != NULL);
+
+	memset (s, 0, sizeof (*s));
+	s->pos = buf;
+	s->end = buf + strlen (buf);
+	PianoJsonStreamSkipSpace (s);
+	s->value = s->pos;
+}
+
+/*	get type of next value
+ *	@param stream
+ *	@return type, PIANO_JSON_NONE if there is no value
+ */
+PianoJsonType_t PianoJsonStreamType (PianoJsonStream_t *s) {
+	PianoJsonStreamSkipSpace (s);
+
+	switch (*s->pos) {
+		case '{':
+			return PIANO_JSON_OBJECT;
+
+		case '[':
+			return PIANO_JSON_ARRAY;
+
+		case '"':
+			return PIANO_JSON_STRING;
+
+		case 't':
+		case 'f':
+			return PIANO_JSON_BOOL;
+
+		case 'n':
+			return PIANO_JSON_NULL;
+
+		case '-':
+		case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			return PIANO_JSON_NUMBER;
+
+		default:
+			return PIANO_JSON_NONE;
+	}
+}
+
+/*	iterate over object members, the member's value must be consumed before
+ *	the next call; values which are not objects are skipped
+ *	@param stream
+ *	@param stores member name
+ *	@return true if there is another member
+ */
+bool PianoJsonStreamObjectNext (PianoJsonStream_t *s, char **key) {
+	assert (key != NULL);
+
+	PianoJsonStreamSkipSpace (s);
+
+	if (s->pos == s->value) {
+		/* first call for this value */
+		switch (*s->pos) {
+			case '{':
+				++s->pos;
+				PianoJsonStreamSkipSpace (s);
+				if (*s->pos == '}') {
+					++s->pos;
+					return false;
+				}
+				break;
+
+			case '\0':
+				PianoJsonStreamFail (s);
+				return false;
+
+			default:
+				/* not an object */
+				PianoJsonStreamSkip (s);
+				return false;
+		}
+	} else {
+		/* the previous member's value was consumed */
+		switch (*s->pos) {
+			case ',':
+				++s->pos;
+				PianoJsonStreamSkipSpace (s);
+				break;
+
+			case '}':
+				++s->pos;
+				return false;
+
+			default:
+				PianoJsonStreamFail (s);
+				return false;
+		}
+	}
+
+	if (*s->pos != '"' || (*key = PianoJsonStreamUnescape (s)) == NULL) {
+		PianoJsonStreamFail (s);
+		return false;
+	}
+
+	PianoJsonStreamSkipSpace (s);
+	if (*s->pos != ':') {
+		PianoJsonStreamFail (s);
+		return false;
+	}
+	++s->pos;
+	PianoJsonStreamSkipSpace (s);
+	s->value = s->pos;
+
+	return true;
+}
+
+/*	iterate over array elements, the element must be consumed before the
+ *	next call; values which are not arrays are skipped
+ *	@param stream
+ *	@return true if there is another element
+ */
+bool PianoJsonStreamArrayNext (PianoJsonStream_t *s) {
+	PianoJsonStreamSkipSpace (s);
+
+	if (s->pos == s->value) {
+		/* first call for this value */
+		switch (*s->pos) {
+			case '[':
+				++s->pos;
+				PianoJsonStreamSkipSpace (s);
+				if (*s->pos == ']') {
+					++s->pos;
+					return false;
+				}
+				break;
+
+			case '\0':
+				PianoJsonStreamFail (s);
+				return false;
+
+			default:
+				/* not an array */
+				PianoJsonStreamSkip (s);
+				return false;
+		}
+	} else {
+		/* the previous element was consumed */
+		switch (*s->pos) {
+			case ',':
+				++s->pos;
+				PianoJsonStreamSkipSpace (s);
+				break;
+
+			case ']':
+				++s->pos;
+				return false;
+
+			default:
+				PianoJsonStreamFail (s);
+				return false;
+		}
+	}
+
+	s->value = s->pos;
+	return true;
+}
+
+/*	get string value
+ *	@param stream
+ *	@return string or NULL if the value is not a string
+ */
+char *PianoJsonStreamString (PianoJsonStream_t *s) {
+	switch (PianoJsonStreamType (s)) {
+		case PIANO_JSON_STRING:
+			return PianoJsonStreamUnescape (s);
+
+		case PIANO_JSON_NULL:
+			PianoJsonStreamLiteral (s, "null");
+			return NULL;
+
+		default:
+			PianoJsonStreamSkip (s);
+			return NULL;
+	}
+}
+
+/*	get numeric value, strings are converted
+ *	@param stream
+ *	@return value or 0 if the value is not a number
+ */
+double PianoJsonStreamDouble (PianoJsonStream_t *s) {
+	char *end, *str;
+	double value;
+
+	switch (PianoJsonStreamType (s)) {
+		case PIANO_JSON_NUMBER:
+			value = strtod (s->pos, &end);
+			if (end == s->pos) {
+				PianoJsonStreamFail (s);
+				return 0;
+			}
+			s->pos = end;
+			return value;
+
+		case PIANO_JSON_STRING:
+			str = PianoJsonStreamUnescape (s);
+			return str == NULL ? 0 : strtod (str, NULL);
+
+		case PIANO_JSON_BOOL:
+			return PianoJsonStreamBool (s);
+
+		default:
+			PianoJsonStreamSkip (s);
+			return 0;
+	}
+}
+
+/*	get integer value
+ *	@param stream
+ *	@return value or 0 if the value is not a number
+ */
+long int PianoJsonStreamInt (PianoJsonStream_t *s) {
+	return PianoJsonStreamDouble (s);
+}
+
+/*	get boolean value, like json-c non-zero numbers and non-empty strings are
+ *	true
+ *	@param stream
+ *	@return value
+ */
+bool PianoJsonStreamBool (PianoJsonStream_t *s) {
+	const char *str;
+
+	switch (PianoJsonStreamType (s)) {
+		case PIANO_JSON_BOOL:
+			if (*s->pos == 't') {
+				PianoJsonStreamLiteral (s, "true");
+				return true;
+			} else {
+				PianoJsonStreamLiteral (s, "false");
+				return false;
+			}
+
+		case PIANO_JSON_NUMBER:
+			return PianoJsonStreamDouble (s) != 0;
+
+		case PIANO_JSON_STRING:
+			str = PianoJsonStreamUnescape (s);
+			return str != NULL && *str != '\0';
+
+		default:
+			PianoJsonStreamSkip (s);
+			return false;
+	}
+}
+
+/*	skip value without modifying it
+ *	@param stream
+ */
+void PianoJsonStreamSkip (PianoJsonStream_t *s) {
+	unsigned int depth = 0;
+
+	do {
+		PianoJsonStreamSkipSpace (s);
+
+		switch (*s->pos) {
+			case '{':
+			case '[':
+				++depth;
+				++s->pos;
+				break;
+
+			case '}':
+			case ']':
+				if (depth == 0) {
+					PianoJsonStreamFail (s);
+					return;
+				}
+				--depth;
+				++s->pos;
+				break;
+
+			case ',':
+			case ':':
+				if (depth == 0) {
+					PianoJsonStreamFail (s);
+					return;
+				}
+				++s->pos;
+				break;
+
+			case '"':
+				++s->pos;
+				while (*s->pos != '"') {
+					if (*s->pos == '\\') {
+						++s->pos;
+					}
+					if (*s->pos == '\0') {
+						PianoJsonStreamFail (s);
+						return;
+					}
+					++s->pos;
+				}
+				++s->pos;
+				break;
+
+			case '\0':
+				PianoJsonStreamFail (s);
+				return;
+
+			default:
+				/* number or literal */
+				while (strchr (",:]} \t\r\n", *s->pos) == NULL) {
+					++s->pos;
+				}
+				break;
+		}
+	} while (depth > 0);
+}
+
+/*	decode object described by schema; the object and all its
+ *	PIANO_JSON_FIELD_STRING members are allocated as a single block, released
+ *	by free (object). Objects are returned even if decoding failed halfway, so
+ *	the caller can destroy members allocated by callbacks.
+ *	@param stream
+ *	@param schema
+ *	@param number of schema fields
+ *	@param object size
+ *	@param initial object, NULL for all zero
+ *	@param passed to callbacks
+ *	@return object or NULL if the value is not an object or out of memory
+ */
+void *PianoJsonStreamObject (PianoJsonStream_t *s,
+		const PianoJsonField_t * const fields, const size_t count,
+		const size_t size, const void * const init, void * const data) {
+	union {
+		long double d;
+		void *p;
+		char c[PIANO_JSON_OBJECT_MAX];
+	} object;
+	char *strings[count];
+	size_t total = size;
+	char *key;
+
+	assert (count > 0);
+	assert (size <= sizeof (object.c));
+
+	if (PianoJsonStreamType (s) != PIANO_JSON_OBJECT) {
+		PianoJsonStreamSkip (s);
+		return NULL;
+	}
+
+	if (init != NULL) {
+		memcpy (object.c, init, size);
+	} else {
+		memset (object.c, 0, size);
+	}
+	memset (strings, 0, sizeof (strings));
+
+	while (PianoJsonStreamObjectNext (s, &key)) {
+		size_t i;
+
+		for (i = 0; i < count; i++) {
+			if (fields[i].key != NULL && strcmp (fields[i].key, key) == 0) {
+				break;
+			}
+		}
+		if (i == count) {
+			PianoJsonStreamSkip (s);
+			continue;
+		}
+
+		char * const member = object.c + fields[i].offset;
+		switch (fields[i].type) {
+			case PIANO_JSON_FIELD_STRING:
+			case PIANO_JSON_FIELD_STRDUP:
+				strings[i] = PianoJsonStreamString (s);
+				break;
+
+			case PIANO_JSON_FIELD_BOOL:
+				*member = PianoJsonStreamBool (s);
+				break;
+
+			case PIANO_JSON_FIELD_UINT: {
+				const unsigned int value = PianoJsonStreamInt (s);
+				memcpy (member, &value, sizeof (value));
+				break;
+			}
+
+			case PIANO_JSON_FIELD_FLOAT: {
+				const float value = PianoJsonStreamDouble (s);
+				memcpy (member, &value, sizeof (value));
+				break;
+			}
+
+			case PIANO_JSON_FIELD_PARSE:
+				assert (fields[i].parse != NULL);
+				if (!fields[i].parse (s, object.c, strings, data)) {
+					PianoJsonStreamFail (s);
+				}
+				break;
+		}
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (strings[i] != NULL && fields[i].type == PIANO_JSON_FIELD_STRING) {
+			total += strlen (strings[i]) + 1;
+		}
+	}
+
+	char * const block = malloc (total);
+	if (block == NULL) {
+		s->outOfMemory = true;
+		PianoJsonStreamFail (s);
+		return NULL;
+	}
+	memcpy (block, object.c, size);
+
+	char *pos = block + size;
+	for (size_t i = 0; i < count; i++) {
+		char *copy;
+
+		if (strings[i] == NULL) {
+			continue;
+		} else if (fields[i].type == PIANO_JSON_FIELD_STRING) {
+			const size_t len = strlen (strings[i]) + 1;
+			copy = memcpy (pos, strings[i], len);
+			pos += len;
+		} else {
+			if ((copy = strdup (strings[i])) == NULL) {
+				s->outOfMemory = true;
+				PianoJsonStreamFail (s);
+			}
+		}
+		memcpy (block + fields[i].offset, &copy, sizeof (copy));
+	}
+
+	return block;
+}
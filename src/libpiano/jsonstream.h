@@ -0,0 +1,93 @@
+/*
+Copyright (c) 2013
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef _JSONSTREAM_H
+#define _JSONSTREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* pull decoder working on a writable, NUL-terminated buffer; strings are
+ * unescaped in place and stay valid as long as the buffer */
+typedef struct {
+	char *pos;
+	char *end;
+	/* start of the value the stream was last positioned at, tells
+	 * iterators whether they are starting or in the middle of an
+	 * object/array */
+	char *value;
+	bool error;
+	bool outOfMemory;
+} PianoJsonStream_t;
+
+typedef enum {
+	PIANO_JSON_NONE = 0,
+	PIANO_JSON_OBJECT,
+	PIANO_JSON_ARRAY,
+	PIANO_JSON_STRING,
+	PIANO_JSON_NUMBER,
+	PIANO_JSON_BOOL,
+	PIANO_JSON_NULL,
+} PianoJsonType_t;
+
+typedef enum {
+	/* string copied into the object's allocation */
+	PIANO_JSON_FIELD_STRING = 0,
+	/* string with an allocation of its own */
+	PIANO_JSON_FIELD_STRDUP,
+	PIANO_JSON_FIELD_BOOL, /* char */
+	PIANO_JSON_FIELD_UINT, /* unsigned int */
+	PIANO_JSON_FIELD_FLOAT,
+	PIANO_JSON_FIELD_PARSE,
+} PianoJsonFieldType_t;
+
+/* custom parser for a value, strings can be returned through the object's
+ * string slots, which are indexed like the schema */
+typedef bool (*PianoJsonParseCallback_t) (PianoJsonStream_t *, void *object,
+		char **strings, void *data);
+
+/* maps one key of a json object to a struct member */
+typedef struct {
+	/* NULL for slots only set by callbacks */
+	const char *key;
+	PianoJsonFieldType_t type;
+	size_t offset;
+	PianoJsonParseCallback_t parse;
+} PianoJsonField_t;
+
+/* largest object PianoJsonStreamObject can decode */
+#define PIANO_JSON_OBJECT_MAX 512
+
+void PianoJsonStreamInit (PianoJsonStream_t *, char *);
+PianoJsonType_t PianoJsonStreamType (PianoJsonStream_t *);
+bool PianoJsonStreamObjectNext (PianoJsonStream_t *, char **);
+bool PianoJsonStreamArrayNext (PianoJsonStream_t *);
+char *PianoJsonStreamString (PianoJsonStream_t *);
+long int PianoJsonStreamInt (PianoJsonStream_t *);
+double PianoJsonStreamDouble (PianoJsonStream_t *);
+bool PianoJsonStreamBool (PianoJsonStream_t *);
+void PianoJsonStreamSkip (PianoJsonStream_t *);
+void *PianoJsonStreamObject (PianoJsonStream_t *, const PianoJsonField_t *,
+		size_t, size_t, const void *, void *);
+
+#endif /* _JSONSTREAM_H */
@@ -27,20 +27,29 @@ THE SOFTWARE.
 
 #define PianoListForeach(l) for (; (l) != NULL; (l) = (void *) (l)->next)
 
+/*	turn e into a list of its own
+ */
+static void PianoListInit (PianoListHead_t * const e) {
+	e->next = NULL;
+	e->tail = e;
+	e->count = 1;
+}
+
 /*	append element e to list l, return new list head
  */
 void *PianoListAppend (PianoListHead_t * const l, PianoListHead_t * const e) {
 	assert (e != NULL);
 	assert (e->next == NULL);
 
+	PianoListInit (e);
+
 	if (l == NULL) {
 		return e;
 	} else {
-		PianoListHead_t *curr = l;
-		while (curr->next != NULL) {
-			curr = curr->next;
-		}
-		curr->next = e;
+		assert (l->tail != NULL && l->tail->next == NULL);
+		l->tail->next = e;
+		l->tail = e;
+		++l->count;
 		return l;
 	}
 }
@@ -51,11 +60,18 @@ void *PianoListPrepend (PianoListHead_t * const l, PianoListHead_t * const e) {
 	assert (e != NULL);
 	assert (e->next == NULL);
 
-	e->next = l;
+	PianoListInit (e);
+
+	if (l != NULL) {
+		e->next = l;
+		e->tail = l->tail;
+		e->count = l->count + 1;
+	}
 	return e;
 }
 
-/*	delete element e from list l, return new list head
+/*	delete element e from list l, return new list head; e becomes a list of
+ *	its own
  */
 void *PianoListDelete (PianoListHead_t * const l, PianoListHead_t * const e) {
 	assert (l != NULL);
@@ -67,10 +83,19 @@ void *PianoListDelete (PianoListHead_t * const l, PianoListHead_t * const e) {
 			/* found it! */
 			if (prev != NULL) {
 				prev->next = curr->next;
+				if (l->tail == curr) {
+					l->tail = prev;
+				}
+				--l->count;
 			} else {
-				/* no successor */
+				/* no predecessor, successor becomes the new head */
 				first = curr->next;
+				if (first != NULL) {
+					first->tail = l->tail;
+					first->count = l->count - 1;
+				}
 			}
+			PianoListInit (e);
 			break;
 		}
 		prev = curr;
@@ -85,6 +110,12 @@ void *PianoListGet (PianoListHead_t * const l, const size_t n) {
 	PianoListHead_t *curr = l;
 	size_t i = n;
 
+	if (l == NULL || n >= l->count) {
+		return NULL;
+	} else if (n == l->count - 1) {
+		return l->tail;
+	}
+
 	PianoListForeach (curr) {
 		if (i == 0) {
 			return curr;
@@ -100,13 +131,5 @@ void *PianoListGet (PianoListHead_t * const l, const size_t n) {
 size_t PianoListCount (const PianoListHead_t * const l) {
 	assert (l != NULL);
 
-	size_t count = 0;
-	const PianoListHead_t *curr = l;
-
-	PianoListForeach (curr) {
-		++count;
-	}
-
-	return count;
+	return l->count;
 }
-
@@ -0,0 +1,810 @@
+/*
+Copyright (c) 2008-2013
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* test cases and benchmarks for libpiano */
+
+#ifndef __FreeBSD__
+#define _POSIX_C_SOURCE 200809L /* clock_gettime(), strndup() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <json.h>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define HAVE_MALLINFO2
+#endif
+
+#include "piano.h"
+#include "piano_private.h"
+#include "jsonstream.h"
+#include "crypt.h"
+
+/* number of failed tests */
+static unsigned int failed = 0;
+
+/*	report test result
+ *	@param test passed?
+ *	@param test name
+ */
+static void report (bool ok, const char *name) {
+	if (ok) {
+		printf ("OK for %s\n", name);
+	} else {
+		printf ("FAILED test(s) for %s\n", name);
+		++failed;
+	}
+}
+
+/*	microseconds, monotonic
+ */
+static long long int usNow (void) {
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (long long int) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*	lists
+ */
+
+typedef struct {
+	PianoListHead_t head;
+	size_t value;
+} listItem_t;
+
+/*	walk the list and check it against the bookkeeping in its head
+ *	@param list
+ *	@param expected number of elements
+ *	@param expected first value
+ *	@param expected last value
+ */
+static bool checkList (listItem_t *l, size_t count, size_t first,
+		size_t last) {
+	listItem_t *curr = l, *tail = NULL;
+	size_t n = 0;
+
+	if (l == NULL) {
+		return count == 0;
+	}
+
+	PianoListForeachP (curr) {
+		tail = curr;
+		++n;
+	}
+	return n == count && PianoListCountP (l) == count &&
+			(listItem_t *) l->head.tail == tail && l->value == first &&
+			tail->value == last;
+}
+
+/*	test PianoListAppend, Count, Get and Delete
+ *	@param number of elements
+ */
+static void testList (size_t count) {
+	listItem_t *items = calloc (count, sizeof (*items)), *l = NULL, *e;
+	long long int start, appendElapsed, getElapsed;
+	char name[64];
+	bool ok = true;
+
+	start = usNow ();
+	for (size_t i = 0; i < count; i++) {
+		items[i].value = i;
+		l = PianoListAppendP (l, &items[i]);
+	}
+	appendElapsed = usNow () - start;
+	ok = ok && checkList (l, count, 0, count-1);
+
+	start = usNow ();
+	for (size_t i = 0; i < count; i++) {
+		/* the last element is the one an append-heavy caller looks up */
+		ok = ok && PianoListGetP (l, count-1) == &items[count-1];
+	}
+	getElapsed = usNow () - start;
+	ok = ok && PianoListGetP (l, 0) == &items[0] &&
+			PianoListGetP (l, count/2) == &items[count/2] &&
+			PianoListGetP (l, count) == NULL;
+	snprintf (name, sizeof (name), "list of %zu (append, get)", count);
+	report (ok, name);
+	printf ("  %zu appends in %.3f ms, %zu gets of the last element in "
+			"%.3f ms\n", count, appendElapsed / 1000.0, count,
+			getElapsed / 1000.0);
+
+	/* head: the successor inherits tail and count */
+	ok = true;
+	l = PianoListDeleteP (l, &items[0]);
+	ok = ok && checkList (l, count-1, 1, count-1) &&
+			items[0].head.next == NULL && PianoListCountP (&items[0]) == 1 &&
+			PianoListGetP (l, 0) == &items[1];
+	/* tail: the predecessor becomes the tail */
+	l = PianoListDeleteP (l, &items[count-1]);
+	ok = ok && checkList (l, count-2, 1, count-2) &&
+			PianoListGetP (l, count-3) == &items[count-2] &&
+			PianoListGetP (l, count-2) == NULL;
+	/* somewhere in between */
+	l = PianoListDeleteP (l, &items[count/2]);
+	ok = ok && checkList (l, count-3, 1, count-2) &&
+			PianoListGetP (l, count/2-1) == &items[count/2+1];
+	/* appending after deleting the tail must not resurrect it */
+	l = PianoListAppendP (l, &items[count/2]);
+	ok = ok && checkList (l, count-2, 1, count/2);
+	/* and prepending after deleting the head */
+	l = PianoListPrependP (l, &items[0]);
+	ok = ok && checkList (l, count-1, 0, count/2);
+	snprintf (name, sizeof (name), "list of %zu (delete)", count);
+	report (ok, name);
+
+	/* drain from the front */
+	ok = true;
+	start = usNow ();
+	for (size_t n = count-1; n > 0; n--) {
+		e = l;
+		l = PianoListDeleteP (l, e);
+		ok = ok && (n == 1 ? l == NULL : PianoListCountP (l) == n-1);
+	}
+	snprintf (name, sizeof (name), "list of %zu (drain)", count);
+	report (ok && l == NULL, name);
+	printf ("  %zu deletes of the head in %.3f ms\n", count-1,
+			(usNow () - start) / 1000.0);
+
+	free (items);
+}
+
+/*	json stream decoder
+ */
+
+/*	test in-place string decoding
+ *	@param json string, with quotes
+ *	@param expected result, NULL if decoding must fail
+ */
+static void compareJsonString (const char *in, const char *expected) {
+	char *buf = strdup (in), *out;
+	PianoJsonStream_t s;
+	bool ok;
+
+	PianoJsonStreamInit (&s, buf);
+	out = PianoJsonStreamString (&s);
+	ok = expected == NULL ? (out == NULL && s.error) :
+			(out != NULL && !s.error && strcmp (out, expected) == 0);
+	report (ok, in);
+
+	free (buf);
+}
+
+/*	test PianoJsonStreamSkip
+ *	@param json value
+ *	@param value is complete and valid
+ */
+static void compareJsonSkip (const char *in, bool valid) {
+	char *buf = strdup (in);
+	PianoJsonStream_t s;
+
+	PianoJsonStreamInit (&s, buf);
+	PianoJsonStreamSkip (&s);
+	report (s.error != valid && s.pos == s.end, in);
+
+	free (buf);
+}
+
+/*	responses
+ */
+
+/* user.getStationList: result before stat, escapes, a quickmix referring to
+ * stations that come after it, unknown and null values */
+static const char stationsFixture[] = "{\"result\": {\"stations\": ["
+		"{\"stationName\": \"Quick\\u004dix\", \"stationToken\": \"1\", "
+		"\"isQuickMix\": true, \"isShared\": false, "
+		"\"quickMixStationIds\": [\"3\", \"2\", \"missing\"], "
+		"\"extra\": {\"a\": [1, 2.5e3, {\"b\": \"}]\\\"\"}, true, null]}}, "
+		"{\"stationName\": \"Caf\\u00e9 \\ud83c\\udfb5\", "
+		"\"stationToken\": \"2\", \"isShared\": true}, "
+		"{\"stationToken\": \"3\", \"stationName\": \"Three\"}, "
+		"{\"stationToken\": \"4\", \"stationName\": \"F\\/o\\\"ur\"}, null], "
+		"\"checksum\": \"x\"}, \"stat\": \"ok\"}";
+
+/* station.getPlaylist: ad tokens, only high quality for every song */
+static const char playlistFixture[] = "{\"stat\": \"ok\", \"result\": {"
+		"\"items\": [{\"adToken\": \"a1\"}, "
+		"{\"artistName\": \"A\", \"albumName\": \"B\", \"songName\": \"C\\nD\", "
+		"\"trackToken\": \"t\", \"stationId\": \"2\", "
+		"\"albumArtUrl\": \"http:\\/\\/a\", \"trackGain\": \"-3.25\", "
+		"\"trackLength\": 245, \"songRating\": 1, \"audioUrlMap\": {"
+		"\"lowQuality\": {\"audioUrl\": \"l\", \"encoding\": \"aacplus\"}, "
+		"\"highQuality\": {\"bitrate\": \"192\", \"encoding\": \"mp3\", "
+		"\"audioUrl\": \"http:\\/\\/h\\/x?a=1\"}}}, "
+		"{\"adToken\": \"a2\"}, "
+		"{\"artistName\": \"D\", \"songRating\": 0, \"audioUrlMap\": {"
+		"\"highQuality\": {\"audioUrl\": \"u\", \"encoding\": \"aacplus\"}}}"
+		"]}}";
+
+/* station.getGenreStations */
+static const char genresFixture[] = "{\"stat\": \"ok\", \"result\": {"
+		"\"categories\": [{\"stations\": [{\"stationName\": \"G1\", "
+		"\"stationToken\": \"g1\"}, {\"stationName\": \"G2\", "
+		"\"stationToken\": \"g2\"}], \"categoryName\": \"Cat1\"}, "
+		"{\"categoryName\": \"Cat2\", \"stations\": []}]}}";
+
+/*	decode response, responseData is modified, so it's decoded from a copy
+ *	@param piano handle
+ *	@param request type
+ *	@param request data
+ *	@param json text
+ *	@param decode at most that many bytes of it
+ */
+static PianoReturn_t decodeResponse (PianoHandle_t *ph,
+		PianoRequestType_t type, void *data, const char *json, size_t size) {
+	PianoRequest_t req;
+	PianoReturn_t ret;
+
+	memset (&req, 0, sizeof (req));
+	req.type = type;
+	req.data = data;
+	req.responseData = strndup (json, size);
+	ret = PianoResponse (ph, &req);
+	free (req.responseData);
+
+	return ret;
+}
+
+/*	string equality test (memory location or content)
+ */
+static bool streqtest (const char *x, const char *y) {
+	return (x == y) || (x != NULL && y != NULL && strcmp (x, y) == 0);
+}
+
+/*	check station
+ *	@param station
+ *	@param name
+ *	@param id
+ *	@param isCreator, isQuickMix and useQuickMix
+ */
+static bool checkStation (const PianoStation_t *station, const char *name,
+		const char *id, char isCreator, char isQuickMix, char useQuickMix) {
+	return station != NULL && streqtest (station->name, name) &&
+			streqtest (station->id, id) && station->isCreator == isCreator &&
+			station->isQuickMix == isQuickMix &&
+			station->useQuickMix == useQuickMix;
+}
+
+static void testStations (void) {
+	PianoHandle_t ph;
+	PianoStation_t *station;
+	PianoReturn_t ret;
+	size_t truncated = 0, rejected = 0;
+
+	memset (&ph, 0, sizeof (ph));
+	ret = decodeResponse (&ph, PIANO_REQUEST_GET_STATIONS, NULL,
+			stationsFixture, sizeof (stationsFixture));
+	station = ph.stations;
+	report (ret == PIANO_RET_OK && PianoListCountP (station) == 4 &&
+			checkStation (PianoListGetP (station, 0), "QuickMix", "1",
+			1, 1, 0) &&
+			checkStation (PianoListGetP (station, 1),
+			"Caf\xc3\xa9 \xf0\x9f\x8e\xb5", "2", 0, 0, 1) &&
+			checkStation (PianoListGetP (station, 2), "Three", "3",
+			1, 0, 1) &&
+			checkStation (PianoListGetP (station, 3), "F/o\"ur", "4",
+			1, 0, 0) &&
+			PianoFindStationById (&ph, "3") == PianoListGetP (station, 2) &&
+			PianoFindStationById (&ph, "missing") == NULL,
+			"user.getStationList");
+
+	/* every prefix is invalid and must leave the station list alone */
+	for (size_t i = 0; i < sizeof (stationsFixture) - 1; i++) {
+		if (decodeResponse (&ph, PIANO_REQUEST_GET_STATIONS, NULL,
+				stationsFixture, i) == PIANO_RET_INVALID_RESPONSE &&
+				PianoListCountP (ph.stations) == 4) {
+			++truncated;
+		}
+	}
+	report (truncated == sizeof (stationsFixture) - 1,
+			"user.getStationList (truncated)");
+
+	ret = decodeResponse (&ph, PIANO_REQUEST_GET_STATIONS, NULL,
+			"{\"stat\": \"fail\", \"message\": \"x\", \"code\": 1001}",
+			(size_t) -1);
+	report (ret == PIANO_RET_P_INVALID_AUTH_TOKEN,
+			"user.getStationList (error code)");
+	ret = decodeResponse (&ph, PIANO_REQUEST_GET_STATIONS, NULL,
+			"{\"result\": {\"stations\": []}}", (size_t) -1);
+	report (ret == PIANO_RET_INVALID_RESPONSE &&
+			PianoListCountP (ph.stations) == 4,
+			"user.getStationList (no status)");
+
+	/* json-c rejects them, so must we, instead of dropping the rest */
+	static const char * const missingComma[] = {
+			"{\"stat\": \"ok\", \"result\": {\"stations\": ["
+			"{\"stationName\": \"A\", \"stationToken\": \"5\"}]} "
+			"\"extra\": 1}",
+			"{\"stat\": \"ok\", \"result\": {\"stations\": ["
+			"{\"stationName\": \"A\", \"stationToken\": \"5\"}] "
+			"\"checksum\": \"x\"}}",
+			"{\"stat\": \"ok\", \"result\": {\"stations\": ["
+			"{\"stationName\": \"A\" \"stationToken\": \"1\"}]}}",
+			"{\"stat\": \"ok\", \"result\": {\"stations\": ["
+			"{\"stationName\": \"A\", \"stationToken\": \"1\"} "
+			"{\"stationName\": \"B\", \"stationToken\": \"2\"}]}}",
+			};
+	for (size_t i = 0; i < sizeof (missingComma) / sizeof (*missingComma);
+			i++) {
+		if (decodeResponse (&ph, PIANO_REQUEST_GET_STATIONS, NULL,
+				missingComma[i], (size_t) -1) == PIANO_RET_INVALID_RESPONSE &&
+				PianoListCountP (ph.stations) == 4) {
+			++rejected;
+		}
+	}
+	report (rejected == sizeof (missingComma) / sizeof (*missingComma),
+			"user.getStationList (missing comma)");
+
+	PianoDestroy (&ph);
+}
+
+/*	check song
+ *	@param song
+ *	@param artist
+ *	@param title
+ *	@param audio url
+ *	@param audio format
+ *	@param rating
+ */
+static bool checkSong (const PianoSong_t *song, const char *artist,
+		const char *title, const char *audioUrl, PianoAudioFormat_t format,
+		PianoSongRating_t rating) {
+	return song != NULL && streqtest (song->artist, artist) &&
+			streqtest (song->title, title) &&
+			streqtest (song->audioUrl, audioUrl) &&
+			song->audioFormat == format && song->rating == rating;
+}
+
+static void testPlaylist (void) {
+	PianoHandle_t ph;
+	PianoRequestDataGetPlaylist_t reqData = {NULL, PIANO_AQ_HIGH, NULL};
+	PianoSong_t *song;
+	PianoReturn_t ret;
+	size_t truncated = 0;
+
+	memset (&ph, 0, sizeof (ph));
+	ret = decodeResponse (&ph, PIANO_REQUEST_GET_PLAYLIST, &reqData,
+			playlistFixture, sizeof (playlistFixture));
+	song = reqData.retPlaylist;
+	report (ret == PIANO_RET_OK && PianoListCountP (song) == 2 &&
+			checkSong (song, "A", "C\nD", "http://h/x?a=1", PIANO_AF_MP3,
+			PIANO_RATE_LOVE) &&
+			streqtest (song->album, "B") &&
+			streqtest (song->trackToken, "t") &&
+			streqtest (song->stationId, "2") &&
+			streqtest (song->coverArt, "http://a") &&
+			song->detailUrl == NULL && song->fileGain == -3.25f &&
+			song->length == 245 &&
+			checkSong (PianoListNextP (song), "D", NULL, "u",
+			PIANO_AF_AACPLUS, PIANO_RATE_NONE),
+			"station.getPlaylist");
+	PianoDestroyPlaylist (reqData.retPlaylist);
+
+	/* the second song has no low quality url */
+	reqData.quality = PIANO_AQ_LOW;
+	reqData.retPlaylist = NULL;
+	ret = decodeResponse (&ph, PIANO_REQUEST_GET_PLAYLIST, &reqData,
+			playlistFixture, sizeof (playlistFixture));
+	report (ret == PIANO_RET_QUALITY_UNAVAILABLE &&
+			reqData.retPlaylist == NULL,
+			"station.getPlaylist (missing quality)");
+
+	reqData.quality = PIANO_AQ_HIGH;
+	for (size_t i = 0; i < sizeof (playlistFixture) - 1; i++) {
+		if (decodeResponse (&ph, PIANO_REQUEST_GET_PLAYLIST, &reqData,
+				playlistFixture, i) == PIANO_RET_INVALID_RESPONSE &&
+				reqData.retPlaylist == NULL) {
+			++truncated;
+		}
+	}
+	report (truncated == sizeof (playlistFixture) - 1,
+			"station.getPlaylist (truncated)");
+
+	PianoDestroy (&ph);
+}
+
+static void testGenres (void) {
+	PianoHandle_t ph;
+	PianoGenreCategory_t *category;
+	PianoReturn_t ret;
+
+	memset (&ph, 0, sizeof (ph));
+	ret = decodeResponse (&ph, PIANO_REQUEST_GET_GENRE_STATIONS, NULL,
+			genresFixture, sizeof (genresFixture));
+	category = ph.genreStations;
+	report (ret == PIANO_RET_OK && PianoListCountP (category) == 2 &&
+			streqtest (category->name, "Cat1") &&
+			PianoListCountP (category->genres) == 2 &&
+			streqtest (category->genres->name, "G1") &&
+			streqtest (category->genres->musicId, "g1") &&
+			streqtest (((PianoGenre_t *) PianoListNextP (
+			category->genres))->musicId, "g2") &&
+			streqtest (((PianoGenreCategory_t *) PianoListNextP (
+			category))->name, "Cat2") &&
+			((PianoGenreCategory_t *) PianoListNextP (category))->genres ==
+			NULL, "station.getGenreStations");
+
+	ret = decodeResponse (&ph, PIANO_REQUEST_GET_GENRE_STATIONS, NULL,
+			"{\"stat\": \"ok\", \"result\": {\"categories\": [{"
+			"\"categoryName\": \"X\", \"stations\": [{\"stationName\": \"G1\" "
+			"\"x\"}]}]}}", (size_t) -1);
+	report (ret == PIANO_RET_INVALID_RESPONSE &&
+			PianoListCountP (ph.genreStations) == 2,
+			"station.getGenreStations (invalid)");
+
+	PianoDestroy (&ph);
+}
+
+/*	heap in use, if the C library can tell. Neither decoder frees much
+ *	before it returns (json-c's tokener, a resized station index), so the
+ *	heap in use at the end of decoding is close to its peak.
+ */
+static size_t heapInUse (void) {
+	#ifdef HAVE_MALLINFO2
+	const struct mallinfo2 info = mallinfo2 ();
+	return info.uordblks + info.hblkhd;
+	#else
+	return 0;
+	#endif
+}
+
+/*	user.getStationList response with many stations, most of each station is
+ *	not used by libpiano
+ *	@param number of stations
+ *	@return json text
+ */
+static char *makeStations (size_t count) {
+	const size_t size = 1024 + count * 1024;
+	char *json = malloc (size), *pos = json;
+
+	pos += sprintf (pos, "{\"stat\": \"ok\", \"result\": {\"stations\": [");
+	for (size_t i = 0; i < count; i++) {
+		pos += sprintf (pos, "%s{\"suppressVideoAds\": false, "
+				"\"isQuickMix\": %s, \"stationId\": \"%zu\", "
+				"\"allowDelete\": true, \"isShared\": false, "
+				"\"dateCreated\": {\"date\": 1, \"month\": 2, \"year\": 113, "
+				"\"time\": 1357000000000}, \"stationToken\": \"%zu\", "
+				"\"stationName\": \"Station \\u00e9 %zu\", "
+				"\"stationDetailUrl\": \"https:\\/\\/www.example.com\\/"
+				"station\\/%zu\", \"genre\": [\"Rock\", \"Pop\"], "
+				"\"allowRename\": true, \"allowAddMusic\": true",
+				i == 0 ? "" : ", ", i == 0 ? "true" : "false", i, i, i, i);
+		if (i == 0) {
+			pos += sprintf (pos, ", \"quickMixStationIds\": [");
+			for (size_t j = 1; j < count && j < 100; j++) {
+				pos += sprintf (pos, "%s\"%zu\"", j == 1 ? "" : ", ", j);
+			}
+			pos += sprintf (pos, "]");
+		}
+		pos += sprintf (pos, "}");
+		assert ((size_t) (pos - json) < size - 1024);
+	}
+	sprintf (pos, "], \"checksum\": \"0\"}}");
+
+	return json;
+}
+
+/*	decode user.getStationList with json-c, the way PianoResponse did before
+ *	it used PianoJsonStream_t
+ *	@param piano handle
+ *	@param json text
+ *	@param heap in use while the object tree is alive
+ */
+static PianoReturn_t jsoncStations (PianoHandle_t *ph, const char *json,
+		size_t *heap) {
+	json_object *j = json_tokener_parse (json), *stations, *mix = NULL;
+
+	if (j == NULL) {
+		return PIANO_RET_INVALID_RESPONSE;
+	}
+	stations = json_object_object_get (json_object_object_get (j, "result"),
+			"stations");
+
+	for (size_t i = 0; i < json_object_array_length (stations); i++) {
+		json_object *s = json_object_array_get_idx (stations, i);
+		PianoStation_t *station;
+
+		if ((station = calloc (1, sizeof (*station))) == NULL) {
+			json_object_put (j);
+			return PIANO_RET_OUT_OF_MEMORY;
+		}
+		station->name = strdup (json_object_get_string (
+				json_object_object_get (s, "stationName")));
+		station->id = strdup (json_object_get_string (
+				json_object_object_get (s, "stationToken")));
+		station->isCreator = !json_object_get_boolean (
+				json_object_object_get (s, "isShared"));
+		station->isQuickMix = json_object_get_boolean (
+				json_object_object_get (s, "isQuickMix"));
+		if (station->isQuickMix) {
+			mix = json_object_object_get (s, "quickMixStationIds");
+		}
+		ph->stations = PianoListAppendP (ph->stations, station);
+		PianoStationIndexAdd (ph, station);
+	}
+
+	if (mix != NULL) {
+		for (size_t i = 0; i < json_object_array_length (mix); i++) {
+			PianoStation_t *station = PianoFindStationById (ph,
+					json_object_get_string (json_object_array_get_idx (mix,
+					i)));
+			if (station != NULL) {
+				station->useQuickMix = true;
+			}
+		}
+	}
+
+	*heap = heapInUse ();
+	json_object_put (j);
+	return PIANO_RET_OK;
+}
+
+/*	benchmark: decode user.getStationList with PianoJsonStream_t and json-c
+ *	@param number of stations
+ *	@param number of rounds
+ */
+static void benchStations (size_t count, unsigned int rounds) {
+	char * const json = makeStations (count);
+	const size_t size = strlen (json);
+	long long int streamElapsed = 0, jsoncElapsed = 0;
+	size_t streamHeap = 0, jsoncHeap = 0;
+	char name[64];
+	bool ok = true;
+
+	for (unsigned int i = 0; i < rounds; i++) {
+		PianoHandle_t ph;
+		PianoRequest_t req;
+		size_t base, heap = 0;
+		long long int start;
+
+		/* the stream decoder works in place, copying is not part of it */
+		memset (&ph, 0, sizeof (ph));
+		memset (&req, 0, sizeof (req));
+		req.type = PIANO_REQUEST_GET_STATIONS;
+		req.responseData = strdup (json);
+		base = heapInUse ();
+		start = usNow ();
+		ok = ok && PianoResponse (&ph, &req) == PIANO_RET_OK;
+		streamElapsed += usNow () - start;
+		streamHeap = heapInUse () - base;
+		ok = ok && ph.stations != NULL &&
+				PianoListCountP (ph.stations) == count;
+		free (req.responseData);
+		PianoDestroy (&ph);
+
+		memset (&ph, 0, sizeof (ph));
+		base = heapInUse ();
+		start = usNow ();
+		ok = ok && jsoncStations (&ph, json, &heap) == PIANO_RET_OK;
+		jsoncElapsed += usNow () - start;
+		jsoncHeap = heap - base;
+		ok = ok && ph.stations != NULL &&
+				PianoListCountP (ph.stations) == count;
+		PianoDestroy (&ph);
+	}
+
+	snprintf (name, sizeof (name), "user.getStationList of %zu stations "
+			"(benchmark)", count);
+	report (ok, name);
+	printf ("  %zu bytes, stream %.3f ms, json-c %.3f ms per response\n",
+			size, streamElapsed / 1000.0 / rounds,
+			jsoncElapsed / 1000.0 / rounds);
+	#ifdef HAVE_MALLINFO2
+	printf ("  peak heap, without the response: stream %zu KiB, json-c "
+			"%zu KiB\n", streamHeap / 1024, jsoncHeap / 1024);
+	#endif
+
+	free (json);
+}
+
+/*	encryption
+ */
+
+/*	open blowfish handle
+ *	@param key
+ */
+static gcry_cipher_hd_t openCipher (const char *key) {
+	gcry_cipher_hd_t h = NULL;
+
+	if (gcry_cipher_open (&h, GCRY_CIPHER_BLOWFISH, GCRY_CIPHER_MODE_ECB,
+			0) != GPG_ERR_NO_ERROR || gcry_cipher_setkey (h,
+			(const unsigned char *) key, strlen (key)) != GPG_ERR_NO_ERROR) {
+		gcry_cipher_close (h);
+		return NULL;
+	}
+	return h;
+}
+
+/*	test PianoEncryptString against known ciphertext and decrypt it again
+ *	@param key
+ *	@param plaintext
+ *	@param expected hex-encoded ciphertext, plaintext is padded to 8 bytes
+ */
+static void compareCrypt (const char *key, const char *in,
+		const char *expected) {
+	gcry_cipher_hd_t h = openCipher (key);
+	char *out = NULL, *decrypted = NULL;
+	size_t size = 0, padded = (strlen (in) + 7) / 8 * 8;
+	bool ok;
+
+	if (h != NULL) {
+		out = PianoEncryptString (h, in);
+		if (out != NULL) {
+			decrypted = PianoDecryptString (h, out, &size);
+		}
+	}
+	ok = out != NULL && strcmp (out, expected) == 0 && decrypted != NULL &&
+			size == padded && strncmp (decrypted, in, padded) == 0 &&
+			decrypted[size] == '\0';
+	report (ok, expected);
+	if (!ok) {
+		printf ("%s vs %s\n", out, expected);
+	}
+
+	free (out);
+	free (decrypted);
+	gcry_cipher_close (h);
+}
+
+/*	test PianoDecryptString
+ *	@param key
+ *	@param hex-encoded ciphertext
+ *	@param expected plaintext, NULL if decryption must fail
+ */
+static void compareDecrypt (const char *key, const char *in,
+		const char *expected) {
+	gcry_cipher_hd_t h = openCipher (key);
+	char *out = NULL;
+	size_t size = 0;
+	bool ok;
+
+	if (h != NULL) {
+		out = PianoDecryptString (h, in, &size);
+	}
+	ok = h != NULL && (expected == NULL ? out == NULL :
+			(out != NULL && size == strlen (expected) &&
+			memcmp (out, expected, size + 1) == 0));
+	report (ok, in);
+
+	free (out);
+	gcry_cipher_close (h);
+}
+
+/*	benchmark: encrypt and decrypt a request-sized string
+ *	@param string length
+ *	@param number of rounds
+ */
+static void benchCrypt (size_t size, unsigned int rounds) {
+	gcry_cipher_hd_t h = openCipher ("6#26FRL$ZWD");
+	char * const in = malloc (size + 1);
+	long long int start, encryptElapsed = 0, decryptElapsed = 0;
+	bool ok = h != NULL;
+
+	for (size_t i = 0; i < size; i++) {
+		in[i] = 'a' + i % 26;
+	}
+	in[size] = '\0';
+
+	for (unsigned int i = 0; ok && i < rounds; i++) {
+		char *encrypted, *decrypted;
+		size_t decryptedSize;
+
+		start = usNow ();
+		encrypted = PianoEncryptString (h, in);
+		encryptElapsed += usNow () - start;
+		ok = encrypted != NULL;
+
+		start = usNow ();
+		decrypted = ok ? PianoDecryptString (h, encrypted,
+				&decryptedSize) : NULL;
+		decryptElapsed += usNow () - start;
+		ok = ok && decrypted != NULL && memcmp (decrypted, in, size) == 0;
+
+		free (encrypted);
+		free (decrypted);
+	}
+
+	report (ok, "encryption throughput");
+	printf ("  %zu bytes, encrypt %.1f MB/s, decrypt %.1f MB/s\n", size,
+			encryptElapsed > 0 ? (double) size * rounds / encryptElapsed : 0.0,
+			decryptElapsed > 0 ? (double) size * rounds / decryptElapsed : 0.0);
+
+	free (in);
+	gcry_cipher_close (h);
+}
+
+int main () {
+	gcry_check_version (NULL);
+	gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+	gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	testList (1000);
+	testList (10000);
+
+	compareJsonString ("\"\"", "");
+	compareJsonString ("\"a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\"",
+			"a\"b\\c/d\b\f\n\r\t");
+	compareJsonString ("\"\\u0041\\u00e9\\u20AC\"", "A\xc3\xa9\xe2\x82\xac");
+	compareJsonString ("\"\\ud83c\\udfb5\"", "\xf0\x9f\x8e\xb5");
+	/* unpaired surrogates are replaced */
+	compareJsonString ("\"\\ud83cx\"", "\xef\xbf\xbdx");
+	compareJsonString ("\"\\udfb5\\ud83c\"", "\xef\xbf\xbd\xef\xbf\xbd");
+	compareJsonString ("\"\\ud83c\\u0041\"", "\xef\xbf\xbd" "A");
+	compareJsonString ("\"\\x\"", NULL);
+	compareJsonString ("\"\\u00g1\"", NULL);
+	compareJsonString ("\"\\u00", NULL);
+	compareJsonString ("\"abc", NULL);
+	compareJsonString ("\"abc\\\"", NULL);
+
+	compareJsonSkip ("{\"a\": [1, -2.5e3, {\"b\": \"}]\\\"\"}, true, null], "
+			"\"c\": {}}", true);
+	compareJsonSkip ("[[[[]]], {}]", true);
+	compareJsonSkip ("{\"a\": [1, 2", false);
+	compareJsonSkip ("{\"a\": \"b", false);
+	compareJsonSkip ("{\"a\": \"b\\\"}", false);
+	compareJsonSkip ("]", false);
+	compareJsonSkip ("", false);
+
+	testStations ();
+	testPlaylist ();
+	testGenres ();
+
+	benchStations (2000, 20);
+
+	/* published blowfish test vectors */
+	compareCrypt ("abcdefghijklmnopqrstuvwxyz", "BLOWFISH",
+			"324ed0fef413a203");
+	compareCrypt ("Who is John Galt?", "\xfe\xdc\xba\x98\x76\x54\x32\x10",
+			"cc91732b8022f684");
+	/* ecb, so blocks repeat */
+	compareCrypt ("abcdefghijklmnopqrstuvwxyz", "BLOWFISHBLOWFISH",
+			"324ed0fef413a203324ed0fef413a203");
+	/* zero padding */
+	compareCrypt ("abcdefghijklmnopqrstuvwxyz", "BLOW", "a8fd418ad47505f5");
+
+	compareDecrypt ("abcdefghijklmnopqrstuvwxyz", "324ED0FEF413A203",
+			"BLOWFISH");
+	compareDecrypt ("abcdefghijklmnopqrstuvwxyz", "", "");
+	compareDecrypt ("abcdefghijklmnopqrstuvwxyz", "324ed0fef413a20", NULL);
+	compareDecrypt ("abcdefghijklmnopqrstuvwxyz", "324ed0fef413a2031", NULL);
+	compareDecrypt ("abcdefghijklmnopqrstuvwxyz", "324ed0fef413a2g3", NULL);
+	compareDecrypt ("abcdefghijklmnopqrstuvwxyz", "zz4ed0fef413a203", NULL);
+	compareDecrypt ("abcdefghijklmnopqrstuvwxyz", "324ed0fe f413a203", NULL);
+	/* not a multiple of the block size */
+	compareDecrypt ("abcdefghijklmnopqrstuvwxyz", "324ed0fe", NULL);
+
+	benchCrypt (4096, 5000);
+
+	if (failed > 0) {
+		printf ("%u test(s) FAILED\n", failed);
+		return EXIT_FAILURE;
+	}
+
+	/* done */
+	return EXIT_SUCCESS;
+}
@@ -76,9 +76,7 @@ static void PianoDestroyArtists (PianoArtist_t *artists) {
 
 	curArtist = artists;
 	while (curArtist != NULL) {
-		free (curArtist->name);
-		free (curArtist->musicId);
-		free (curArtist->seedId);
+		/* strings are part of the artist's allocation */
 		lastArtist = curArtist;
 		curArtist = (PianoArtist_t *) curArtist->head.next;
 		free (lastArtist);
@@ -107,7 +105,7 @@ void PianoDestroyStation (PianoStation_t *station) {
 /*	free complete station list
  *	@param piano handle
  */
-static void PianoDestroyStations (PianoStation_t *stations) {
+void PianoDestroyStations (PianoStation_t *stations) {
 	PianoStation_t *curStation, *lastStation;
 
 	curStation = stations;
@@ -129,19 +127,7 @@ void PianoDestroyPlaylist (PianoSong_t *playlist) {
 
 	curSong = playlist;
 	while (curSong != NULL) {
-		free (curSong->audioUrl);
-		free (curSong->coverArt);
-		free (curSong->artist);
-		free (curSong->musicId);
-		free (curSong->title);
-		free (curSong->stationId);
-		free (curSong->album);
-		free (curSong->feedbackId);
-		free (curSong->seedId);
-		free (curSong->detailUrl);
-		free (curSong->songExplorerUrl);
-		free (curSong->albumExplorerUrl);
-		free (curSong->trackToken);
+		/* strings are part of the song's allocation */
 		lastSong = curSong;
 		curSong = (PianoSong_t *) curSong->head.next;
 		free (lastSong);
@@ -162,14 +148,27 @@ static void PianoDestroyGenres (PianoGenre_t *genres) {
 
 	curGenre = genres;
 	while (curGenre != NULL) {
-		free (curGenre->name);
-		free (curGenre->musicId);
+		/* strings are part of the genre's allocation */
 		lastGenre = curGenre;
 		curGenre = (PianoGenre_t *) curGenre->head.next;
 		free (lastGenre);
 	}
 }
 
+/*	destroy genre categories and their genres
+ */
+void PianoDestroyGenreCategories (PianoGenreCategory_t *categories) {
+	PianoGenreCategory_t *curGenreCat = categories, *lastGenreCat;
+
+	while (curGenreCat != NULL) {
+		PianoDestroyGenres (curGenreCat->genres);
+		/* name is part of the category's allocation */
+		lastGenreCat = curGenreCat;
+		curGenreCat = (PianoGenreCategory_t *) curGenreCat->head.next;
+		free (lastGenreCat);
+	}
+}
+
 /*	destroy user information
  */
 void PianoDestroyUserInfo (PianoUserInfo_t *user) {
@@ -196,16 +195,9 @@ static void PianoDestroyPartner (PianoPartner_t *partner) {
 void PianoDestroy (PianoHandle_t *ph) {
 	PianoDestroyUserInfo (&ph->user);
 	PianoDestroyStations (ph->stations);
+	free (ph->stationIndex);
 	PianoDestroyPartner (&ph->partner);
-	/* destroy genre stations */
-	PianoGenreCategory_t *curGenreCat = ph->genreStations, *lastGenreCat;
-	while (curGenreCat != NULL) {
-		PianoDestroyGenres (curGenreCat->genres);
-		free (curGenreCat->name);
-		lastGenreCat = curGenreCat;
-		curGenreCat = (PianoGenreCategory_t *) curGenreCat->head.next;
-		free (lastGenreCat);
-	}
+	PianoDestroyGenreCategories (ph->genreStations);
 	memset (ph, 0, sizeof (*ph));
 }
 
@@ -218,16 +210,130 @@ void PianoDestroyRequest (PianoRequest_t *req) {
 	memset (req, 0, sizeof (*req));
 }
 
-/*	get station from list by id
- *	@param search here
+/*	FNV-1a hash of station id
+ *	@param station id
+ *	@return hash
+ */
+static size_t PianoStationIndexHash (const char *id) {
+	uint32_t hash = 2166136261u;
+
+	for (; *id != '\0'; ++id) {
+		hash ^= (unsigned char) *id;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/*	append station to the end of its bucket, stations found earlier in the
+ *	list are found first
+ *	@param index
+ *	@param index size, power of two
+ *	@param station
+ */
+static void PianoStationIndexInsert (PianoStation_t **index, size_t size,
+		PianoStation_t *station) {
+	if (station->id == NULL) {
+		return;
+	}
+
+	PianoStation_t **bucket =
+			&index[PianoStationIndexHash (station->id) & (size-1)];
+
+	while (*bucket != NULL) {
+		bucket = &(*bucket)->indexNext;
+	}
+	station->indexNext = NULL;
+	*bucket = station;
+}
+
+/*	add station, which must already be part of ph->stations, to station index;
+ *	the index is rebuilt from the station list when it grows
+ *	@param piano handle
+ *	@param station
+ */
+void PianoStationIndexAdd (PianoHandle_t *ph, PianoStation_t *station) {
+	assert (ph != NULL);
+	assert (station != NULL);
+
+	const size_t count = PianoListCountP (ph->stations);
+
+	if (count > ph->stationIndexSize) {
+		size_t size = ph->stationIndexSize == 0 ? 64 :
+				ph->stationIndexSize * 2;
+		while (size < count) {
+			size *= 2;
+		}
+
+		PianoStation_t **index = calloc (size, sizeof (*index));
+		if (index != NULL) {
+			PianoStation_t *curStation = ph->stations;
+			PianoListForeachP (curStation) {
+				PianoStationIndexInsert (index, size, curStation);
+			}
+			free (ph->stationIndex);
+			ph->stationIndex = index;
+			ph->stationIndexSize = size;
+			return;
+		} else if (ph->stationIndex == NULL) {
+			/* PianoFindStationById falls back to searching the list */
+			return;
+		}
+		/* out of memory, keep using the old index with longer buckets */
+	}
+
+	PianoStationIndexInsert (ph->stationIndex, ph->stationIndexSize,
+			station);
+}
+
+/*	remove station from station index
+ *	@param piano handle
+ *	@param station
+ */
+void PianoStationIndexRemove (PianoHandle_t *ph, PianoStation_t *station) {
+	assert (ph != NULL);
+	assert (station != NULL);
+
+	if (ph->stationIndex == NULL || station->id == NULL) {
+		return;
+	}
+
+	PianoStation_t **bucket = &ph->stationIndex[
+			PianoStationIndexHash (station->id) & (ph->stationIndexSize-1)];
+	while (*bucket != NULL) {
+		if (*bucket == station) {
+			*bucket = station->indexNext;
+			break;
+		}
+		bucket = &(*bucket)->indexNext;
+	}
+	station->indexNext = NULL;
+}
+
+/*	get station by id
+ *	@param piano handle
  *	@param search for this
  *	@return the first station structure matching the given id
  */
-PianoStation_t *PianoFindStationById (PianoStation_t * const stations,
+PianoStation_t *PianoFindStationById (const PianoHandle_t * const ph,
 		const char * const searchStation) {
+	assert (ph != NULL);
 	assert (searchStation != NULL);
 
-	PianoStation_t *currStation = stations;
+	PianoStation_t *currStation;
+
+	if (ph->stationIndex != NULL) {
+		currStation = ph->stationIndex[PianoStationIndexHash (searchStation) &
+				(ph->stationIndexSize-1)];
+		for (; currStation != NULL; currStation = currStation->indexNext) {
+			if (strcmp (currStation->id, searchStation) == 0) {
+				return currStation;
+			}
+		}
+		return NULL;
+	}
+
+	currStation = ph->stations;
 	PianoListForeachP (currStation) {
 		if (strcmp (currStation->id, searchStation) == 0) {
 			return currStation;
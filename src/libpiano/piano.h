@@ -42,8 +42,11 @@ THE SOFTWARE.
 #define PIANO_RPC_HOST "tuner.pandora.com"
 #define PIANO_RPC_PATH "/services/json/?"
 
+/* tail and count are only valid in a list's first element */
 typedef struct PianoListHead {
 	struct PianoListHead *next;
+	struct PianoListHead *tail;
+	size_t count;
 } PianoListHead_t;
 
 typedef struct PianoUserInfo {
@@ -59,6 +62,7 @@ typedef struct PianoStation {
 	char *name;
 	char *id;
 	char *seedId;
+	struct PianoStation *indexNext; /* next station in same index bucket */
 } PianoStation_t;
 
 typedef enum {
@@ -134,6 +138,9 @@ typedef struct PianoHandle {
 	/* linked lists */
 	PianoStation_t *stations;
 	PianoGenreCategory_t *genreStations;
+	/* stations hashed by id */
+	PianoStation_t **stationIndex;
+	size_t stationIndexSize;
 	PianoPartner_t partner;
 	int timeOffset;
 } PianoHandle_t;
@@ -344,7 +351,7 @@ PianoReturn_t PianoResponse (PianoHandle_t *, PianoRequest_t *);
 void PianoDestroyRequest (PianoRequest_t *);
 
 /* misc */
-PianoStation_t *PianoFindStationById (PianoStation_t * const,
+PianoStation_t *PianoFindStationById (const PianoHandle_t * const,
 		const char * const);
 const char *PianoErrorToStr (PianoReturn_t);
 
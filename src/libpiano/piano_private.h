@@ -27,6 +27,10 @@ THE SOFTWARE.
 #include "piano.h"
 
 void PianoDestroyStation (PianoStation_t *station);
+void PianoDestroyStations (PianoStation_t *stations);
+void PianoDestroyGenreCategories (PianoGenreCategory_t *categories);
 void PianoDestroyUserInfo (PianoUserInfo_t *user);
+void PianoStationIndexAdd (PianoHandle_t *ph, PianoStation_t *station);
+void PianoStationIndexRemove (PianoHandle_t *ph, PianoStation_t *station);
 
 #endif /* _PIANO_PRIVATE_H */
@@ -31,15 +31,65 @@ THE SOFTWARE.
 #include <assert.h>
 #include <time.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 #include "piano.h"
 #include "piano_private.h"
 #include "crypt.h"
+#include "jsonstream.h"
+
+/* string member of an object allocated by PianoJsonAlloc */
+typedef struct {
+	json_object *j;
+	const char *key;
+	size_t offset;
+} PianoJsonString_t;
+
+#define PianoJsonMember(j,key,type,member) {j, key, offsetof (type, member)}
 
 static char *PianoJsonStrdup (json_object *j, const char *key) {
 	return strdup (json_object_get_string (json_object_object_get (j, key)));
 }
 
+/*	allocate zeroed object and copies of its string members in a single block,
+ *	which is released by free (object)
+ *	@param object size
+ *	@param string members, missing keys are set to NULL
+ *	@param number of string members
+ *	@return object or NULL if out of memory
+ */
+static void *PianoJsonAlloc (const size_t size,
+		const PianoJsonString_t * const members, const size_t count) {
+	const char *values[count];
+	size_t lengths[count];
+	size_t total = size;
+
+	for (size_t i = 0; i < count; i++) {
+		values[i] = members[i].j == NULL ? NULL : json_object_get_string (
+				json_object_object_get (members[i].j, members[i].key));
+		lengths[i] = values[i] == NULL ? 0 : strlen (values[i]) + 1;
+		total += lengths[i];
+	}
+
+	char * const object = malloc (total);
+	if (object == NULL) {
+		return NULL;
+	}
+	memset (object, 0, size);
+
+	char *pos = object + size;
+	for (size_t i = 0; i < count; i++) {
+		char *copy = NULL;
+		if (values[i] != NULL) {
+			copy = memcpy (pos, values[i], lengths[i]);
+			pos += lengths[i];
+		}
+		memcpy (object + members[i].offset, &copy, sizeof (copy));
+	}
+
+	return object;
+}
+
 static void PianoJsonParseStation (json_object *j, PianoStation_t *s) {
 	s->name = PianoJsonStrdup (j, "stationName");
 	s->id = PianoJsonStrdup (j, "stationToken");
@@ -73,6 +123,357 @@ static void PianoStrpcat (char * restrict dest, const char * restrict src,
 	*dest = '\0';
 }
 
+/* defaults for stations without isShared */
+static const PianoStation_t PianoStationDefaults = {.isCreator = 1};
+
+static bool PianoResponseStationShared (PianoJsonStream_t *s, void *object,
+		char **strings, void *data) {
+	PianoStation_t * const station = object;
+
+	station->isCreator = !PianoJsonStreamBool (s);
+	return true;
+}
+
+/*	remember where the quickmix station ids are, they are resolved after all
+ *	stations are known
+ */
+static bool PianoResponseStationMix (PianoJsonStream_t *s, void *object,
+		char **strings, void *data) {
+	char ** const mix = data;
+
+	*mix = s->pos;
+	PianoJsonStreamSkip (s);
+	return true;
+}
+
+static const PianoJsonField_t PianoStationFields[] = {
+		/* renaming replaces the name, so both need their own allocation */
+		{"stationName", PIANO_JSON_FIELD_STRDUP,
+				offsetof (PianoStation_t, name), NULL},
+		{"stationToken", PIANO_JSON_FIELD_STRDUP,
+				offsetof (PianoStation_t, id), NULL},
+		{"isShared", PIANO_JSON_FIELD_PARSE, 0, PianoResponseStationShared},
+		{"isQuickMix", PIANO_JSON_FIELD_BOOL,
+				offsetof (PianoStation_t, isQuickMix), NULL},
+		{"quickMixStationIds", PIANO_JSON_FIELD_PARSE, 0,
+				PianoResponseStationMix},
+		};
+
+/*	user.getStationList
+ */
+static PianoReturn_t PianoResponseStations (PianoHandle_t *ph,
+		PianoRequest_t *req, PianoJsonStream_t *s) {
+	PianoStation_t *stations = NULL, *station;
+	char *key, *mix = NULL;
+
+	while (PianoJsonStreamObjectNext (s, &key)) {
+		if (strcmp (key, "stations") != 0) {
+			PianoJsonStreamSkip (s);
+			continue;
+		}
+
+		while (PianoJsonStreamArrayNext (s)) {
+			station = PianoJsonStreamObject (s, PianoStationFields,
+					sizeof (PianoStationFields)/sizeof (*PianoStationFields),
+					sizeof (*station), &PianoStationDefaults, &mix);
+			if (station != NULL) {
+				stations = PianoListAppendP (stations, station);
+			}
+		}
+	}
+
+	if (s->error) {
+		PianoDestroyStations (stations);
+		return s->outOfMemory ? PIANO_RET_OUT_OF_MEMORY :
+				PIANO_RET_INVALID_RESPONSE;
+	}
+
+	/* move to station list */
+	while (stations != NULL) {
+		station = stations;
+		stations = PianoListDeleteP (stations, station);
+		ph->stations = PianoListAppendP (ph->stations, station);
+		PianoStationIndexAdd (ph, station);
+	}
+
+	/* fix quickmix flags */
+	if (mix != NULL) {
+		PianoJsonStream_t m;
+
+		PianoJsonStreamInit (&m, mix);
+		while (PianoJsonStreamArrayNext (&m)) {
+			const char * const id = PianoJsonStreamString (&m);
+			if (id != NULL && (station = PianoFindStationById (ph,
+					id)) != NULL) {
+				station->useQuickMix = true;
+			}
+		}
+	}
+
+	return PIANO_RET_OK;
+}
+
+/* selected quality of a song's audioUrlMap */
+typedef struct {
+	PianoAudioQuality_t quality;
+	bool found;
+} PianoResponseAudio_t;
+
+/* slot of audioUrl in PianoSongFields */
+#define PIANO_SONG_AUDIO_URL 0
+
+static bool PianoResponseSongAudio (PianoJsonStream_t *s, void *object,
+		char **strings, void *data) {
+	static const char *qualityMap[] = {"", "lowQuality", "mediumQuality",
+			"highQuality"};
+	static const char *formatMap[] = {"", "aacplus", "mp3"};
+	PianoSong_t * const song = object;
+	PianoResponseAudio_t * const audio = data;
+	char *quality, *key;
+
+	assert (audio->quality < sizeof (qualityMap)/sizeof (*qualityMap));
+
+	while (PianoJsonStreamObjectNext (s, &quality)) {
+		if (strcmp (quality, qualityMap[audio->quality]) != 0) {
+			PianoJsonStreamSkip (s);
+			continue;
+		}
+
+		audio->found = true;
+		while (PianoJsonStreamObjectNext (s, &key)) {
+			if (strcmp (key, "audioUrl") == 0) {
+				strings[PIANO_SONG_AUDIO_URL] = PianoJsonStreamString (s);
+			} else if (strcmp (key, "encoding") == 0) {
+				const char * const encoding = PianoJsonStreamString (s);
+				for (size_t k = 0; encoding != NULL &&
+						k < sizeof (formatMap)/sizeof (*formatMap); k++) {
+					if (strcmp (formatMap[k], encoding) == 0) {
+						song->audioFormat = k;
+						break;
+					}
+				}
+			} else {
+				PianoJsonStreamSkip (s);
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool PianoResponseSongRating (PianoJsonStream_t *s, void *object,
+		char **strings, void *data) {
+	PianoSong_t * const song = object;
+
+	if (PianoJsonStreamInt (s) == 1) {
+		song->rating = PIANO_RATE_LOVE;
+	}
+	return true;
+}
+
+static const PianoJsonField_t PianoSongFields[] = {
+		[PIANO_SONG_AUDIO_URL] = {NULL, PIANO_JSON_FIELD_STRING,
+				offsetof (PianoSong_t, audioUrl), NULL},
+		{"audioUrlMap", PIANO_JSON_FIELD_PARSE, 0, PianoResponseSongAudio},
+		{"artistName", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoSong_t, artist), NULL},
+		{"albumName", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoSong_t, album), NULL},
+		{"songName", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoSong_t, title), NULL},
+		{"trackToken", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoSong_t, trackToken), NULL},
+		{"stationId", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoSong_t, stationId), NULL},
+		{"albumArtUrl", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoSong_t, coverArt), NULL},
+		{"songDetailUrl", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoSong_t, detailUrl), NULL},
+		{"songExplorerUrl", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoSong_t, songExplorerUrl), NULL},
+		{"albumExplorerUrl", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoSong_t, albumExplorerUrl), NULL},
+		{"trackGain", PIANO_JSON_FIELD_FLOAT,
+				offsetof (PianoSong_t, fileGain), NULL},
+		{"trackLength", PIANO_JSON_FIELD_UINT,
+				offsetof (PianoSong_t, length), NULL},
+		{"songRating", PIANO_JSON_FIELD_PARSE, 0, PianoResponseSongRating},
+		};
+
+/*	station.getPlaylist, usually four songs
+ */
+static PianoReturn_t PianoResponsePlaylist (PianoHandle_t *ph,
+		PianoRequest_t *req, PianoJsonStream_t *s) {
+	PianoRequestDataGetPlaylist_t *reqData = req->data;
+	PianoSong_t *playlist = NULL;
+	char *key;
+
+	assert (reqData != NULL);
+	assert (reqData->quality != PIANO_AQ_UNKNOWN);
+
+	while (PianoJsonStreamObjectNext (s, &key)) {
+		if (strcmp (key, "items") != 0) {
+			PianoJsonStreamSkip (s);
+			continue;
+		}
+
+		while (PianoJsonStreamArrayNext (s)) {
+			PianoResponseAudio_t audio = {reqData->quality, false};
+			PianoSong_t *song = PianoJsonStreamObject (s, PianoSongFields,
+					sizeof (PianoSongFields)/sizeof (*PianoSongFields),
+					sizeof (*song), NULL, &audio);
+
+			if (song == NULL) {
+				continue;
+			} else if (song->artist == NULL) {
+				/* not a song (ad token) */
+				free (song);
+				continue;
+			}
+
+			playlist = PianoListAppendP (playlist, song);
+
+			if (!audio.found) {
+				/* requested quality is not available */
+				PianoDestroyPlaylist (playlist);
+				return PIANO_RET_QUALITY_UNAVAILABLE;
+			}
+		}
+	}
+
+	if (s->error) {
+		PianoDestroyPlaylist (playlist);
+		return s->outOfMemory ? PIANO_RET_OUT_OF_MEMORY :
+				PIANO_RET_INVALID_RESPONSE;
+	}
+
+	reqData->retPlaylist = playlist;
+	return PIANO_RET_OK;
+}
+
+static const PianoJsonField_t PianoGenreFields[] = {
+		{"stationName", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoGenre_t, name), NULL},
+		{"stationToken", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoGenre_t, musicId), NULL},
+		};
+
+static bool PianoResponseGenres (PianoJsonStream_t *s, void *object,
+		char **strings, void *data) {
+	PianoGenreCategory_t * const category = object;
+
+	while (PianoJsonStreamArrayNext (s)) {
+		PianoGenre_t *genre = PianoJsonStreamObject (s, PianoGenreFields,
+				sizeof (PianoGenreFields)/sizeof (*PianoGenreFields),
+				sizeof (*genre), NULL, NULL);
+		if (genre != NULL) {
+			category->genres = PianoListAppendP (category->genres, genre);
+		}
+	}
+
+	return true;
+}
+
+static const PianoJsonField_t PianoGenreCategoryFields[] = {
+		{"categoryName", PIANO_JSON_FIELD_STRING,
+				offsetof (PianoGenreCategory_t, name), NULL},
+		{"stations", PIANO_JSON_FIELD_PARSE, 0, PianoResponseGenres},
+		};
+
+/*	station.getGenreStations
+ */
+static PianoReturn_t PianoResponseGenreStations (PianoHandle_t *ph,
+		PianoRequest_t *req, PianoJsonStream_t *s) {
+	PianoGenreCategory_t *categories = NULL, *category;
+	char *key;
+
+	while (PianoJsonStreamObjectNext (s, &key)) {
+		if (strcmp (key, "categories") != 0) {
+			PianoJsonStreamSkip (s);
+			continue;
+		}
+
+		while (PianoJsonStreamArrayNext (s)) {
+			category = PianoJsonStreamObject (s, PianoGenreCategoryFields,
+					sizeof (PianoGenreCategoryFields)/
+					sizeof (*PianoGenreCategoryFields), sizeof (*category),
+					NULL, NULL);
+			if (category != NULL) {
+				categories = PianoListAppendP (categories, category);
+			}
+		}
+	}
+
+	if (s->error) {
+		PianoDestroyGenreCategories (categories);
+		return s->outOfMemory ? PIANO_RET_OUT_OF_MEMORY :
+				PIANO_RET_INVALID_RESPONSE;
+	}
+
+	while (categories != NULL) {
+		category = categories;
+		categories = PianoListDeleteP (categories, category);
+		ph->genreStations = PianoListAppendP (ph->genreStations, category);
+	}
+
+	return PIANO_RET_OK;
+}
+
+/* large responses, decoded with a PianoJsonStream_t instead of a json-c
+ * object tree */
+static const struct {
+	PianoRequestType_t type;
+	PianoReturn_t (*parse) (PianoHandle_t *, PianoRequest_t *,
+			PianoJsonStream_t *);
+} PianoResponseStreamParsers[] = {
+		{PIANO_REQUEST_GET_STATIONS, PianoResponseStations},
+		{PIANO_REQUEST_GET_PLAYLIST, PianoResponsePlaylist},
+		{PIANO_REQUEST_GET_GENRE_STATIONS, PianoResponseGenreStations},
+		};
+
+/*	check status of streamed response and decode its result
+ *	@param piano handle
+ *	@param request
+ *	@param result parser
+ */
+static PianoReturn_t PianoResponseStream (PianoHandle_t *ph,
+		PianoRequest_t *req, PianoReturn_t (*parse) (PianoHandle_t *,
+		PianoRequest_t *, PianoJsonStream_t *)) {
+	PianoJsonStream_t s;
+	char *key, *status = NULL, *result = NULL;
+	long int code = 0;
+	bool hasCode = false;
+
+	assert (req->responseData != NULL);
+
+	/* the result may come before the status, so it's skipped first */
+	PianoJsonStreamInit (&s, req->responseData);
+	while (PianoJsonStreamObjectNext (&s, &key)) {
+		if (strcmp (key, "stat") == 0) {
+			status = PianoJsonStreamString (&s);
+		} else if (strcmp (key, "code") == 0) {
+			code = PianoJsonStreamInt (&s);
+			hasCode = true;
+		} else if (strcmp (key, "result") == 0) {
+			result = s.pos;
+			PianoJsonStreamSkip (&s);
+		} else {
+			PianoJsonStreamSkip (&s);
+		}
+	}
+
+	if (s.error || status == NULL) {
+		return PIANO_RET_INVALID_RESPONSE;
+	} else if (strcmp (status, "ok") != 0) {
+		return hasCode ? code+PIANO_RET_OFFSET : PIANO_RET_INVALID_RESPONSE;
+	} else if (result == NULL) {
+		return PIANO_RET_INVALID_RESPONSE;
+	}
+
+	PianoJsonStreamInit (&s, result);
+	return parse (ph, req, &s);
+}
+
 /*	parse xml response and update data structures/return new data structure
  *	@param piano handle
  *	@param initialized request (expects responseData to be a NUL-terminated
@@ -85,6 +486,14 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 	assert (ph != NULL);
 	assert (req != NULL);
 
+	for (size_t i = 0; i < sizeof (PianoResponseStreamParsers)/
+			sizeof (*PianoResponseStreamParsers); i++) {
+		if (PianoResponseStreamParsers[i].type == req->type) {
+			return PianoResponseStream (ph, req,
+					PianoResponseStreamParsers[i].parse);
+		}
+	}
+
 	j = json_tokener_parse (req->responseData);
 
 	status = json_object_object_get (j, "stat");
@@ -120,6 +529,13 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 	result = json_object_object_get (j, "result");
 
 	switch (req->type) {
+		case PIANO_REQUEST_GET_STATIONS:
+		case PIANO_REQUEST_GET_PLAYLIST:
+		case PIANO_REQUEST_GET_GENRE_STATIONS:
+			/* see PianoResponseStreamParsers */
+			assert (0);
+			break;
+
 		case PIANO_REQUEST_LOGIN: {
 			/* authenticate user */
 			PianoRequestDataLogin_t *reqData = req->data;
@@ -171,131 +587,6 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 			break;
 		}
 
-		case PIANO_REQUEST_GET_STATIONS: {
-			/* get stations */
-			assert (req->responseData != NULL);
-
-			json_object *stations = json_object_object_get (result,
-					"stations"), *mix = NULL;
-
-			for (int i = 0; i < json_object_array_length (stations); i++) {
-				PianoStation_t *tmpStation;
-				json_object *s = json_object_array_get_idx (stations, i);
-
-				if ((tmpStation = calloc (1, sizeof (*tmpStation))) == NULL) {
-					return PIANO_RET_OUT_OF_MEMORY;
-				}
-
-				PianoJsonParseStation (s, tmpStation);
-
-				if (tmpStation->isQuickMix) {
-					/* fix flags on other stations later */
-					mix = json_object_object_get (s, "quickMixStationIds");
-				}
-
-				/* start new linked list or append */
-				ph->stations = PianoListAppendP (ph->stations, tmpStation);
-			}
-
-			/* fix quickmix flags */
-			if (mix != NULL) {
-				PianoStation_t *curStation = ph->stations;
-				PianoListForeachP (curStation) {
-					for (int i = 0; i < json_object_array_length (mix); i++) {
-						json_object *id = json_object_array_get_idx (mix, i);
-						if (strcmp (json_object_get_string (id),
-								curStation->id) == 0) {
-							curStation->useQuickMix = true;
-						}
-					}
-				}
-			}
-			break;
-		}
-
-		case PIANO_REQUEST_GET_PLAYLIST: {
-			/* get playlist, usually four songs */
-			PianoRequestDataGetPlaylist_t *reqData = req->data;
-			PianoSong_t *playlist = NULL;
-
-			assert (req->responseData != NULL);
-			assert (reqData != NULL);
-			assert (reqData->quality != PIANO_AQ_UNKNOWN);
-
-			json_object *items = json_object_object_get (result, "items");
-			assert (items != NULL);
-
-			for (int i = 0; i < json_object_array_length (items); i++) {
-				json_object *s = json_object_array_get_idx (items, i);
-				PianoSong_t *song;
-
-				if ((song = calloc (1, sizeof (*song))) == NULL) {
-					return PIANO_RET_OUT_OF_MEMORY;
-				}
-
-				if (json_object_object_get (s, "artistName") == NULL) {
-					free (song);
-					continue;
-				}
-
-				/* get audio url based on selected quality */
-				static const char *qualityMap[] = {"", "lowQuality", "mediumQuality",
-						"highQuality"};
-				assert (reqData->quality < sizeof (qualityMap)/sizeof (*qualityMap));
-				static const char *formatMap[] = {"", "aacplus", "mp3"};
-				json_object *map = json_object_object_get (s, "audioUrlMap");
-				assert (map != NULL);
-
-				if (map != NULL) {
-					map = json_object_object_get (map, qualityMap[reqData->quality]);
-
-					if (map != NULL) {
-						const char *encoding = json_object_get_string (
-								json_object_object_get (map, "encoding"));
-						assert (encoding != NULL);
-						for (size_t k = 0; k < sizeof (formatMap)/sizeof (*formatMap); k++) {
-							if (strcmp (formatMap[k], encoding) == 0) {
-								song->audioFormat = k;
-								break;
-							}
-						}
-						song->audioUrl = PianoJsonStrdup (map, "audioUrl");
-					} else {
-						/* requested quality is not available */
-						ret = PIANO_RET_QUALITY_UNAVAILABLE;
-						free (song);
-						PianoDestroyPlaylist (playlist);
-						goto cleanup;
-					}
-				}
-
-				song->artist = PianoJsonStrdup (s, "artistName");
-				song->album = PianoJsonStrdup (s, "albumName");
-				song->title = PianoJsonStrdup (s, "songName");
-				song->trackToken = PianoJsonStrdup (s, "trackToken");
-				song->stationId = PianoJsonStrdup (s, "stationId");
-				song->coverArt = PianoJsonStrdup (s, "albumArtUrl");
-				song->detailUrl = PianoJsonStrdup (s, "songDetailUrl");
-				song->songExplorerUrl = PianoJsonStrdup (s, "songExplorerUrl");
-				song->albumExplorerUrl = PianoJsonStrdup (s, "albumExplorerUrl");
-				song->fileGain = json_object_get_double (
-						json_object_object_get (s, "trackGain"));
-				song->length = json_object_get_int (
-						json_object_object_get (s, "trackLength"));
-				switch (json_object_get_int (json_object_object_get (s,
-						"songRating"))) {
-					case 1:
-						song->rating = PIANO_RATE_LOVE;
-						break;
-				}
-
-				playlist = PianoListAppendP (playlist, song);
-			}
-
-			reqData->retPlaylist = playlist;
-			break;
-		}
-
 		case PIANO_REQUEST_RATE_SONG: {
 			/* love/ban song */
 			PianoRequestDataRateSong_t *reqData = req->data;
@@ -327,6 +618,7 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 
 			assert (station != NULL);
 
+			PianoStationIndexRemove (ph, station);
 			ph->stations = PianoListDeleteP (ph->stations, station);
 			PianoDestroyStation (station);
 			free (station);
@@ -350,14 +642,17 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 				for (int i = 0; i < json_object_array_length (artists); i++) {
 					json_object *a = json_object_array_get_idx (artists, i);
 					PianoArtist_t *artist;
-
-					if ((artist = calloc (1, sizeof (*artist))) == NULL) {
+					const PianoJsonString_t members[] = {
+							PianoJsonMember (a, "artistName", PianoArtist_t, name),
+							PianoJsonMember (a, "musicToken", PianoArtist_t,
+									musicId),
+					};
+
+					if ((artist = PianoJsonAlloc (sizeof (*artist), members,
+							sizeof (members)/sizeof (*members))) == NULL) {
 						return PIANO_RET_OUT_OF_MEMORY;
 					}
 
-					artist->name = PianoJsonStrdup (a, "artistName");
-					artist->musicId = PianoJsonStrdup (a, "musicToken");
-
 					searchResult->artists =
 							PianoListAppendP (searchResult->artists, artist);
 				}
@@ -369,15 +664,17 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 				for (int i = 0; i < json_object_array_length (songs); i++) {
 					json_object *s = json_object_array_get_idx (songs, i);
 					PianoSong_t *song;
-
-					if ((song = calloc (1, sizeof (*song))) == NULL) {
+					const PianoJsonString_t members[] = {
+							PianoJsonMember (s, "songName", PianoSong_t, title),
+							PianoJsonMember (s, "artistName", PianoSong_t, artist),
+							PianoJsonMember (s, "musicToken", PianoSong_t, musicId),
+					};
+
+					if ((song = PianoJsonAlloc (sizeof (*song), members,
+							sizeof (members)/sizeof (*members))) == NULL) {
 						return PIANO_RET_OUT_OF_MEMORY;
 					}
 
-					song->title = PianoJsonStrdup (s, "songName");
-					song->artist = PianoJsonStrdup (s, "artistName");
-					song->musicId = PianoJsonStrdup (s, "musicToken");
-
 					searchResult->songs =
 							PianoListAppendP (searchResult->songs, song);
 				}
@@ -395,14 +692,16 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 
 			PianoJsonParseStation (result, tmpStation);
 
-			PianoStation_t *search = PianoFindStationById (ph->stations,
+			PianoStation_t *search = PianoFindStationById (ph,
 					tmpStation->id);
 			if (search != NULL) {
+				PianoStationIndexRemove (ph, search);
 				ph->stations = PianoListDeleteP (ph->stations, search);
 				PianoDestroyStation (search);
 				free (search);
 			}
 			ph->stations = PianoListAppendP (ph->stations, tmpStation);
+			PianoStationIndexAdd (ph, tmpStation);
 			break;
 		}
 
@@ -416,56 +715,6 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 			/* response unused */
 			break;
 
-		case PIANO_REQUEST_GET_GENRE_STATIONS: {
-			/* get genre stations */
-			json_object *categories = json_object_object_get (result, "categories");
-			if (categories != NULL) {
-				for (int i = 0; i < json_object_array_length (categories); i++) {
-					json_object *c = json_object_array_get_idx (categories, i);
-					PianoGenreCategory_t *tmpGenreCategory;
-
-					if ((tmpGenreCategory = calloc (1,
-							sizeof (*tmpGenreCategory))) == NULL) {
-						return PIANO_RET_OUT_OF_MEMORY;
-					}
-
-					tmpGenreCategory->name = PianoJsonStrdup (c,
-							"categoryName");
-
-					/* get genre subnodes */
-					json_object *stations = json_object_object_get (c,
-							"stations");
-					if (stations != NULL) {
-						for (int k = 0;
-								k < json_object_array_length (stations); k++) {
-							json_object *s =
-									json_object_array_get_idx (stations, k);
-							PianoGenre_t *tmpGenre;
-
-							if ((tmpGenre = calloc (1,
-									sizeof (*tmpGenre))) == NULL) {
-								return PIANO_RET_OUT_OF_MEMORY;
-							}
-
-							/* get genre attributes */
-							tmpGenre->name = PianoJsonStrdup (s,
-									"stationName");
-							tmpGenre->musicId = PianoJsonStrdup (s,
-									"stationToken");
-
-							tmpGenreCategory->genres =
-									PianoListAppendP (tmpGenreCategory->genres,
-									tmpGenre);
-						}
-					}
-
-					ph->genreStations = PianoListAppendP (ph->genreStations,
-							tmpGenreCategory);
-				}
-			}
-			break;
-		}
-
 		case PIANO_REQUEST_TRANSFORM_STATION: {
 			/* transform shared station into private and update isCreator flag */
 			PianoStation_t *station = req->data;
@@ -529,16 +778,19 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 					for (int i = 0; i < json_object_array_length (songs); i++) {
 						json_object *s = json_object_array_get_idx (songs, i);
 						PianoSong_t *seedSong;
-
-						seedSong = calloc (1, sizeof (*seedSong));
+						const PianoJsonString_t members[] = {
+								PianoJsonMember (s, "songName", PianoSong_t, title),
+								PianoJsonMember (s, "artistName", PianoSong_t,
+										artist),
+								PianoJsonMember (s, "seedId", PianoSong_t, seedId),
+						};
+
+						seedSong = PianoJsonAlloc (sizeof (*seedSong), members,
+								sizeof (members)/sizeof (*members));
 						if (seedSong == NULL) {
 							return PIANO_RET_OUT_OF_MEMORY;
 						}
 
-						seedSong->title = PianoJsonStrdup (s, "songName");
-						seedSong->artist = PianoJsonStrdup (s, "artistName");
-						seedSong->seedId = PianoJsonStrdup (s, "seedId");
-
 						info->songSeeds = PianoListAppendP (info->songSeeds,
 								seedSong);
 					}
@@ -551,15 +803,19 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 					for (int i = 0; i < json_object_array_length (artists); i++) {
 						json_object *a = json_object_array_get_idx (artists, i);
 						PianoArtist_t *seedArtist;
-
-						seedArtist = calloc (1, sizeof (*seedArtist));
+						const PianoJsonString_t members[] = {
+								PianoJsonMember (a, "artistName", PianoArtist_t,
+										name),
+								PianoJsonMember (a, "seedId", PianoArtist_t,
+										seedId),
+						};
+
+						seedArtist = PianoJsonAlloc (sizeof (*seedArtist),
+								members, sizeof (members)/sizeof (*members));
 						if (seedArtist == NULL) {
 							return PIANO_RET_OUT_OF_MEMORY;
 						}
 
-						seedArtist->name = PianoJsonStrdup (a, "artistName");
-						seedArtist->seedId = PianoJsonStrdup (a, "seedId");
-
 						info->artistSeeds =
 								PianoListAppendP (info->artistSeeds, seedArtist);
 					}
@@ -574,17 +830,19 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 					for (int i = 0; i < json_object_array_length (val); i++) {
 						json_object *s = json_object_array_get_idx (val, i);
 						PianoSong_t *feedbackSong;
-
-						feedbackSong = calloc (1, sizeof (*feedbackSong));
+						const PianoJsonString_t members[] = {
+								PianoJsonMember (s, "songName", PianoSong_t, title),
+								PianoJsonMember (s, "artistName", PianoSong_t,
+										artist),
+								PianoJsonMember (s, "feedbackId", PianoSong_t,
+										feedbackId),
+						};
+
+						feedbackSong = PianoJsonAlloc (sizeof (*feedbackSong),
+								members, sizeof (members)/sizeof (*members));
 						if (feedbackSong == NULL) {
 							return PIANO_RET_OUT_OF_MEMORY;
 						}
-
-						feedbackSong->title = PianoJsonStrdup (s, "songName");
-						feedbackSong->artist = PianoJsonStrdup (s,
-								"artistName");
-						feedbackSong->feedbackId = PianoJsonStrdup (s,
-								"feedbackId");
 						feedbackSong->rating = json_object_get_boolean (
 								json_object_object_get (s, "isPositive")) ?
 								PIANO_RATE_LOVE : PIANO_RATE_BAN;
@@ -598,7 +856,6 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 		}
 	}
 
-cleanup:
 	json_object_put (j);
 
 	return ret;
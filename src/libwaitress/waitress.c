@@ -22,7 +22,7 @@ THE SOFTWARE.
 */
 
 #ifndef __FreeBSD__
-#define _POSIX_C_SOURCE 1 /* required by getaddrinfo() */
+#define _POSIX_C_SOURCE 200112L /* getaddrinfo(), clock_gettime() */
 #define _BSD_SOURCE /* snprintf() */
 #define _DARWIN_C_SOURCE /* snprintf() on OS X */
 #endif
@@ -40,21 +40,49 @@ THE SOFTWARE.
 #include <errno.h>
 #include <assert.h>
 #include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <gnutls/x509.h>
+#ifdef ENABLE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "config.h"
 #include "waitress.h"
 
 #define strcaseeq(a,b) (strcasecmp(a,b) == 0)
 #define WAITRESS_HTTP_VERSION "1.1"
+/* delay between connection attempts to different addresses (ms), see
+ * RFC 8305 */
+#define WAITRESS_CONNECT_STAGGER 250
+/* resolved host:port pairs cached */
+#define WAITRESS_DNS_CACHE_SIZE 16
 
+/* resolver cache entry */
 typedef struct {
-	char *data;
-	size_t pos;
-} WaitressFetchBufCbBuffer_t;
+	char *host, *port; /* NULL if unused */
+	/* getaddrinfo () error if the lookup failed (negative caching) */
+	int error;
+	struct addrinfo *addrs;
+	/* WaitressMsNow () */
+	long long int expires;
+} WaitressDnsEntry_t;
+
+/* resolver cache, shared by all handles */
+static struct {
+	pthread_mutex_t lock;
+	WaitressDnsEntry_t entries[WAITRESS_DNS_CACHE_SIZE];
+	WaitressResolveFn_t resolve;
+	WaitressFreeAddrFn_t freeAddr;
+	/* seconds */
+	unsigned int ttl, negativeTtl;
+	WaitressDnsStats_t stats;
+} WaitressDns = {PTHREAD_MUTEX_INITIALIZER, {{NULL}}, getaddrinfo,
+		freeaddrinfo, 300, 30, {0, 0, 0}};
 
 static WaitressReturn_t WaitressReceiveHeaders (WaitressHandle_t *, size_t *);
+static void WaitressTimingReset (WaitressHandle_t *);
 
 #define READ_RET(buf, count, size) \
 		if ((wRet = waith->request.read (waith, buf, count, size)) != \
@@ -72,11 +100,52 @@ void WaitressInit (WaitressHandle_t *waith) {
 
 	memset (waith, 0, sizeof (*waith));
 	waith->timeout = 30000;
+	waith->cancelFd = -1;
+	waith->idleTimeout = 15;
+	waith->maxBufSize = WAITRESS_MAX_BUF_SIZE;
+	for (size_t i = 0; i < WAITRESS_POOL_SIZE; i++) {
+		waith->pool[i].sockfd = -1;
+	}
+	WaitressTimingReset (waith);
+}
+
+/*	close idle connection and mark pool slot as unused
+ *	@param pool slot
+ */
+static void WaitressPoolClose (WaitressConnection_t *conn) {
+	if (conn->sockfd == -1) {
+		return;
+	}
+
+	if (conn->tls) {
+		/* no gnutls_bye, the session's transport functions use the handle's
+		 * current request */
+		gnutls_deinit (conn->tlsSession);
+	}
+	close (conn->sockfd);
+	free (conn->host);
+	free (conn->port);
+	memset (conn, 0, sizeof (*conn));
+	conn->sockfd = -1;
 }
 
 void WaitressFree (WaitressHandle_t *waith) {
 	assert (waith != NULL);
 
+	for (size_t i = 0; i < WAITRESS_POOL_SIZE; i++) {
+		WaitressTlsSession_t * const sess = &waith->tlsSessions[i];
+
+		WaitressPoolClose (&waith->pool[i]);
+		if (sess->host != NULL) {
+			gnutls_free (sess->data.data);
+			free (sess->host);
+			free (sess->port);
+		}
+		free (waith->lastFamily[i].host);
+	}
+	if (waith->tlsCred != NULL) {
+		gnutls_certificate_free_credentials (waith->tlsCred);
+	}
 	free (waith->url.url);
 	free (waith->proxy.url);
 	memset (waith, 0, sizeof (*waith));
@@ -92,6 +161,15 @@ static bool WaitressProxyEnabled (const WaitressHandle_t *waith) {
 	return waith->proxy.host != NULL;
 }
 
+/*	Keep-alive connections can be used?
+ *	@param Waitress handle
+ *	@return true|false
+ */
+static bool WaitressPoolEnabled (const WaitressHandle_t *waith) {
+	/* the connection to a http proxy depends on the destination as well */
+	return waith->idleTimeout > 0 && !WaitressProxyEnabled (waith);
+}
+
 /*	urlencode post-data
  *	@param encode this
  *	@return malloc'ed encoded string, don't forget to free it
@@ -134,8 +212,8 @@ static char *WaitressBase64Encode (const char *in) {
 			"abcdefghijklmnopqrstuvwxyz0123456789+/";
 	const size_t alphabetLen = strlen (alphabet);
 
-	/* worst case is 1.333 */
-	out = malloc ((inLen * 2 + 1) * sizeof (*out));
+	/* four characters for every (started) group of three bytes */
+	out = malloc (((inLen + 2) / 3 * 4 + 1) * sizeof (*out));
 	if (out == NULL) {
 		return NULL;
 	}
@@ -235,6 +313,10 @@ static bool WaitressSplitUrl (const char *inurl, WaitressUrl_t *retUrl) {
 	assert (retUrl != NULL);
 
 	static const char *httpPrefix = "http://";
+
+	/* handles may be reused for another url */
+	free (retUrl->url);
+	memset (retUrl, 0, sizeof (*retUrl));
 	
 	/* is http url? */
 	if (strncmp (httpPrefix, inurl, strlen (httpPrefix)) == 0) {
@@ -367,7 +449,8 @@ bool WaitressSetProxy (WaitressHandle_t *waith, const char *url) {
 }
 
 /*	Callback for WaitressFetchBuf, appends received data to \0-terminated
- *	buffer
+ *	buffer. The buffer is allocated for the whole body if its size is known
+ *	and grows exponentially otherwise.
  *	@param received data
  *	@param data size
  *	@param buffer structure
@@ -376,21 +459,35 @@ static WaitressCbReturn_t WaitressFetchBufCb (void *recvData, size_t recvDataSiz
 		void *extraData) {
 	char *recvBytes = recvData;
 	WaitressFetchBufCbBuffer_t *buffer = extraData;
+	const WaitressHandle_t * const waith = buffer->waith;
+	/* data and \0 */
+	const size_t need = buffer->pos + recvDataSize + 1;
+
+	if (waith->maxBufSize > 0 && (need - 1 > waith->maxBufSize ||
+			(waith->request.contentLengthKnown &&
+			waith->request.contentLength > waith->maxBufSize))) {
+		buffer->tooLarge = true;
+		return WAITRESS_CB_RET_ERR;
+	}
 
-	if (buffer->data == NULL) {
-		if ((buffer->data = malloc (sizeof (*buffer->data) *
-				(recvDataSize + 1))) == NULL) {
-			return WAITRESS_CB_RET_ERR;
-		}
-	} else {
+	if (need > buffer->size) {
+		size_t newSize = buffer->size * 2;
 		char *newbuf;
+
+		if (waith->request.contentLengthKnown &&
+				waith->request.contentLength + 1 > newSize) {
+			newSize = waith->request.contentLength + 1;
+		}
+		if (newSize < need) {
+			newSize = need;
+		}
+		/* the old buffer is still valid and returned to the caller */
 		if ((newbuf = realloc (buffer->data,
-				sizeof (*buffer->data) *
-				(buffer->pos + recvDataSize + 1))) == NULL) {
-			free (buffer->data);
+				sizeof (*buffer->data) * newSize)) == NULL) {
 			return WAITRESS_CB_RET_ERR;
 		}
 		buffer->data = newbuf;
+		buffer->size = newSize;
 	}
 	memcpy (buffer->data + buffer->pos, recvBytes, recvDataSize);
 	buffer->pos += recvDataSize;
@@ -416,19 +513,49 @@ WaitressReturn_t WaitressFetchBuf (WaitressHandle_t *waith, char **retBuffer) {
  */
 WaitressReturn_t WaitressFetchBufEx (WaitressHandle_t *waith, char **retBuffer,
 		size_t *size) {
+	size_t bufferSize = 0;
+
+	assert (retBuffer != NULL);
+
+	*retBuffer = NULL;
+	return WaitressFetchBufReuse (waith, retBuffer, &bufferSize, size);
+}
+
+/*	Fetch string into a buffer that can be reused by subsequent calls,
+ *	avoiding allocations. Beware! This overwrites your waith->data pointer
+ *	@param waitress handle
+ *	@param \0-terminated result buffer, NULL or the one returned by the
+ *			last call; grown with realloc () if required (don't forget to
+ *			free it yourself)
+ *	@param allocated size of the buffer, updated
+ *	@param size of the response, may be NULL
+ */
+WaitressReturn_t WaitressFetchBufReuse (WaitressHandle_t *waith,
+		char **retBuffer, size_t *bufferSize, size_t *size) {
 	WaitressFetchBufCbBuffer_t buffer;
 	WaitressReturn_t wRet;
 
 	assert (waith != NULL);
 	assert (retBuffer != NULL);
+	assert (bufferSize != NULL);
 
 	memset (&buffer, 0, sizeof (buffer));
+	buffer.data = *retBuffer;
+	buffer.size = buffer.data != NULL ? *bufferSize : 0;
+	buffer.waith = waith;
+	if (buffer.data != NULL) {
+		buffer.data[0] = '\0';
+	}
 
 	waith->data = &buffer;
 	waith->callback = WaitressFetchBufCb;
 
 	wRet = WaitressFetchCall (waith);
+	if (buffer.tooLarge) {
+		wRet = WAITRESS_RET_TOO_LARGE;
+	}
 	*retBuffer = buffer.data;
+	*bufferSize = buffer.size;
 
 	if (size != NULL) {
 		*size = buffer.pos;
@@ -437,21 +564,102 @@ WaitressReturn_t WaitressFetchBufEx (WaitressHandle_t *waith, char **retBuffer,
 	return wRet;
 }
 
+/*	monotonic clock
+ *	@return milliseconds
+ */
+static long long int WaitressMsNow (void) {
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (long long int) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*	forget phases of a failed attempt, the request is started over
+ *	@param Waitress handle
+ */
+static void WaitressTimingReset (WaitressHandle_t *waith) {
+	waith->timing.resolve = waith->timing.connect = waith->timing.handshake =
+			waith->timing.sent = waith->timing.firstByte =
+			waith->timing.headers = waith->timing.done = -1;
+}
+
+/*	start timing a request
+ *	@param Waitress handle
+ */
+static void WaitressTimingStart (WaitressHandle_t *waith) {
+	memset (&waith->timing, 0, sizeof (waith->timing));
+	WaitressTimingReset (waith);
+	waith->timingStart = WaitressMsNow ();
+}
+
+/*	request reached a phase
+ *	@param Waitress handle
+ *	@param one of the handle's timing members
+ */
+static void WaitressTimingMark (const WaitressHandle_t *waith,
+		long int *phase) {
+	*phase = WaitressMsNow () - waith->timingStart;
+}
+
+/*	Get phases and byte counts of the handle's current or last request
+ *	@param Waitress handle
+ *	@param store them here
+ */
+void WaitressGetTiming (const WaitressHandle_t *waith,
+		WaitressTiming_t *timing) {
+	assert (waith != NULL);
+	assert (timing != NULL);
+
+	*timing = waith->timing;
+}
+
 /*	poll wrapper that retries after signal interrupts, required for socksify
- *	wrapper
+ *	wrapper; watches the handle's cancel fd too
+ *	@param waitress handle
+ *	@param fd
+ *	@param poll events
+ *	@return WAITRESS_RET_OK if fd is ready
  */
-static int WaitressPollLoop (int fd, short events, int timeout) {
+static WaitressReturn_t WaitressPollLoop (const WaitressHandle_t *waith,
+		int fd, short events) {
 	int pollres = -1;
-	struct pollfd sockpoll = {fd, events, 0};
+	struct pollfd sockpoll[2] = {{fd, events, 0}, {waith->cancelFd, POLLIN, 0}};
 
 	assert (fd != -1);
 
 	do {
 		errno = 0;
-		pollres = poll (&sockpoll, 1, timeout);
+		pollres = poll (sockpoll, waith->cancelFd != -1 ? 2 : 1,
+				waith->timeout);
 	} while (errno == EINTR || errno == EINPROGRESS || errno == EAGAIN);
 
-	return pollres;
+	if (pollres == 0) {
+		return WAITRESS_RET_TIMEOUT;
+	} else if (pollres == -1) {
+		return WAITRESS_RET_ERR;
+	} else if (sockpoll[1].revents != 0) {
+		return WAITRESS_RET_CB_ABORT;
+	}
+	return WAITRESS_RET_OK;
+}
+
+/*	check whether a non-blocking request's read/write failed because the
+ *	socket is not ready
+ *	@param waitress handle
+ *	@return true if the caller should wait for the socket, request's
+ *	wouldBlock is set
+ */
+static bool WaitressWouldBlock (WaitressHandle_t *waith) {
+	if (!waith->request.nonblocking ||
+			(errno != EAGAIN && errno != EWOULDBLOCK)) {
+		return false;
+	}
+	waith->request.wouldBlock = true;
+	waith->request.readWriteRet = WAITRESS_RET_OK;
+	if (waith->url.tls) {
+		gnutls_transport_set_errno (waith->request.tlsSession, EAGAIN);
+	}
+	return true;
 }
 
 /*	write () wrapper with poll () timeout
@@ -461,27 +669,25 @@ static int WaitressPollLoop (int fd, short events, int timeout) {
  *	@return number of written bytes or -1 on error
  */
 static ssize_t WaitressPollWrite (void *data, const void *buf, size_t count) {
-	int pollres = -1;
 	ssize_t retSize;
 	WaitressHandle_t *waith = data;
 
 	assert (waith != NULL);
 	assert (buf != NULL);
 
-	/* FIXME: simplify logic */
-	pollres = WaitressPollLoop (waith->request.sockfd, POLLOUT,
-			waith->timeout);
-	if (pollres == 0) {
-		waith->request.readWriteRet = WAITRESS_RET_TIMEOUT;
-		return -1;
-	} else if (pollres == -1) {
-		waith->request.readWriteRet = WAITRESS_RET_ERR;
+	if (!waith->request.nonblocking && (waith->request.readWriteRet =
+			WaitressPollLoop (waith, waith->request.sockfd, POLLOUT)) !=
+			WAITRESS_RET_OK) {
 		return -1;
 	}
 	if ((retSize = write (waith->request.sockfd, buf, count)) == -1) {
+		if (WaitressWouldBlock (waith)) {
+			return -1;
+		}
 		waith->request.readWriteRet = WAITRESS_RET_ERR;
 		return -1;
 	}
+	waith->timing.bytesSent += retSize;
 	waith->request.readWriteRet = WAITRESS_RET_OK;
 	return retSize;
 }
@@ -489,17 +695,36 @@ static ssize_t WaitressPollWrite (void *data, const void *buf, size_t count) {
 static WaitressReturn_t WaitressOrdinaryWrite (void *data, const char *buf,
 		const size_t size) {
 	WaitressHandle_t *waith = data;
+	size_t written = 0;
 
-	WaitressPollWrite (waith, buf, size);
+	/* the socket is non-blocking, writes may be short */
+	while (written < size) {
+		const ssize_t ret = WaitressPollWrite (waith, buf + written,
+				size - written);
+		if (ret == -1) {
+			break;
+		}
+		written += ret;
+	}
 	return waith->request.readWriteRet;
 }
 
 static WaitressReturn_t WaitressGnutlsWrite (void *data, const char *buf,
 		const size_t size) {
 	WaitressHandle_t *waith = data;
-
-	if (gnutls_record_send (waith->request.tlsSession, buf, size) < 0) {
-		return WAITRESS_RET_TLS_WRITE_ERR;
+	size_t written = 0;
+
+	/* records are limited in size */
+	while (written < size) {
+		const ssize_t ret = gnutls_record_send (waith->request.tlsSession,
+				buf + written, size - written);
+		if (ret < 0) {
+			if (waith->request.readWriteRet == WAITRESS_RET_CB_ABORT) {
+				return WAITRESS_RET_CB_ABORT;
+			}
+			return WAITRESS_RET_TLS_WRITE_ERR;
+		}
+		written += ret;
 	}
 	return waith->request.readWriteRet;
 }
@@ -511,23 +736,21 @@ static WaitressReturn_t WaitressGnutlsWrite (void *data, const char *buf,
  *	@return number of read bytes or -1 on error
  */
 static ssize_t WaitressPollRead (void *data, void *buf, size_t count) {
-	int pollres = -1;
 	ssize_t retSize;
 	WaitressHandle_t *waith = data;
 
 	assert (waith != NULL);
 	assert (buf != NULL);
 
-	/* FIXME: simplify logic */
-	pollres = WaitressPollLoop (waith->request.sockfd, POLLIN, waith->timeout);
-	if (pollres == 0) {
-		waith->request.readWriteRet = WAITRESS_RET_TIMEOUT;
-		return -1;
-	} else if (pollres == -1) {
-		waith->request.readWriteRet = WAITRESS_RET_ERR;
+	if (!waith->request.nonblocking && (waith->request.readWriteRet =
+			WaitressPollLoop (waith, waith->request.sockfd, POLLIN)) !=
+			WAITRESS_RET_OK) {
 		return -1;
 	}
 	if ((retSize = read (waith->request.sockfd, buf, count)) == -1) {
+		if (WaitressWouldBlock (waith)) {
+			return -1;
+		}
 		/* this is a terrible hack. it seems that never see an
 		 * EOF at the end of a song, only an ECONNRESET
 		 */
@@ -540,6 +763,12 @@ static ssize_t WaitressPollRead (void *data, void *buf, size_t count) {
 		waith->request.readWriteRet = WAITRESS_RET_READ_ERR;
 		return -1;
 	}
+	waith->timing.bytesReceived += retSize;
+	/* proxy tunnel and tls handshake data does not count */
+	if (retSize > 0 && waith->timing.sent != -1 &&
+			waith->timing.firstByte == -1) {
+		WaitressTimingMark (waith, &waith->timing.firstByte);
+	}
 	waith->request.readWriteRet = WAITRESS_RET_OK;
 	return retSize;
 }
@@ -559,9 +788,20 @@ static WaitressReturn_t WaitressOrdinaryRead (void *data, char *buf,
 static WaitressReturn_t WaitressGnutlsRead (void *data, char *buf,
 		const size_t size, size_t *retSize) {
 	WaitressHandle_t *waith = data;
+	ssize_t ret;
 
-	ssize_t ret = gnutls_record_recv (waith->request.tlsSession, buf, size);
+	/* tls 1.3 session tickets arrive after the handshake and make
+	 * gnutls_record_recv return without data */
+	do {
+		ret = gnutls_record_recv (waith->request.tlsSession, buf, size);
+	} while ((ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED) &&
+			waith->request.readWriteRet == WAITRESS_RET_OK &&
+			!waith->request.wouldBlock);
 	if (ret < 0) {
+		if (waith->request.wouldBlock) {
+			*retSize = 0;
+			return WAITRESS_RET_OK;
+		}
 		if (ret == GNUTLS_E_UNEXPECTED_PACKET_LENGTH
 #ifdef GNUTLS_E_PREMATURE_TERMINATION
 			|| ret == GNUTLS_E_PREMATURE_TERMINATION
@@ -570,6 +810,9 @@ static WaitressReturn_t WaitressGnutlsRead (void *data, char *buf,
 			*retSize = 0;
 			return waith->request.readWriteRet;
 		}
+		if (waith->request.readWriteRet == WAITRESS_RET_CB_ABORT) {
+			return WAITRESS_RET_CB_ABORT;
+		}
 		return WAITRESS_RET_TLS_READ_ERR;
 	} else {
 		*retSize = ret;
@@ -644,6 +887,79 @@ static char *WaitressGetline (char * const str) {
 	return eol;
 }
 
+/*	decompress gzip/deflate content encoding and pass the result to the
+ *	callback
+ *	@param Waitress handle
+ *	@param compressed data
+ *	@param data size
+ */
+static WaitressHandlerReturn_t WaitressInflate (WaitressHandle_t *waith,
+		char *buf, const size_t size) {
+#ifdef ENABLE_ZLIB
+	z_stream *zs = waith->request.inflate;
+	char out[WAITRESS_BUFFER_SIZE];
+
+	if (zs == NULL) {
+		if ((zs = calloc (1, sizeof (*zs))) == NULL) {
+			return WAITRESS_HANDLER_ERR;
+		}
+		/* detect zlib or gzip header */
+		if (inflateInit2 (zs, 15+32) != Z_OK) {
+			free (zs);
+			return WAITRESS_HANDLER_ERR;
+		}
+		waith->request.inflate = zs;
+	}
+
+	zs->next_in = (Bytef *) buf;
+	zs->avail_in = size;
+	do {
+		int ret;
+		size_t outSize;
+
+		zs->next_out = (Bytef *) out;
+		zs->avail_out = sizeof (out);
+		ret = inflate (zs, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+			return WAITRESS_HANDLER_ERR;
+		}
+		outSize = sizeof (out) - zs->avail_out;
+		waith->timing.bodyBytes += outSize;
+		/* an empty body is passed on at the end of the stream, like
+		 * identity encoding does */
+		if ((outSize > 0 || ret == Z_STREAM_END) &&
+				waith->callback (out, outSize, waith->data) ==
+				WAITRESS_CB_RET_ERR) {
+			return WAITRESS_HANDLER_ABORTED;
+		}
+		if (ret == Z_STREAM_END) {
+			waith->request.inflateDone = true;
+		}
+		if (ret == Z_STREAM_END || (ret == Z_BUF_ERROR && outSize == 0)) {
+			/* done or no progress possible until more input arrives */
+			break;
+		}
+	} while (zs->avail_in > 0 || zs->avail_out == 0);
+
+	return WAITRESS_HANDLER_CONTINUE;
+#else
+	return WAITRESS_HANDLER_ERR;
+#endif
+}
+
+/*	free decompressor
+ *	@param Waitress handle
+ */
+static void WaitressInflateEnd (WaitressHandle_t *waith) {
+#ifdef ENABLE_ZLIB
+	if (waith->request.inflate != NULL) {
+		inflateEnd (waith->request.inflate);
+		free (waith->request.inflate);
+		waith->request.inflate = NULL;
+	}
+#endif
+}
+
 /*	identity encoding handler
  */
 static WaitressHandlerReturn_t WaitressHandleIdentity (void *data, char *buf,
@@ -654,6 +970,10 @@ static WaitressHandlerReturn_t WaitressHandleIdentity (void *data, char *buf,
 	WaitressHandle_t *waith = data;
 
 	waith->request.contentReceived += size;
+	if (waith->request.compressed) {
+		return WaitressInflate (waith, buf, size);
+	}
+	waith->timing.bodyBytes += size;
 	if (waith->callback (buf, size, waith->data) == WAITRESS_CB_RET_ERR) {
 		return WAITRESS_HANDLER_ABORTED;
 	} else {
@@ -686,9 +1006,9 @@ static WaitressHandlerReturn_t WaitressHandleChunked (void *data, char *buf,
 					/* ignore */
 				} else if (buf[pos] == '\n') {
 					waith->request.chunkedState = DATA;
-					/* last chunk has size 0 */
+					/* last chunk has size 0, trailer follows */
 					if (waith->request.chunkSize == 0) {
-						return WAITRESS_HANDLER_DONE;
+						waith->request.chunkedState = TRAILER;
 					}
 				} else {
 					/* everything else is a protocol violation */
@@ -705,9 +1025,11 @@ static WaitressHandlerReturn_t WaitressHandleChunked (void *data, char *buf,
 					if (payloadSize > waith->request.chunkSize) {
 						payloadSize = waith->request.chunkSize;
 					}
-					if (WaitressHandleIdentity (waith, &buf[pos],
-							payloadSize) == WAITRESS_HANDLER_ABORTED) {
-						return WAITRESS_HANDLER_ABORTED;
+					const WaitressHandlerReturn_t hRet =
+							WaitressHandleIdentity (waith, &buf[pos],
+							payloadSize);
+					if (hRet != WAITRESS_HANDLER_CONTINUE) {
+						return hRet;
 					}
 					pos += payloadSize;
 					assert (waith->request.chunkSize >= payloadSize);
@@ -720,6 +1042,22 @@ static WaitressHandlerReturn_t WaitressHandleChunked (void *data, char *buf,
 					++pos;
 				}
 				break;
+
+			case TRAILER:
+				/* ignore trailer fields, chunkSize counts the characters
+				 * of the current line; an empty one ends the body. Reading
+				 * it makes sure nothing is left for the next request if
+				 * the connection is kept alive. */
+				if (buf[pos] == '\n') {
+					if (waith->request.chunkSize == 0) {
+						return WAITRESS_HANDLER_DONE;
+					}
+					waith->request.chunkSize = 0;
+				} else if (buf[pos] != '\r') {
+					++waith->request.chunkSize;
+				}
+				++pos;
+				break;
 		}
 	}
 
@@ -737,10 +1075,26 @@ static void WaitressHandleHeader (WaitressHandle_t *waith, const char * const ke
 	if (strcaseeq (key, "Content-Length")) {
 		waith->request.contentLength = atol (value);
 		waith->request.contentLengthKnown = true;
+	} else if (strcaseeq (key, "Content-Range")) {
+		/* bytes first-last/total */
+		const char * const total = strchr (value, '/');
+		if (total != NULL && total[1] != '*') {
+			waith->request.contentRangeTotal = atol (total + 1);
+		}
 	} else if (strcaseeq (key, "Transfer-Encoding")) {
 		if (strcaseeq (value, "chunked")) {
 			waith->request.dataHandler = WaitressHandleChunked;
 		}
+	} else if (strcaseeq (key, "Connection")) {
+		if (strcaseeq (value, "close")) {
+			waith->request.keepAlive = false;
+		}
+	} else if (strcaseeq (key, "Content-Encoding")) {
+		/* only if asked for, other encodings are passed through */
+		if (waith->acceptEncoding && (strcaseeq (value, "gzip") ||
+				strcaseeq (value, "x-gzip") || strcaseeq (value, "deflate"))) {
+			waith->request.compressed = true;
+		}
 	}
 }
 
@@ -759,11 +1113,14 @@ static int WaitressParseStatusline (const char * const line) {
 
 /*	verify server certificate
  */
-static WaitressReturn_t WaitressTlsVerify (const WaitressHandle_t *waith) {
+static WaitressReturn_t WaitressTlsVerify (WaitressHandle_t *waith) {
 	gnutls_session_t session = waith->request.tlsSession;
 	unsigned int certListSize;
 	const gnutls_datum_t *certList;
 	gnutls_x509_crt_t cert;
+	char fingerprint[20];
+	size_t fingerprintSize = sizeof (fingerprint);
+	WaitressReturn_t wRet = WAITRESS_RET_TLS_HANDSHAKE_ERR;
 
 	if (gnutls_certificate_type_get (session) != GNUTLS_CRT_X509) {
 		return WAITRESS_RET_TLS_HANDSHAKE_ERR;
@@ -780,214 +1137,891 @@ static WaitressReturn_t WaitressTlsVerify (const WaitressHandle_t *waith) {
 
 	if (gnutls_x509_crt_import (cert, &certList[0],
 			GNUTLS_X509_FMT_DER) != GNUTLS_E_SUCCESS) {
-		return WAITRESS_RET_TLS_HANDSHAKE_ERR;
+		goto end;
 	}
 
-	char fingerprint[20];
-	size_t fingerprintSize = sizeof (fingerprint);
 	if (gnutls_x509_crt_get_fingerprint (cert, GNUTLS_DIG_SHA1, fingerprint,
 			&fingerprintSize) != 0) {
-		return WAITRESS_RET_TLS_HANDSHAKE_ERR;
+		goto end;
 	}
 
 	assert (waith->tlsFingerprint != NULL);
 	if (memcmp (fingerprint, waith->tlsFingerprint, sizeof (fingerprint)) != 0) {
-		return WAITRESS_RET_TLS_FINGERPRINT_MISMATCH;
+		wRet = WAITRESS_RET_TLS_FINGERPRINT_MISMATCH;
+		goto end;
 	}
 
+	waith->request.tlsVerified = true;
+	memcpy (waith->request.tlsPeerFingerprint, fingerprint,
+			sizeof (fingerprint));
+	wRet = WAITRESS_RET_OK;
+
+end:
 	gnutls_x509_crt_deinit (cert);
 
-	return WAITRESS_RET_OK;
+	return wRet;
 }
 
-/*	Connect to server
+/*	find resumption data for the request's host
+ *	@param Waitress handle
+ *	@return cache entry or NULL
  */
-static WaitressReturn_t WaitressConnect (WaitressHandle_t *waith) {
-	WaitressReturn_t ret;
-	struct addrinfo hints, *gares;
+static WaitressTlsSession_t *WaitressTlsSessionFind (WaitressHandle_t *waith) {
+	const char * const port = WaitressDefaultPort (&waith->url);
 
-	memset (&hints, 0, sizeof hints);
+	for (size_t i = 0; i < WAITRESS_POOL_SIZE; i++) {
+		WaitressTlsSession_t * const sess = &waith->tlsSessions[i];
 
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
+		if (sess->host != NULL && strcmp (sess->host, waith->url.host) == 0 &&
+				strcmp (sess->port, port) == 0) {
+			return sess;
+		}
+	}
+	return NULL;
+}
 
-	/* Use proxy? */
-	if (WaitressProxyEnabled (waith)) {
-		if (getaddrinfo (waith->proxy.host,
-				WaitressDefaultPort (&waith->proxy), &hints, &gares) != 0) {
-			return WAITRESS_RET_GETADDR_ERR;
+/*	remember the current connection's session for resumption; must be
+ *	called after the response was received, tls 1.3 tickets arrive after
+ *	the handshake
+ *	@param Waitress handle
+ */
+static void WaitressTlsSessionStore (WaitressHandle_t *waith) {
+	WaitressTlsSession_t *sess;
+	gnutls_datum_t data;
+
+	if (!waith->request.tlsVerified ||
+			gnutls_session_get_data2 (waith->request.tlsSession, &data) !=
+			GNUTLS_E_SUCCESS) {
+		return;
+	}
+
+	if ((sess = WaitressTlsSessionFind (waith)) == NULL) {
+		sess = &waith->tlsSessions[waith->tlsSessionsNext];
+		waith->tlsSessionsNext = (waith->tlsSessionsNext + 1) %
+				WAITRESS_POOL_SIZE;
+		if (sess->host != NULL) {
+			free (sess->host);
+			free (sess->port);
 		}
+		sess->host = strdup (waith->url.host);
+		sess->port = strdup (WaitressDefaultPort (&waith->url));
 	} else {
-		if (getaddrinfo (waith->url.host,
-				WaitressDefaultPort (&waith->url), &hints, &gares) != 0) {
-			return WAITRESS_RET_GETADDR_ERR;
+		gnutls_free (sess->data.data);
+	}
+	sess->data = data;
+	memcpy (sess->fingerprint, waith->request.tlsPeerFingerprint,
+			sizeof (sess->fingerprint));
+}
+
+/*	free address list returned by WaitressDnsCopy
+ *	@param list
+ */
+static void WaitressDnsFreeAddrs (struct addrinfo *addrs) {
+	while (addrs != NULL) {
+		struct addrinfo * const next = addrs->ai_next;
+		free (addrs);
+		addrs = next;
+	}
+}
+
+/*	copy address list, every entry is a single allocation (addrinfo and
+ *	sockaddr)
+ *	@param list
+ *	@return copy, NULL if out of memory or the list was empty
+ */
+static struct addrinfo *WaitressDnsCopy (const struct addrinfo *addrs) {
+	struct addrinfo *copy = NULL, **last = &copy;
+
+	for (; addrs != NULL; addrs = addrs->ai_next) {
+		struct addrinfo * const a = malloc (sizeof (*a) + addrs->ai_addrlen);
+
+		if (a == NULL) {
+			WaitressDnsFreeAddrs (copy);
+			return NULL;
 		}
+		*a = *addrs;
+		a->ai_canonname = NULL;
+		a->ai_addr = (struct sockaddr *) (a + 1);
+		memcpy (a->ai_addr, addrs->ai_addr, addrs->ai_addrlen);
+		a->ai_next = NULL;
+		*last = a;
+		last = &a->ai_next;
 	}
 
-	/* try all addresses */
-	for (struct addrinfo *gacurr = gares; gacurr != NULL;
-			gacurr = gacurr->ai_next) {
-		int sock = -1;
+	return copy;
+}
 
-		ret = WAITRESS_RET_OK;
+/*	set resolver, e.g. to inject fake results in tests; flushes the cache
+ *	@param resolver or NULL to use getaddrinfo ()
+ *	@param function freeing its results, required if a resolver is given
+ */
+void WaitressDnsSetResolver (WaitressResolveFn_t resolve,
+		WaitressFreeAddrFn_t freeAddr) {
+	assert (resolve == NULL || freeAddr != NULL);
+
+	pthread_mutex_lock (&WaitressDns.lock);
+	WaitressDns.resolve = resolve == NULL ? getaddrinfo : resolve;
+	WaitressDns.freeAddr = resolve == NULL ? freeaddrinfo : freeAddr;
+	pthread_mutex_unlock (&WaitressDns.lock);
+	WaitressDnsFlush ();
+}
 
-		if ((sock = socket (gacurr->ai_family, gacurr->ai_socktype,
-				gacurr->ai_protocol)) == -1) {
-			ret = WAITRESS_RET_SOCK_ERR;
-		} else {
-			int pollres;
+/*	set how long lookup results are cached
+ *	@param seconds for successful lookups, 0 disables caching
+ *	@param seconds for failed lookups
+ */
+void WaitressDnsSetTtl (unsigned int ttl, unsigned int negativeTtl) {
+	pthread_mutex_lock (&WaitressDns.lock);
+	WaitressDns.ttl = ttl;
+	WaitressDns.negativeTtl = negativeTtl;
+	pthread_mutex_unlock (&WaitressDns.lock);
+}
 
-			/* we need shorter timeouts for connect() */
-			fcntl (sock, F_SETFL, O_NONBLOCK);
+/*	forget all cached lookups
+ */
+void WaitressDnsFlush (void) {
+	pthread_mutex_lock (&WaitressDns.lock);
+	for (size_t i = 0; i < WAITRESS_DNS_CACHE_SIZE; i++) {
+		WaitressDnsEntry_t * const e = &WaitressDns.entries[i];
+
+		free (e->host);
+		free (e->port);
+		WaitressDnsFreeAddrs (e->addrs);
+		memset (e, 0, sizeof (*e));
+	}
+	pthread_mutex_unlock (&WaitressDns.lock);
+}
 
-			/* increase socket receive buffer */
-			const int sockopt = 5*1024*1024;
-			setsockopt (sock, SOL_SOCKET, SO_RCVBUF, &sockopt,
-					sizeof (sockopt));
+/*	get resolver cache statistics
+ *	@param copy them here
+ */
+void WaitressDnsGetStats (WaitressDnsStats_t *stats) {
+	assert (stats != NULL);
 
-			/* non-blocking connect will return immediately */
-			connect (sock, gacurr->ai_addr, gacurr->ai_addrlen);
+	pthread_mutex_lock (&WaitressDns.lock);
+	*stats = WaitressDns.stats;
+	pthread_mutex_unlock (&WaitressDns.lock);
+}
 
-			pollres = WaitressPollLoop (sock, POLLOUT, waith->timeout);
-			if (pollres == 0) {
-				ret = WAITRESS_RET_TIMEOUT;
-			} else if (pollres == -1) {
-				ret = WAITRESS_RET_ERR;
-			} else {
-				/* check connect () return value */
-				socklen_t pollresSize = sizeof (pollres);
-				getsockopt (sock, SOL_SOCKET, SO_ERROR, &pollres,
-						&pollresSize);
-				if (pollres != 0) {
-					ret = WAITRESS_RET_CONNECT_REFUSED;
-				} else {
-					/* this one is working */
-					waith->request.sockfd = sock;
-					break;
-				}
+/*	resolve host and port (tcp), cached
+ *	@param host
+ *	@param port
+ *	@param result, free with WaitressDnsFreeAddrs
+ *	@return 0 or getaddrinfo () error
+ */
+static int WaitressDnsResolve (const char *host, const char *port,
+		struct addrinfo **retAddrs) {
+	struct addrinfo hints, *gares;
+	WaitressDnsEntry_t *e = NULL;
+	long long int now = WaitressMsNow ();
+	int error;
+
+	pthread_mutex_lock (&WaitressDns.lock);
+	for (size_t i = 0; i < WAITRESS_DNS_CACHE_SIZE; i++) {
+		e = &WaitressDns.entries[i];
+		if (e->host != NULL && now < e->expires &&
+				strcmp (e->host, host) == 0 && strcmp (e->port, port) == 0) {
+			++WaitressDns.stats.hits;
+			error = e->error;
+			*retAddrs = NULL;
+			if (error == 0 && (*retAddrs = WaitressDnsCopy (e->addrs)) ==
+					NULL) {
+				error = EAI_MEMORY;
 			}
-			close (sock);
+			pthread_mutex_unlock (&WaitressDns.lock);
+			return error;
 		}
 	}
+	++WaitressDns.stats.misses;
+	const WaitressResolveFn_t resolve = WaitressDns.resolve;
+	const WaitressFreeAddrFn_t freeAddr = WaitressDns.freeAddr;
+	pthread_mutex_unlock (&WaitressDns.lock);
 
-	freeaddrinfo (gares);
-	/* could not connect to any of the addresses */
-	if (ret != WAITRESS_RET_OK) {
-		return ret;
+	/* don't block the other threads while resolving */
+	memset (&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	const long long int start = WaitressMsNow ();
+	if ((error = resolve (host, port, &hints, &gares)) == 0) {
+		*retAddrs = WaitressDnsCopy (gares);
+		freeAddr (gares);
+		if (*retAddrs == NULL) {
+			error = EAI_MEMORY;
+		}
+	} else {
+		*retAddrs = NULL;
 	}
 
-	if (waith->url.tls) {
-		WaitressReturn_t wRet;
-
-		/* set up proxy tunnel */
-		if (WaitressProxyEnabled (waith)) {
-			char buf[256];
-			size_t size;
-
-			snprintf (buf, sizeof (buf), "CONNECT %s:%s HTTP/"
-					WAITRESS_HTTP_VERSION "\r\n"
-					"Host: %s:%s\r\n"
-					"Proxy-Connection: close\r\n",
-					waith->url.host, WaitressDefaultPort (&waith->url),
-					waith->url.host, WaitressDefaultPort (&waith->url));
-			WRITE_RET (buf, strlen (buf));
-
-			/* write authorization headers */
-			if (WaitressFormatAuthorization (waith, &waith->proxy, "Proxy-",
-					buf, WAITRESS_BUFFER_SIZE)) {
-				WRITE_RET (buf, strlen (buf));
+	pthread_mutex_lock (&WaitressDns.lock);
+	now = WaitressMsNow ();
+	WaitressDns.stats.lookupTime += now - start;
+	const unsigned int ttl = error == 0 ? WaitressDns.ttl :
+			WaitressDns.negativeTtl;
+	if (ttl > 0 && (error == 0 || error == EAI_NONAME)) {
+		/* replace an expired or the oldest entry */
+		WaitressDnsEntry_t *oldest = &WaitressDns.entries[0];
+		for (size_t i = 0; i < WAITRESS_DNS_CACHE_SIZE; i++) {
+			e = &WaitressDns.entries[i];
+			if (e->host == NULL || e->expires < oldest->expires) {
+				oldest = e;
+			}
+			if (e->host != NULL && strcmp (e->host, host) == 0 &&
+					strcmp (e->port, port) == 0) {
+				oldest = e;
+				break;
 			}
+		}
+		e = oldest;
+		free (e->host);
+		free (e->port);
+		WaitressDnsFreeAddrs (e->addrs);
+		e->host = strdup (host);
+		e->port = strdup (port);
+		e->error = error;
+		e->addrs = error == 0 ? WaitressDnsCopy (*retAddrs) : NULL;
+		e->expires = now + (long long int) ttl * 1000;
+		if (e->host == NULL || e->port == NULL ||
+				(error == 0 && e->addrs == NULL)) {
+			free (e->host);
+			free (e->port);
+			WaitressDnsFreeAddrs (e->addrs);
+			memset (e, 0, sizeof (*e));
+		}
+	}
+	pthread_mutex_unlock (&WaitressDns.lock);
 
-			WRITE_RET ("\r\n", 2);
+	return error;
+}
 
-			if ((wRet = WaitressReceiveHeaders (waith, &size)) !=
-					WAITRESS_RET_OK) {
-				return wRet;
-			}
+/*	address family host was reached with last time
+ *	@param Waitress handle
+ *	@param host
+ *	@return family or AF_UNSPEC
+ */
+static int WaitressFamilyGet (const WaitressHandle_t *waith,
+		const char *host) {
+	for (size_t i = 0; i < WAITRESS_POOL_SIZE; i++) {
+		if (waith->lastFamily[i].host != NULL &&
+				strcmp (waith->lastFamily[i].host, host) == 0) {
+			return waith->lastFamily[i].family;
 		}
+	}
+	return AF_UNSPEC;
+}
 
-		if (gnutls_handshake (waith->request.tlsSession) != GNUTLS_E_SUCCESS) {
-			return WAITRESS_RET_TLS_HANDSHAKE_ERR;
+/*	remember the address family host was reached with
+ *	@param Waitress handle
+ *	@param host
+ *	@param family
+ */
+static void WaitressFamilySet (WaitressHandle_t *waith, const char *host,
+		const int family) {
+	size_t i;
+
+	for (i = 0; i < WAITRESS_POOL_SIZE; i++) {
+		if (waith->lastFamily[i].host != NULL &&
+				strcmp (waith->lastFamily[i].host, host) == 0) {
+			break;
 		}
+	}
+	if (i == WAITRESS_POOL_SIZE) {
+		i = waith->lastFamilyNext;
+		waith->lastFamilyNext = (i + 1) % WAITRESS_POOL_SIZE;
+		free (waith->lastFamily[i].host);
+		waith->lastFamily[i].host = strdup (host);
+	}
+	waith->lastFamily[i].family = family;
+}
 
-		if ((wRet = WaitressTlsVerify (waith)) != WAITRESS_RET_OK) {
-			return wRet;
+/*	sort addresses for connecting: alternate between address families,
+ *	starting with the preferred one (RFC 8305, section 4)
+ *	@param getaddrinfo result
+ *	@param preferred family or AF_UNSPEC
+ *	@param sorted addresses, WAITRESS_CONNECT_MAX entries
+ *	@return number of addresses
+ */
+static size_t WaitressSortAddresses (struct addrinfo *gares, int family,
+		struct addrinfo **sorted) {
+	struct addrinfo *first[WAITRESS_CONNECT_MAX],
+			*second[WAITRESS_CONNECT_MAX];
+	size_t firstN = 0, secondN = 0, n = 0;
+
+	if (family == AF_UNSPEC && gares != NULL) {
+		family = gares->ai_family;
+	}
+
+	for (struct addrinfo *gacurr = gares; gacurr != NULL;
+			gacurr = gacurr->ai_next) {
+		if (gacurr->ai_family == family) {
+			if (firstN < WAITRESS_CONNECT_MAX) {
+				first[firstN++] = gacurr;
+			}
+		} else if (secondN < WAITRESS_CONNECT_MAX) {
+			second[secondN++] = gacurr;
 		}
+	}
 
-		/* now we can talk encrypted */
-		waith->request.read = WaitressGnutlsRead;
-		waith->request.write = WaitressGnutlsWrite;
+	for (size_t i = 0; n < WAITRESS_CONNECT_MAX &&
+			(i < firstN || i < secondN); i++) {
+		if (i < firstN) {
+			sorted[n++] = first[i];
+		}
+		if (i < secondN && n < WAITRESS_CONNECT_MAX) {
+			sorted[n++] = second[i];
+		}
 	}
 
-	return WAITRESS_RET_OK;
+	return n;
 }
 
-/*	Write http header/post data to socket
+/*	start non-blocking connect to address
+ *	@param address
+ *	@return socket or -1 if connect failed already
  */
-static WaitressReturn_t WaitressSendRequest (WaitressHandle_t *waith) {
-	assert (waith != NULL);
-	assert (waith->request.buf != NULL);
+static int WaitressConnectStart (const struct addrinfo *addr) {
+	int sock;
 
-	const char *path = waith->url.path;
-	char * const buf = waith->request.buf;
-	WaitressReturn_t wRet = WAITRESS_RET_OK;
+	if ((sock = socket (addr->ai_family, addr->ai_socktype,
+			addr->ai_protocol)) == -1) {
+		return -1;
+	}
 
-	if (waith->url.path == NULL) {
-		/* avoid NULL pointer deref */
-		path = "";
-	} else if (waith->url.path[0] == '/') {
-		/* most servers don't like "//" */
-		++path;
+	/* we need shorter timeouts for connect() */
+	fcntl (sock, F_SETFL, O_NONBLOCK);
+
+	/* increase socket receive buffer */
+	const int sockopt = 5*1024*1024;
+	setsockopt (sock, SOL_SOCKET, SO_RCVBUF, &sockopt, sizeof (sockopt));
+
+	/* non-blocking connect will return immediately */
+	if (connect (sock, addr->ai_addr, addr->ai_addrlen) == -1 &&
+			errno != EINPROGRESS) {
+		/* e.g. no route to this address family */
+		close (sock);
+		return -1;
 	}
 
-	/* send request */
-	if (WaitressProxyEnabled (waith) && !waith->url.tls) {
-		snprintf (buf, WAITRESS_BUFFER_SIZE,
-			"%s http://%s:%s/%s HTTP/" WAITRESS_HTTP_VERSION "\r\n",
-			(waith->method == WAITRESS_METHOD_GET ? "GET" : "POST"),
-			waith->url.host,
-			WaitressDefaultPort (&waith->url), path);
+	return sock;
+}
+
+/*	resolve the server's name and prepare connection attempts
+ *	@param Waitress handle
+ *	@return WAITRESS_RET_OK or WAITRESS_RET_GETADDR_ERR
+ */
+static WaitressReturn_t WaitressConnectBegin (WaitressHandle_t *waith) {
+	const char *port;
+
+	/* Use proxy? */
+	if (WaitressProxyEnabled (waith)) {
+		waith->request.connect.host = waith->proxy.host;
+		port = WaitressDefaultPort (&waith->proxy);
+	} else {
+		waith->request.connect.host = waith->url.host;
+		port = WaitressDefaultPort (&waith->url);
+	}
+	if (WaitressDnsResolve (waith->request.connect.host, port,
+			&waith->request.connect.gares) != 0) {
+		return WAITRESS_RET_GETADDR_ERR;
+	}
+	WaitressTimingMark (waith, &waith->timing.resolve);
+
+	waith->request.connect.addrsN = WaitressSortAddresses (
+			waith->request.connect.gares,
+			WaitressFamilyGet (waith, waith->request.connect.host),
+			waith->request.connect.addrs);
+	waith->request.connect.next = 0;
+	waith->request.connect.active = 0;
+	waith->request.connect.nextStart = WaitressMsNow ();
+	waith->request.connect.ret = WAITRESS_RET_CONNECT_REFUSED;
+
+	return WAITRESS_RET_OK;
+}
+
+/*	race connection attempts: start the next one if the previous failed or
+ *	did not succeed within WAITRESS_CONNECT_STAGGER ms; the first one that
+ *	connects wins
+ *	@param Waitress handle
+ *	@param WaitressMsNow ()
+ *	@return ms until the next attempt is due or one times out, -1 if all
+ *	of them failed
+ */
+static int WaitressConnectStep (WaitressHandle_t *waith,
+		const long long int now) {
+	struct pollfd * const fds = waith->request.connect.fds;
+	size_t * const next = &waith->request.connect.next;
+	long long int wakeup = -1;
+
+	while (*next < waith->request.connect.addrsN &&
+			(waith->request.connect.active == 0 ||
+			now >= waith->request.connect.nextStart)) {
+		const int sock = WaitressConnectStart (
+				waith->request.connect.addrs[*next]);
+
+		fds[*next].fd = sock;
+		fds[*next].events = POLLOUT;
+		fds[*next].revents = 0;
+		waith->request.connect.started[*next] = now;
+		++*next;
+		if (sock == -1) {
+			waith->request.connect.ret = WAITRESS_RET_SOCK_ERR;
+			continue;
+		}
+		++waith->request.connect.active;
+		waith->request.connect.nextStart = now + WAITRESS_CONNECT_STAGGER;
+	}
+
+	if (waith->request.connect.active == 0) {
+		return -1;
+	}
+
+	/* sleep until the next attempt is due or one times out */
+	if (*next < waith->request.connect.addrsN) {
+		wakeup = waith->request.connect.nextStart;
+	}
+	for (size_t i = 0; i < *next; i++) {
+		const long long int timeout = waith->request.connect.started[i] +
+				waith->timeout;
+		if (fds[i].fd != -1 && (wakeup == -1 || timeout < wakeup)) {
+			wakeup = timeout;
+		}
+	}
+	return wakeup > now ? wakeup - now : 0;
+}
+
+/*	check connection attempts after poll ()
+ *	@param Waitress handle
+ *	@param WaitressMsNow ()
+ *	@return true if one of them connected, request's sockfd is set
+ */
+static bool WaitressConnectCheck (WaitressHandle_t *waith,
+		const long long int now) {
+	struct pollfd * const fds = waith->request.connect.fds;
+
+	for (size_t i = 0; i < waith->request.connect.next; i++) {
+		if (fds[i].fd == -1) {
+			continue;
+		}
+		if (fds[i].revents != 0) {
+			/* check connect () return value */
+			int sockerr;
+			socklen_t sockerrSize = sizeof (sockerr);
+			getsockopt (fds[i].fd, SOL_SOCKET, SO_ERROR, &sockerr,
+					&sockerrSize);
+			if (sockerr == 0) {
+				/* this one is working */
+				waith->request.sockfd = fds[i].fd;
+				fds[i].fd = -1;
+				WaitressFamilySet (waith, waith->request.connect.host,
+						waith->request.connect.addrs[i]->ai_family);
+				waith->request.connect.ret = WAITRESS_RET_OK;
+				WaitressTimingMark (waith, &waith->timing.connect);
+				return true;
+			}
+			waith->request.connect.ret = WAITRESS_RET_CONNECT_REFUSED;
+		} else if (now - waith->request.connect.started[i] >=
+				waith->timeout) {
+			waith->request.connect.ret = WAITRESS_RET_TIMEOUT;
+		} else {
+			continue;
+		}
+		close (fds[i].fd);
+		fds[i].fd = -1;
+		--waith->request.connect.active;
+		/* don't wait for the stagger delay */
+		waith->request.connect.nextStart = now;
+	}
+
+	return false;
+}
+
+/*	close the losers of the race
+ *	@param Waitress handle
+ *	@return WAITRESS_RET_OK if connected or the last error
+ */
+static WaitressReturn_t WaitressConnectEnd (WaitressHandle_t *waith) {
+	for (size_t i = 0; i < waith->request.connect.next; i++) {
+		if (waith->request.connect.fds[i].fd != -1) {
+			close (waith->request.connect.fds[i].fd);
+			waith->request.connect.fds[i].fd = -1;
+		}
+	}
+	waith->request.connect.next = 0;
+
+	WaitressDnsFreeAddrs (waith->request.connect.gares);
+	waith->request.connect.gares = NULL;
+
+	return waith->request.connect.ret;
+}
+
+/*	append string to the formatted request
+ *	@param Waitress handle
+ *	@param string
+ *	@return false if out of memory
+ */
+static bool WaitressAppend (WaitressHandle_t *waith, const char *str) {
+	const size_t len = strlen (str);
+	char * const out = realloc (waith->request.out,
+			waith->request.outSize + len + 1);
+
+	if (out == NULL) {
+		return false;
+	}
+	memcpy (out + waith->request.outSize, str, len + 1);
+	waith->request.out = out;
+	waith->request.outSize += len;
+
+	return true;
+}
+
+/*	format proxy CONNECT request, sets request's out
+ *	@param Waitress handle
+ *	@return false if out of memory
+ */
+static bool WaitressFormatTunnel (WaitressHandle_t *waith) {
+	char * const buf = waith->request.buf;
+
+	snprintf (buf, WAITRESS_BUFFER_SIZE, "CONNECT %s:%s HTTP/"
+			WAITRESS_HTTP_VERSION "\r\n"
+			"Host: %s:%s\r\n"
+			"Proxy-Connection: close\r\n",
+			waith->url.host, WaitressDefaultPort (&waith->url),
+			waith->url.host, WaitressDefaultPort (&waith->url));
+	if (!WaitressAppend (waith, buf)) {
+		return false;
+	}
+
+	/* write authorization headers */
+	if (WaitressFormatAuthorization (waith, &waith->proxy, "Proxy-",
+			buf, WAITRESS_BUFFER_SIZE) && !WaitressAppend (waith, buf)) {
+		return false;
+	}
+
+	return WaitressAppend (waith, "\r\n");
+}
+
+/*	format http header/post data, sets request's out
+ *	@param Waitress handle
+ *	@return false if out of memory
+ */
+static bool WaitressFormatRequest (WaitressHandle_t *waith) {
+	const char *path = waith->url.path;
+	char * const buf = waith->request.buf;
+
+	if (waith->url.path == NULL) {
+		/* avoid NULL pointer deref */
+		path = "";
+	} else if (waith->url.path[0] == '/') {
+		/* most servers don't like "//" */
+		++path;
+	}
+
+	/* send request */
+	if (WaitressProxyEnabled (waith) && !waith->url.tls) {
+		snprintf (buf, WAITRESS_BUFFER_SIZE,
+			"%s http://%s:%s/%s HTTP/" WAITRESS_HTTP_VERSION "\r\n",
+			(waith->method == WAITRESS_METHOD_GET ? "GET" : "POST"),
+			waith->url.host,
+			WaitressDefaultPort (&waith->url), path);
 	} else {
 		snprintf (buf, WAITRESS_BUFFER_SIZE,
 			"%s /%s HTTP/" WAITRESS_HTTP_VERSION "\r\n",
 			(waith->method == WAITRESS_METHOD_GET ? "GET" : "POST"),
 			path);
 	}
-	WRITE_RET (buf, strlen (buf));
+	if (!WaitressAppend (waith, buf)) {
+		return false;
+	}
 
 	snprintf (buf, WAITRESS_BUFFER_SIZE,
-			"Host: %s\r\nUser-Agent: " PACKAGE "\r\nConnection: Close\r\n",
-			waith->url.host);
-	WRITE_RET (buf, strlen (buf));
+			"Host: %s\r\nUser-Agent: " PACKAGE "\r\nConnection: %s\r\n",
+			waith->url.host,
+			WaitressPoolEnabled (waith) ? "keep-alive" : "Close");
+	if (!WaitressAppend (waith, buf)) {
+		return false;
+	}
+
+#ifdef ENABLE_ZLIB
+	if (waith->acceptEncoding &&
+			!WaitressAppend (waith, "Accept-Encoding: gzip, deflate\r\n")) {
+		return false;
+	}
+#endif
 
 	if (waith->method == WAITRESS_METHOD_POST && waith->postData != NULL) {
 		snprintf (buf, WAITRESS_BUFFER_SIZE, "Content-Length: %zu\r\n",
 				strlen (waith->postData));
-		WRITE_RET (buf, strlen (buf));
+		if (!WaitressAppend (waith, buf)) {
+			return false;
+		}
 	}
 
 	/* write authorization headers */
 	if (WaitressFormatAuthorization (waith, &waith->url, "", buf,
-			WAITRESS_BUFFER_SIZE)) {
-		WRITE_RET (buf, strlen (buf));
+			WAITRESS_BUFFER_SIZE) && !WaitressAppend (waith, buf)) {
+		return false;
 	}
 	/* don't leak proxy credentials to destination server if tls is used */
 	if (!waith->url.tls &&
 			WaitressFormatAuthorization (waith, &waith->proxy, "Proxy-",
-			buf, WAITRESS_BUFFER_SIZE)) {
-		WRITE_RET (buf, strlen (buf));
+			buf, WAITRESS_BUFFER_SIZE) && !WaitressAppend (waith, buf)) {
+		return false;
 	}
-	
-	if (waith->extraHeaders != NULL) {
-		WRITE_RET (waith->extraHeaders, strlen (waith->extraHeaders));
+
+	if (waith->extraHeaders != NULL &&
+			!WaitressAppend (waith, waith->extraHeaders)) {
+		return false;
+	}
+
+	if (!WaitressAppend (waith, "\r\n")) {
+		return false;
 	}
-	
-	WRITE_RET ("\r\n", 2);
 
 	if (waith->method == WAITRESS_METHOD_POST && waith->postData != NULL) {
-		WRITE_RET (waith->postData, strlen (waith->postData));
+		return WaitressAppend (waith, waith->postData);
+	}
+
+	return true;
+}
+
+/*	write formatted request to socket
+ *	@param Waitress handle
+ */
+static WaitressReturn_t WaitressSendOut (WaitressHandle_t *waith) {
+	WaitressReturn_t wRet = WAITRESS_RET_OK;
+
+	assert (waith->request.out != NULL);
+
+	WRITE_RET (waith->request.out, waith->request.outSize);
+	free (waith->request.out);
+	waith->request.out = NULL;
+	waith->request.outSize = 0;
+
+	return wRet;
+}
+
+/*	account for a finished tls handshake and check the server's
+ *	certificate
+ *	@param Waitress handle
+ *	@param WaitressMsNow () when the handshake was started
+ */
+static WaitressReturn_t WaitressTlsHandshakeDone (WaitressHandle_t *waith,
+		const long long int start) {
+	WaitressReturn_t wRet;
+
+	++waith->tlsStats.handshakes;
+	waith->tlsStats.time += WaitressMsNow () - start;
+	WaitressTimingMark (waith, &waith->timing.handshake);
+
+	const WaitressTlsSession_t * const sess = WaitressTlsSessionFind (waith);
+	if (gnutls_session_is_resumed (waith->request.tlsSession) &&
+			sess != NULL && memcmp (sess->fingerprint,
+			waith->tlsFingerprint, sizeof (sess->fingerprint)) == 0) {
+		/* the certificate was checked when the session was set up */
+		++waith->tlsStats.resumed;
+		waith->request.tlsVerified = true;
+		memcpy (waith->request.tlsPeerFingerprint, sess->fingerprint,
+				sizeof (sess->fingerprint));
+	} else if ((wRet = WaitressTlsVerify (waith)) != WAITRESS_RET_OK) {
+		return wRet;
 	}
 
+	/* now we can talk encrypted */
+	waith->request.read = WaitressGnutlsRead;
+	waith->request.write = WaitressGnutlsWrite;
+
+	return WAITRESS_RET_OK;
+}
+
+/*	Connect to server
+ */
+static WaitressReturn_t WaitressConnect (WaitressHandle_t *waith) {
+	WaitressReturn_t wRet;
+	int timeout;
+
+	if ((wRet = WaitressConnectBegin (waith)) != WAITRESS_RET_OK) {
+		return wRet;
+	}
+
+	while ((timeout = WaitressConnectStep (waith, WaitressMsNow ())) != -1) {
+		struct pollfd * const fds = waith->request.connect.fds;
+		const size_t next = waith->request.connect.next;
+		int pollres;
+
+		fds[next].fd = waith->cancelFd;
+		fds[next].events = POLLIN;
+		fds[next].revents = 0;
+		do {
+			errno = 0;
+			pollres = poll (fds, next+1, timeout);
+		} while (errno == EINTR || errno == EINPROGRESS || errno == EAGAIN);
+		if (pollres == -1) {
+			waith->request.connect.ret = WAITRESS_RET_ERR;
+			break;
+		}
+		if (fds[next].revents != 0) {
+			waith->request.connect.ret = WAITRESS_RET_CB_ABORT;
+			break;
+		}
+
+		if (WaitressConnectCheck (waith, WaitressMsNow ())) {
+			break;
+		}
+	}
+
+	/* could not connect to any of the addresses */
+	if ((wRet = WaitressConnectEnd (waith)) != WAITRESS_RET_OK) {
+		return wRet;
+	}
+
+	if (waith->url.tls) {
+		/* set up proxy tunnel */
+		if (WaitressProxyEnabled (waith)) {
+			size_t size;
+
+			if (!WaitressFormatTunnel (waith)) {
+				return WAITRESS_RET_ERR;
+			}
+			if ((wRet = WaitressSendOut (waith)) != WAITRESS_RET_OK) {
+				return wRet;
+			}
+
+			if ((wRet = WaitressReceiveHeaders (waith, &size)) !=
+					WAITRESS_RET_OK) {
+				return wRet;
+			}
+		}
+
+		const long long int start = WaitressMsNow ();
+		if (gnutls_handshake (waith->request.tlsSession) != GNUTLS_E_SUCCESS) {
+			if (waith->request.readWriteRet == WAITRESS_RET_CB_ABORT) {
+				return WAITRESS_RET_CB_ABORT;
+			}
+			return WAITRESS_RET_TLS_HANDSHAKE_ERR;
+		}
+		return WaitressTlsHandshakeDone (waith, start);
+	}
+
+	return WAITRESS_RET_OK;
+}
+
+/*	Write http header/post data to socket
+ */
+static WaitressReturn_t WaitressSendRequest (WaitressHandle_t *waith) {
+	assert (waith != NULL);
+	assert (waith->request.buf != NULL);
+
+	WaitressReturn_t wRet;
+
+	if (!WaitressFormatRequest (waith)) {
+		return WAITRESS_RET_ERR;
+	}
+	if ((wRet = WaitressSendOut (waith)) == WAITRESS_RET_OK) {
+		WaitressTimingMark (waith, &waith->timing.sent);
+	}
+	return wRet;
+}
+
+/*	parse complete header lines in request's buf
+ *	@param Waitress handle
+ *	@return WAITRESS_RET_OK or http error, hdrParseMode is HDRM_FINISHED
+ *	once all headers are parsed and bufFilled is the number of body
+ *	bytes at the beginning of buf
+ */
+static WaitressReturn_t WaitressParseHeaders (WaitressHandle_t *waith) {
+	char * const buf = waith->request.buf;
+	char *nextLine = NULL, *thisLine = buf;
+
+	buf[waith->request.bufFilled] = '\0';
+
+	/* split */
+	while (waith->request.hdrParseMode != HDRM_FINISHED &&
+			(nextLine = WaitressGetline (thisLine)) != NULL) {
+		switch (waith->request.hdrParseMode) {
+			/* Status code */
+			case HDRM_HEAD:
+				switch (WaitressParseStatusline (thisLine)) {
+					case 200:
+					case 206:
+						waith->request.hdrParseMode = HDRM_LINES;
+						break;
+
+					case 400:
+						return WAITRESS_RET_BAD_REQUEST;
+						break;
+
+					case 403:
+						return WAITRESS_RET_FORBIDDEN;
+						break;
+
+					case 404:
+						return WAITRESS_RET_NOTFOUND;
+						break;
+
+					case -1:
+						/* ignore invalid line */
+						break;
+
+					default:
+						return WAITRESS_RET_STATUS_UNKNOWN;
+						break;
+				}
+				break;
+
+			/* Everything else, except status code */
+			case HDRM_LINES:
+				/* empty line => content starts here */
+				if (*thisLine == '\0') {
+					waith->request.hdrParseMode = HDRM_FINISHED;
+					waith->request.headersReceived = true;
+					if (waith->timing.sent != -1) {
+						WaitressTimingMark (waith, &waith->timing.headers);
+					}
+				} else {
+					/* parse header: "key: value", ignore invalid lines */
+					char *key = thisLine, *val;
+
+					val = strchr (thisLine, ':');
+					if (val != NULL) {
+						*val++ = '\0';
+						while (*val != '\0' && isspace ((unsigned char) *val)) {
+							++val;
+						}
+						WaitressHandleHeader (waith, key, val);
+					}
+				}
+				break;
+
+			default:
+				break;
+		} /* end switch */
+		thisLine = nextLine;
+	} /* end while strchr */
+	memmove (buf, thisLine, waith->request.bufFilled-(thisLine-buf));
+	waith->request.bufFilled -= (thisLine-buf);
+
+	return WAITRESS_RET_OK;
+}
+
+/*	check whether a finished request received the whole body
+ *	@param Waitress handle
+ *	@param result so far
+ *	@return result, WAITRESS_RET_PARTIAL_FILE if the connection was closed
+ *	early or WAITRESS_RET_DECODING_ERR if the compressed stream is
+ *	truncated
+ */
+static WaitressReturn_t WaitressBodyResult (const WaitressHandle_t *waith,
+		const WaitressReturn_t wRet) {
+	if (wRet != WAITRESS_RET_OK) {
+		return wRet;
+	}
+	if (waith->request.contentReceived < waith->request.contentLength) {
+		return WAITRESS_RET_PARTIAL_FILE;
+	}
+	/* an empty body has no stream at all */
+	if (waith->request.compressed && waith->request.contentReceived > 0 &&
+			!waith->request.inflateDone) {
+		return WAITRESS_RET_DECODING_ERR;
+	}
 	return WAITRESS_RET_OK;
 }
 
@@ -998,91 +2032,74 @@ static WaitressReturn_t WaitressSendRequest (WaitressHandle_t *waith) {
 static WaitressReturn_t WaitressReceiveHeaders (WaitressHandle_t *waith,
 		size_t *retRemaining) {
 	char * const buf = waith->request.buf;
-	size_t bufFilled = 0, recvSize = 0;
-	char *nextLine = NULL, *thisLine = NULL;
-	enum {HDRM_HEAD, HDRM_LINES, HDRM_FINISHED} hdrParseMode = HDRM_HEAD;
+	size_t recvSize = 0;
 	WaitressReturn_t wRet = WAITRESS_RET_OK;
 
+	waith->request.hdrParseMode = HDRM_HEAD;
+	waith->request.bufFilled = 0;
+
 	/* receive answer */
-	nextLine = buf;
-	while (hdrParseMode != HDRM_FINISHED) {
-		READ_RET (buf+bufFilled, WAITRESS_BUFFER_SIZE-1 - bufFilled, &recvSize);
+	while (waith->request.hdrParseMode != HDRM_FINISHED) {
+		READ_RET (buf+waith->request.bufFilled,
+				WAITRESS_BUFFER_SIZE-1 - waith->request.bufFilled, &recvSize);
 		if (recvSize == 0) {
 			/* connection closed too early */
 			return WAITRESS_RET_CONNECTION_CLOSED;
 		}
-		bufFilled += recvSize;
-		buf[bufFilled] = '\0';
-		thisLine = buf;
-
-		/* split */
-		while (hdrParseMode != HDRM_FINISHED &&
-				(nextLine = WaitressGetline (thisLine)) != NULL) {
-			switch (hdrParseMode) {
-				/* Status code */
-				case HDRM_HEAD:
-					switch (WaitressParseStatusline (thisLine)) {
-						case 200:
-						case 206:
-							hdrParseMode = HDRM_LINES;
-							break;
-
-						case 400:
-							return WAITRESS_RET_BAD_REQUEST;
-							break;
-
-						case 403:
-							return WAITRESS_RET_FORBIDDEN;
-							break;
-
-						case 404:
-							return WAITRESS_RET_NOTFOUND;
-							break;
-
-						case -1:
-							/* ignore invalid line */
-							break;
-
-						default:
-							return WAITRESS_RET_STATUS_UNKNOWN;
-							break;
-					}
-					break;
-
-				/* Everything else, except status code */
-				case HDRM_LINES:
-					/* empty line => content starts here */
-					if (*thisLine == '\0') {
-						hdrParseMode = HDRM_FINISHED;
-					} else {
-						/* parse header: "key: value", ignore invalid lines */
-						char *key = thisLine, *val;
-
-						val = strchr (thisLine, ':');
-						if (val != NULL) {
-							*val++ = '\0';
-							while (*val != '\0' && isspace ((unsigned char) *val)) {
-								++val;
-							}
-							WaitressHandleHeader (waith, key, val);
-						}
-					}
-					break;
-
-				default:
-					break;
-			} /* end switch */
-			thisLine = nextLine;
-		} /* end while strchr */
-		memmove (buf, thisLine, bufFilled-(thisLine-buf));
-		bufFilled -= (thisLine-buf);
+		waith->request.bufFilled += recvSize;
+		if ((wRet = WaitressParseHeaders (waith)) != WAITRESS_RET_OK) {
+			return wRet;
+		}
 	} /* end while hdrParseMode */
 
-	*retRemaining = bufFilled;
+	*retRemaining = waith->request.bufFilled;
 
 	return wRet;
 }
 
+/*	hand body data in request's buf to the data handler
+ *	@param Waitress handle
+ *	@param number of bytes
+ *	@param set to true if the body is complete
+ */
+static WaitressReturn_t WaitressReceiveBody (WaitressHandle_t *waith,
+		const size_t recvSize, bool *done) {
+	char * const buf = waith->request.buf;
+
+	*done = false;
+
+	/* data must be \0-terminated for chunked handler */
+	buf[recvSize] = '\0';
+	switch (waith->request.dataHandler (waith, buf, recvSize)) {
+		case WAITRESS_HANDLER_DONE:
+			waith->request.complete = true;
+			*done = true;
+			return WAITRESS_RET_OK;
+			break;
+
+		case WAITRESS_HANDLER_ERR:
+			return WAITRESS_RET_DECODING_ERR;
+			break;
+
+		case WAITRESS_HANDLER_ABORTED:
+			return WAITRESS_RET_CB_ABORT;
+			break;
+
+		case WAITRESS_HANDLER_CONTINUE:
+			/* go on */
+			break;
+	}
+	if (waith->request.contentLengthKnown &&
+			waith->request.contentReceived >= waith->request.contentLength) {
+		/* don’t call read() again if we know the body’s size and have all
+		 * of it already */
+		waith->request.complete = waith->request.contentReceived ==
+				waith->request.contentLength;
+		*done = true;
+	}
+	return WAITRESS_RET_OK;
+}
+
 /*	read response header and data
  */
 static WaitressReturn_t WaitressReceiveResponse (WaitressHandle_t *waith) {
@@ -1091,6 +2108,7 @@ static WaitressReturn_t WaitressReceiveResponse (WaitressHandle_t *waith) {
 
 	char * const buf = waith->request.buf;
 	size_t recvSize = 0;
+	bool done = false;
 	WaitressReturn_t wRet = WAITRESS_RET_OK;
 
 	if ((wRet = WaitressReceiveHeaders (waith, &recvSize)) != WAITRESS_RET_OK) {
@@ -1098,30 +2116,9 @@ static WaitressReturn_t WaitressReceiveResponse (WaitressHandle_t *waith) {
 	}
 
 	do {
-		/* data must be \0-terminated for chunked handler */
-		buf[recvSize] = '\0';
-		switch (waith->request.dataHandler (waith, buf, recvSize)) {
-			case WAITRESS_HANDLER_DONE:
-				return WAITRESS_RET_OK;
-				break;
-
-			case WAITRESS_HANDLER_ERR:
-				return WAITRESS_RET_DECODING_ERR;
-				break;
-
-			case WAITRESS_HANDLER_ABORTED:
-				return WAITRESS_RET_CB_ABORT;
-				break;
-
-			case WAITRESS_HANDLER_CONTINUE:
-				/* go on */
-				break;
-		}
-		if (waith->request.contentLengthKnown &&
-				waith->request.contentReceived >= waith->request.contentLength) {
-			/* don’t call read() again if we know the body’s size and have all
-			 * of it already */
-			break;
+		if ((wRet = WaitressReceiveBody (waith, recvSize, &done)) !=
+				WAITRESS_RET_OK || done) {
+			return wRet;
 		}
 		READ_RET (buf, WAITRESS_BUFFER_SIZE-1, &recvSize);
 	} while (recvSize > 0);
@@ -1129,70 +2126,742 @@ static WaitressReturn_t WaitressReceiveResponse (WaitressHandle_t *waith) {
 	return WAITRESS_RET_OK;
 }
 
-/*	Receive data from host and call *callback ()
+/*	set up tls session for a new connection
  *	@param waitress handle
- *	@return WaitressReturn_t
+ *	@return WAITRESS_RET_OK on success
  */
-WaitressReturn_t WaitressFetchCall (WaitressHandle_t *waith) {
-	WaitressReturn_t wRet = WAITRESS_RET_OK;
+static WaitressReturn_t WaitressTlsInit (WaitressHandle_t *waith) {
+	/* credentials are shared by all of the handle's connections */
+	if (waith->tlsCred == NULL) {
+		gnutls_certificate_allocate_credentials (&waith->tlsCred);
+	}
+
+	gnutls_init (&waith->request.tlsSession, GNUTLS_CLIENT);
+	gnutls_set_default_priority (waith->request.tlsSession);
+
+	if (gnutls_credentials_set (waith->request.tlsSession,
+			GNUTLS_CRD_CERTIFICATE,
+			waith->tlsCred) != GNUTLS_E_SUCCESS) {
+		gnutls_deinit (waith->request.tlsSession);
+		return WAITRESS_RET_ERR;
+	}
+
+	/* try to resume the last session with this host */
+	const WaitressTlsSession_t * const sess = WaitressTlsSessionFind (waith);
+	if (sess != NULL) {
+		gnutls_session_set_data (waith->request.tlsSession, sess->data.data,
+				sess->data.size);
+	}
+
+	/* set up custom read/write functions */
+	gnutls_transport_set_ptr (waith->request.tlsSession,
+			(gnutls_transport_ptr_t) waith);
+	gnutls_transport_set_pull_function (waith->request.tlsSession,
+			WaitressPollRead);
+	gnutls_transport_set_push_function (waith->request.tlsSession,
+			WaitressPollWrite);
+
+	return WAITRESS_RET_OK;
+}
+
+/*	close connections that have been idle for too long
+ *	@param Waitress handle
+ */
+static void WaitressPoolExpire (WaitressHandle_t *waith) {
+	const time_t now = time (NULL);
+
+	for (size_t i = 0; i < WAITRESS_POOL_SIZE; i++) {
+		WaitressConnection_t * const conn = &waith->pool[i];
+
+		if (conn->sockfd != -1 &&
+				(now - conn->idleSince >= waith->idleTimeout ||
+				now < conn->idleSince)) {
+			WaitressPoolClose (conn);
+		}
+	}
+}
+
+/*	take idle connection to the request's host out of the pool
+ *	@param Waitress handle
+ *	@return true if one was found, request's socket and tls session are set
+ *	up
+ */
+static bool WaitressPoolGet (WaitressHandle_t *waith) {
+	const char * const port = WaitressDefaultPort (&waith->url);
 
-	/* initialize */
+	for (size_t i = 0; i < WAITRESS_POOL_SIZE; i++) {
+		WaitressConnection_t * const conn = &waith->pool[i];
+		struct pollfd sockpoll = {conn->sockfd, POLLIN, 0};
+
+		if (conn->sockfd == -1 || conn->tls != waith->url.tls ||
+				strcmp (conn->host, waith->url.host) != 0 ||
+				strcmp (conn->port, port) != 0) {
+			continue;
+		}
+
+		/* idle connections must not be readable, otherwise the server
+		 * closed it (or sent garbage) */
+		if (poll (&sockpoll, 1, 0) != 0) {
+			WaitressPoolClose (conn);
+			continue;
+		}
+
+		waith->request.sockfd = conn->sockfd;
+		if (conn->tls) {
+			waith->request.tlsSession = conn->tlsSession;
+			waith->request.read = WaitressGnutlsRead;
+			waith->request.write = WaitressGnutlsWrite;
+		}
+		free (conn->host);
+		free (conn->port);
+		memset (conn, 0, sizeof (*conn));
+		conn->sockfd = -1;
+
+		return true;
+	}
+
+	return false;
+}
+
+/*	put request's connection into the pool, replacing the connection that
+ *	has been idle for the longest time if it is full
+ *	@param Waitress handle
+ */
+static void WaitressPoolPut (WaitressHandle_t *waith) {
+	WaitressConnection_t *conn = &waith->pool[0];
+
+	for (size_t i = 0; i < WAITRESS_POOL_SIZE; i++) {
+		if (waith->pool[i].sockfd == -1) {
+			conn = &waith->pool[i];
+			break;
+		}
+		if (waith->pool[i].idleSince < conn->idleSince) {
+			conn = &waith->pool[i];
+		}
+	}
+	WaitressPoolClose (conn);
+
+	conn->sockfd = waith->request.sockfd;
+	conn->host = strdup (waith->url.host);
+	conn->port = strdup (WaitressDefaultPort (&waith->url));
+	conn->tls = waith->url.tls;
+	conn->tlsSession = waith->request.tlsSession;
+	conn->idleSince = time (NULL);
+	waith->request.sockfd = -1;
+}
+
+/*	reset per-request data
+ *	@param Waitress handle
+ *	@param buffer, WAITRESS_BUFFER_SIZE bytes
+ */
+static void WaitressRequestInit (WaitressHandle_t *waith, char *buf) {
 	memset (&waith->request, 0, sizeof (waith->request));
 	waith->request.sockfd = -1;
 	waith->request.dataHandler = WaitressHandleIdentity;
 	waith->request.read = WaitressOrdinaryRead;
 	waith->request.write = WaitressOrdinaryWrite;
 	waith->request.contentLengthKnown = false;
+	waith->request.keepAlive = true;
+	waith->request.buf = buf;
+	WaitressTimingReset (waith);
+}
 
-	if (waith->url.tls) {
-		gnutls_init (&waith->request.tlsSession, GNUTLS_CLIENT);
-		gnutls_set_default_priority (waith->request.tlsSession);
+/*	put request's connection into the pool or close it
+ *	@param Waitress handle
+ *	@param request result
+ *	@param keep-alive enabled
+ *	@param connection was set up successfully
+ *	@param request will be retried
+ */
+static void WaitressRequestCleanup (WaitressHandle_t *waith,
+		const WaitressReturn_t wRet, const bool usePool, const bool connected,
+		const bool retry) {
+	free (waith->request.out);
+	waith->request.out = NULL;
+	WaitressInflateEnd (waith);
+	if (waith->request.connect.gares != NULL) {
+		WaitressConnectEnd (waith);
+	}
 
-		gnutls_certificate_allocate_credentials (&waith->tlsCred);
-		if (gnutls_credentials_set (waith->request.tlsSession,
-				GNUTLS_CRD_CERTIFICATE,
-				waith->tlsCred) != GNUTLS_E_SUCCESS) {
-			return WAITRESS_RET_ERR;
+	if (waith->url.tls && wRet == WAITRESS_RET_OK &&
+			!waith->request.reused) {
+		WaitressTlsSessionStore (waith);
+	}
+	if (usePool && wRet == WAITRESS_RET_OK && waith->request.keepAlive &&
+			waith->request.complete) {
+		WaitressPoolPut (waith);
+	} else {
+		if (waith->url.tls) {
+			if (connected && !retry) {
+				/* don't wait for the server's close_notify if we must
+				 * not block */
+				gnutls_bye (waith->request.tlsSession,
+						waith->request.nonblocking ? GNUTLS_SHUT_WR :
+						GNUTLS_SHUT_RDWR);
+			}
+			gnutls_deinit (waith->request.tlsSession);
+		}
+		if (waith->request.sockfd != -1) {
+			close (waith->request.sockfd);
+			waith->request.sockfd = -1;
 		}
-
-		/* set up custom read/write functions */
-		gnutls_transport_set_ptr (waith->request.tlsSession,
-				(gnutls_transport_ptr_t) waith);
-		gnutls_transport_set_pull_function (waith->request.tlsSession,
-				WaitressPollRead);
-		gnutls_transport_set_push_function (waith->request.tlsSession,
-				WaitressPollWrite);
 	}
+}
 
+/*	Receive data from host and call *callback ()
+ *	@param waitress handle
+ *	@return WaitressReturn_t
+ */
+WaitressReturn_t WaitressFetchCall (WaitressHandle_t *waith) {
+	WaitressReturn_t wRet = WAITRESS_RET_OK;
+	/* retry with a new connection once if a pooled one is dead */
+	bool retry = false, usePool = WaitressPoolEnabled (waith);
 	/* buffer is required for connect already */
-	waith->request.buf = malloc (WAITRESS_BUFFER_SIZE *
-			sizeof (*waith->request.buf));
+	char * const buf = malloc (WAITRESS_BUFFER_SIZE * sizeof (*buf));
+
+	if (buf == NULL) {
+		return WAITRESS_RET_ERR;
+	}
 
-	/* request */
-	if ((wRet = WaitressConnect (waith)) == WAITRESS_RET_OK) {
-		if ((wRet = WaitressSendRequest (waith)) == WAITRESS_RET_OK) {
-			wRet = WaitressReceiveResponse (waith);
+	WaitressPoolExpire (waith);
+	WaitressTimingStart (waith);
+
+	do {
+		bool connected = false;
+
+		WaitressRequestInit (waith, buf);
+
+		if (usePool && WaitressPoolGet (waith)) {
+			waith->request.reused = true;
+			connected = true;
+			wRet = WAITRESS_RET_OK;
+		} else if (waith->url.tls &&
+				(wRet = WaitressTlsInit (waith)) != WAITRESS_RET_OK) {
+			break;
+		} else {
+			wRet = WaitressConnect (waith);
+			connected = wRet == WAITRESS_RET_OK;
 		}
-		if (waith->url.tls) {
-			gnutls_bye (waith->request.tlsSession, GNUTLS_SHUT_RDWR);
+
+		/* request */
+		if (wRet == WAITRESS_RET_OK) {
+			if ((wRet = WaitressSendRequest (waith)) == WAITRESS_RET_OK) {
+				wRet = WaitressReceiveResponse (waith);
+			}
+		}
+
+		/* a server closing an idle connection is not an error, but
+		 * anything that might have reached the callback is */
+		retry = waith->request.reused && !waith->request.headersReceived &&
+				wRet != WAITRESS_RET_OK && wRet != WAITRESS_RET_CB_ABORT;
+		if (retry) {
+			usePool = false;
 		}
+
+		WaitressRequestCleanup (waith, wRet, usePool, connected, retry);
+	} while (retry);
+
+	free (buf);
+	waith->request.buf = NULL;
+
+	wRet = WaitressBodyResult (waith, wRet);
+	if (wRet == WAITRESS_RET_OK) {
+		WaitressTimingMark (waith, &waith->timing.done);
 	}
+	return wRet;
+}
 
-	/* cleanup */
-	if (waith->url.tls) {
-		gnutls_deinit (waith->request.tlsSession);
-		gnutls_certificate_free_credentials (waith->tlsCred);
+/*	WaitressMulti_t request states
+ */
+enum {
+	WAITRESS_MULTI_START = 0,
+	WAITRESS_MULTI_CONNECT,
+	WAITRESS_MULTI_HANDSHAKE,
+	WAITRESS_MULTI_SEND,
+	WAITRESS_MULTI_RECEIVE,
+};
+
+void WaitressMultiInit (WaitressMulti_t *multi) {
+	assert (multi != NULL);
+
+	memset (multi, 0, sizeof (*multi));
+	multi->cancelFd = -1;
+}
+
+/*	Add request, it is run by WaitressMultiPerform ()
+ *	@param multi handle
+ *	@param waitress handle, url etc. set up; must not be used until the
+ *			request is finished
+ *	@param called when the request is finished, may be NULL
+ *	@param passed to callback
+ *	@return false if there are too many requests already
+ */
+bool WaitressMultiAdd (WaitressMulti_t *multi, WaitressHandle_t *waith,
+		WaitressMultiCb_t callback, void *data) {
+	assert (multi != NULL);
+	assert (waith != NULL);
+
+	for (size_t i = 0; i < WAITRESS_MULTI_SIZE; i++) {
+		assert (multi->requests[i].waith != waith);
+	}
+
+	for (size_t i = 0; i < WAITRESS_MULTI_SIZE; i++) {
+		if (multi->requests[i].waith == NULL) {
+			memset (&multi->requests[i], 0, sizeof (multi->requests[i]));
+			multi->requests[i].waith = waith;
+			multi->requests[i].callback = callback;
+			multi->requests[i].data = data;
+			multi->requests[i].state = WAITRESS_MULTI_START;
+			multi->requests[i].usePool = WaitressPoolEnabled (waith);
+			WaitressTimingStart (waith);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*	Add request that fetches a string, like WaitressFetchBufEx (). Beware!
+ *	This overwrites your waith->data pointer
+ *	@param multi handle
+ *	@param waitress handle
+ *	@param \0-terminated result buffer, malloced (don't forget to free it
+ *			yourself)
+ *	@param size of the buffer, may be NULL
+ *	@param result of the request
+ *	@return false if there are too many requests already
+ */
+bool WaitressMultiAddBuf (WaitressMulti_t *multi, WaitressHandle_t *waith,
+		char **retBuffer, size_t *size, WaitressReturn_t *retStatus) {
+	assert (retBuffer != NULL);
+	assert (retStatus != NULL);
+
+	if (!WaitressMultiAdd (multi, waith, NULL, NULL)) {
+		return false;
 	}
-	if (waith->request.sockfd != -1) {
-		close (waith->request.sockfd);
+	for (size_t i = 0; i < WAITRESS_MULTI_SIZE; i++) {
+		if (multi->requests[i].waith == waith) {
+			multi->requests[i].retBuffer = retBuffer;
+			multi->requests[i].retSize = size;
+			multi->requests[i].retStatus = retStatus;
+			multi->requests[i].buffer.waith = waith;
+			waith->data = &multi->requests[i].buffer;
+			waith->callback = WaitressFetchBufCb;
+			break;
+		}
 	}
+	return true;
+}
+
+/*	request is finished, free its slot and report the result
+ *	@param multi handle
+ *	@param slot
+ *	@param result
+ */
+static void WaitressMultiDone (WaitressMulti_t *multi, const size_t i,
+		WaitressReturn_t wRet) {
+	WaitressHandle_t * const waith = multi->requests[i].waith;
+	const WaitressMultiCb_t callback = multi->requests[i].callback;
+	void * const data = multi->requests[i].data;
+
 	free (waith->request.buf);
+	waith->request.buf = NULL;
 
-	if (wRet == WAITRESS_RET_OK &&
-			waith->request.contentReceived < waith->request.contentLength) {
-		return WAITRESS_RET_PARTIAL_FILE;
+	wRet = WaitressBodyResult (waith, wRet);
+	if (multi->requests[i].buffer.tooLarge) {
+		wRet = WAITRESS_RET_TOO_LARGE;
 	}
-	return wRet;
+	if (wRet == WAITRESS_RET_OK) {
+		WaitressTimingMark (waith, &waith->timing.done);
+	}
+
+	if (multi->requests[i].retBuffer != NULL) {
+		*multi->requests[i].retBuffer = multi->requests[i].buffer.data;
+		if (multi->requests[i].retSize != NULL) {
+			*multi->requests[i].retSize = multi->requests[i].buffer.pos;
+		}
+		*multi->requests[i].retStatus = wRet;
+	}
+
+	/* the callback may add new requests */
+	multi->requests[i].waith = NULL;
+	if (callback != NULL) {
+		callback (waith, wRet, data);
+	}
+}
+
+/*	request is finished or failed, clean up like WaitressFetchCall ()
+ *	@param multi handle
+ *	@param slot
+ *	@param result
+ */
+static void WaitressMultiFinish (WaitressMulti_t *multi, const size_t i,
+		const WaitressReturn_t wRet) {
+	WaitressHandle_t * const waith = multi->requests[i].waith;
+
+	/* a server closing an idle connection is not an error, but
+	 * anything that might have reached the callback is */
+	const bool retry = waith->request.reused &&
+			!waith->request.headersReceived &&
+			wRet != WAITRESS_RET_OK && wRet != WAITRESS_RET_CB_ABORT;
+	if (retry) {
+		multi->requests[i].usePool = false;
+	}
+
+	WaitressRequestCleanup (waith, wRet, multi->requests[i].usePool,
+			multi->requests[i].connected, retry);
+
+	if (retry) {
+		free (waith->request.buf);
+		waith->request.buf = NULL;
+		multi->requests[i].state = WAITRESS_MULTI_START;
+		return;
+	}
+	WaitressMultiDone (multi, i, wRet);
+}
+
+/*	do as much of the request's i/o as possible without blocking
+ *	@param multi handle
+ *	@param slot
+ */
+static void WaitressMultiIo (WaitressMulti_t *multi, const size_t i) {
+	WaitressHandle_t * const waith = multi->requests[i].waith;
+	char * const buf = waith->request.buf;
+	WaitressReturn_t wRet = WAITRESS_RET_OK;
+
+	multi->requests[i].deadline = WaitressMsNow () + waith->timeout;
+
+	while (true) {
+		waith->request.wouldBlock = false;
+
+		switch (multi->requests[i].state) {
+			case WAITRESS_MULTI_HANDSHAKE: {
+				const int ret = gnutls_handshake (waith->request.tlsSession);
+
+				if (ret == GNUTLS_E_AGAIN || ret == GNUTLS_E_INTERRUPTED) {
+					multi->requests[i].events = gnutls_record_get_direction (
+							waith->request.tlsSession) == 1 ? POLLOUT : POLLIN;
+					return;
+				} else if (ret != GNUTLS_E_SUCCESS) {
+					wRet = WAITRESS_RET_TLS_HANDSHAKE_ERR;
+					goto finish;
+				}
+				if ((wRet = WaitressTlsHandshakeDone (waith,
+						multi->requests[i].handshakeStart)) !=
+						WAITRESS_RET_OK) {
+					goto finish;
+				}
+				if (!WaitressFormatRequest (waith)) {
+					wRet = WAITRESS_RET_ERR;
+					goto finish;
+				}
+				multi->requests[i].state = WAITRESS_MULTI_SEND;
+				break;
+			}
+
+			case WAITRESS_MULTI_SEND: {
+				const char * const out = waith->request.out +
+						waith->request.outSent;
+				const size_t size = waith->request.outSize -
+						waith->request.outSent;
+				ssize_t ret;
+
+				if (waith->request.write == WaitressGnutlsWrite) {
+					ret = gnutls_record_send (waith->request.tlsSession, out,
+							size);
+					if (ret < 0 && !waith->request.wouldBlock) {
+						wRet = WAITRESS_RET_TLS_WRITE_ERR;
+						goto finish;
+					}
+				} else {
+					ret = WaitressPollWrite (waith, out, size);
+					if (ret < 0 && !waith->request.wouldBlock) {
+						wRet = waith->request.readWriteRet;
+						goto finish;
+					}
+				}
+				if (ret < 0) {
+					multi->requests[i].events = POLLOUT;
+					return;
+				}
+
+				waith->request.outSent += ret;
+				if (waith->request.outSent == waith->request.outSize) {
+					free (waith->request.out);
+					waith->request.out = NULL;
+					waith->request.outSize = waith->request.outSent = 0;
+					if (!multi->requests[i].tunnel) {
+						WaitressTimingMark (waith, &waith->timing.sent);
+					}
+					waith->request.hdrParseMode = HDRM_HEAD;
+					waith->request.bufFilled = 0;
+					multi->requests[i].state = WAITRESS_MULTI_RECEIVE;
+				}
+				break;
+			}
+
+			case WAITRESS_MULTI_RECEIVE: {
+				size_t recvSize = 0;
+				bool done;
+
+				if (waith->request.hdrParseMode != HDRM_FINISHED) {
+					if ((wRet = waith->request.read (waith,
+							buf + waith->request.bufFilled,
+							WAITRESS_BUFFER_SIZE-1 - waith->request.bufFilled,
+							&recvSize)) != WAITRESS_RET_OK) {
+						goto finish;
+					}
+					if (waith->request.wouldBlock) {
+						multi->requests[i].events = POLLIN;
+						return;
+					}
+					if (recvSize == 0) {
+						/* connection closed too early */
+						wRet = WAITRESS_RET_CONNECTION_CLOSED;
+						goto finish;
+					}
+					waith->request.bufFilled += recvSize;
+					if ((wRet = WaitressParseHeaders (waith)) !=
+							WAITRESS_RET_OK) {
+						goto finish;
+					}
+					if (waith->request.hdrParseMode != HDRM_FINISHED) {
+						break;
+					}
+					if (multi->requests[i].tunnel) {
+						/* proxy tunnel is set up */
+						multi->requests[i].tunnel = false;
+						multi->requests[i].handshakeStart = WaitressMsNow ();
+						multi->requests[i].state = WAITRESS_MULTI_HANDSHAKE;
+						break;
+					}
+					recvSize = waith->request.bufFilled;
+				} else {
+					if ((wRet = waith->request.read (waith, buf,
+							WAITRESS_BUFFER_SIZE-1, &recvSize)) !=
+							WAITRESS_RET_OK) {
+						goto finish;
+					}
+					if (waith->request.wouldBlock) {
+						multi->requests[i].events = POLLIN;
+						return;
+					}
+					if (recvSize == 0) {
+						goto finish;
+					}
+				}
+				if ((wRet = WaitressReceiveBody (waith, recvSize, &done)) !=
+						WAITRESS_RET_OK || done) {
+					goto finish;
+				}
+				break;
+			}
+
+			default:
+				assert (0);
+				break;
+		}
+	}
+
+finish:
+	WaitressMultiFinish (multi, i, wRet);
+}
+
+/*	connection is set up, prepare the first request to send
+ *	@param multi handle
+ *	@param slot
+ */
+static void WaitressMultiConnected (WaitressMulti_t *multi, const size_t i) {
+	WaitressHandle_t * const waith = multi->requests[i].waith;
+
+	multi->requests[i].connected = true;
+	if (waith->url.tls && !waith->request.reused) {
+		if (WaitressProxyEnabled (waith)) {
+			multi->requests[i].tunnel = true;
+			if (!WaitressFormatTunnel (waith)) {
+				WaitressMultiFinish (multi, i, WAITRESS_RET_ERR);
+				return;
+			}
+			multi->requests[i].state = WAITRESS_MULTI_SEND;
+		} else {
+			multi->requests[i].handshakeStart = WaitressMsNow ();
+			multi->requests[i].state = WAITRESS_MULTI_HANDSHAKE;
+		}
+	} else {
+		if (!WaitressFormatRequest (waith)) {
+			WaitressMultiFinish (multi, i, WAITRESS_RET_ERR);
+			return;
+		}
+		multi->requests[i].state = WAITRESS_MULTI_SEND;
+	}
+	WaitressMultiIo (multi, i);
+}
+
+/*	start request: take a connection from the pool or resolve the name
+ *	@param multi handle
+ *	@param slot
+ */
+static void WaitressMultiStart (WaitressMulti_t *multi, const size_t i) {
+	WaitressHandle_t * const waith = multi->requests[i].waith;
+	char * const buf = malloc (WAITRESS_BUFFER_SIZE * sizeof (*buf));
+	WaitressReturn_t wRet;
+
+	if (buf == NULL) {
+		waith->request.buf = NULL;
+		WaitressMultiDone (multi, i, WAITRESS_RET_ERR);
+		return;
+	}
+
+	WaitressPoolExpire (waith);
+	WaitressRequestInit (waith, buf);
+	waith->request.nonblocking = true;
+	multi->requests[i].connected = false;
+	multi->requests[i].tunnel = false;
+
+	if (multi->requests[i].usePool && WaitressPoolGet (waith)) {
+		waith->request.reused = true;
+		WaitressMultiConnected (multi, i);
+	} else if (waith->url.tls &&
+			(wRet = WaitressTlsInit (waith)) != WAITRESS_RET_OK) {
+		WaitressMultiDone (multi, i, wRet);
+	} else if ((wRet = WaitressConnectBegin (waith)) != WAITRESS_RET_OK) {
+		WaitressMultiFinish (multi, i, wRet);
+	} else {
+		multi->requests[i].state = WAITRESS_MULTI_CONNECT;
+	}
+}
+
+/*	Run all requests until they are finished
+ *	@param multi handle
+ *	@return WAITRESS_RET_OK, WAITRESS_RET_CB_ABORT if the multi handle's
+ *	cancel fd became readable or WAITRESS_RET_ERR; results of the single
+ *	requests are reported to their callbacks
+ */
+WaitressReturn_t WaitressMultiPerform (WaitressMulti_t *multi) {
+	struct pollfd fds[WAITRESS_MULTI_SIZE * (WAITRESS_CONNECT_MAX+1) + 1];
+	WaitressReturn_t ret = WAITRESS_RET_OK;
+
+	assert (multi != NULL);
+
+	while (true) {
+		long long int now = WaitressMsNow ();
+		int timeout = -1, pollres;
+		size_t n = 0;
+
+		/* collect pollfds */
+		for (size_t i = 0; i < WAITRESS_MULTI_SIZE; i++) {
+			WaitressHandle_t *waith;
+			int reqTimeout = -1;
+
+			/* finishing a request may start another one in this slot
+			 * (retry or callback) */
+			while ((waith = multi->requests[i].waith) != NULL) {
+				if (multi->requests[i].state == WAITRESS_MULTI_START) {
+					WaitressMultiStart (multi, i);
+				} else if (multi->requests[i].state ==
+						WAITRESS_MULTI_CONNECT && (reqTimeout =
+						WaitressConnectStep (waith, now)) == -1) {
+					/* all attempts failed */
+					WaitressMultiFinish (multi, i, WaitressConnectEnd (waith));
+				} else {
+					break;
+				}
+			}
+			if (waith == NULL) {
+				continue;
+			}
+
+			multi->requests[i].pollFirst = n;
+			if (multi->requests[i].state == WAITRESS_MULTI_CONNECT) {
+				multi->requests[i].pollCount = waith->request.connect.next;
+				memcpy (&fds[n], waith->request.connect.fds,
+						waith->request.connect.next * sizeof (*fds));
+			} else {
+				const long long int left = multi->requests[i].deadline - now;
+
+				reqTimeout = left > 0 ? left : 0;
+				multi->requests[i].pollCount = 1;
+				fds[n].fd = waith->request.sockfd;
+				fds[n].events = multi->requests[i].events;
+			}
+			n += multi->requests[i].pollCount;
+
+			if (waith->cancelFd != -1) {
+				fds[n].fd = waith->cancelFd;
+				fds[n].events = POLLIN;
+				++n;
+			}
+
+			if (timeout == -1 || reqTimeout < timeout) {
+				timeout = reqTimeout;
+			}
+		}
+
+		if (n == 0) {
+			/* all requests are finished */
+			break;
+		}
+
+		fds[n].fd = multi->cancelFd;
+		fds[n].events = POLLIN;
+		for (size_t i = 0; i <= n; i++) {
+			fds[i].revents = 0;
+		}
+		do {
+			errno = 0;
+			pollres = poll (fds, n+1, timeout);
+		} while (errno == EINTR || errno == EINPROGRESS || errno == EAGAIN);
+
+		if (pollres == -1 || fds[n].revents != 0) {
+			ret = pollres == -1 ? WAITRESS_RET_ERR : WAITRESS_RET_CB_ABORT;
+			for (size_t i = 0; i < WAITRESS_MULTI_SIZE; i++) {
+				if (multi->requests[i].waith == NULL) {
+					continue;
+				}
+				if (multi->requests[i].state == WAITRESS_MULTI_START) {
+					/* added by a callback, not started yet */
+					multi->requests[i].waith->request.buf = NULL;
+					WaitressMultiDone (multi, i, ret);
+				} else {
+					WaitressMultiFinish (multi, i, ret);
+				}
+			}
+			break;
+		}
+
+		/* handle events */
+		now = WaitressMsNow ();
+		for (size_t i = 0; i < WAITRESS_MULTI_SIZE; i++) {
+			WaitressHandle_t * const waith = multi->requests[i].waith;
+
+			/* not polled, e.g. added by a callback */
+			if (waith == NULL ||
+					multi->requests[i].state == WAITRESS_MULTI_START) {
+				continue;
+			}
+
+			const struct pollfd * const reqFds =
+					&fds[multi->requests[i].pollFirst];
+			const size_t count = multi->requests[i].pollCount;
+
+			if (waith->cancelFd != -1 && reqFds[count].revents != 0) {
+				WaitressMultiFinish (multi, i, WAITRESS_RET_CB_ABORT);
+			} else if (multi->requests[i].state == WAITRESS_MULTI_CONNECT) {
+				for (size_t j = 0; j < count; j++) {
+					waith->request.connect.fds[j].revents = reqFds[j].revents;
+				}
+				if (WaitressConnectCheck (waith, now)) {
+					WaitressConnectEnd (waith);
+					WaitressMultiConnected (multi, i);
+				}
+			} else if (reqFds[0].revents != 0) {
+				WaitressMultiIo (multi, i);
+			} else if (now >= multi->requests[i].deadline) {
+				WaitressMultiFinish (multi, i, WAITRESS_RET_TIMEOUT);
+			}
+		}
+	}
+
+	return ret;
 }
 
 const char *WaitressErrorToStr (WaitressReturn_t wRet) {
@@ -1269,6 +2938,10 @@ const char *WaitressErrorToStr (WaitressReturn_t wRet) {
 			return "TLS fingerprint mismatch.";
 			break;
 
+		case WAITRESS_RET_TOO_LARGE:
+			return "Response too large.";
+			break;
+
 		default:
 			return "No error message available.";
 			break;
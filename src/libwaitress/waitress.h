@@ -27,9 +27,19 @@ THE SOFTWARE.
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <time.h>
+#include <poll.h>
 #include <gnutls/gnutls.h>
 
 #define WAITRESS_BUFFER_SIZE 10*1024
+/* idle keep-alive connections per handle */
+#define WAITRESS_POOL_SIZE 4
+/* max addresses tried */
+#define WAITRESS_CONNECT_MAX 8
+/* requests driven by one WaitressMulti_t */
+#define WAITRESS_MULTI_SIZE 8
+/* default limit for responses fetched into a buffer */
+#define WAITRESS_MAX_BUF_SIZE 32*1024*1024
 
 typedef enum {
 	WAITRESS_METHOD_GET = 0,
@@ -82,8 +92,43 @@ typedef enum {
 	WAITRESS_RET_DECODING_ERR,
 	WAITRESS_RET_TLS_HANDSHAKE_ERR,
 	WAITRESS_RET_TLS_FINGERPRINT_MISMATCH,
+	/* response exceeds maxBufSize */
+	WAITRESS_RET_TOO_LARGE,
 } WaitressReturn_t;
 
+/*	idle keep-alive connection
+ */
+typedef struct {
+	int sockfd; /* -1 if unused */
+	char *host, *port;
+	bool tls;
+	gnutls_session_t tlsSession;
+	time_t idleSince;
+} WaitressConnection_t;
+
+/*	tls session data for resumption
+ */
+typedef struct {
+	char *host, *port; /* NULL if unused */
+	gnutls_datum_t data;
+	/* the server's certificate matched this fingerprint */
+	char fingerprint[20];
+} WaitressTlsSession_t;
+
+struct addrinfo;
+
+/*	request phases, milliseconds since the request was started (-1 if it
+ *	did not get that far, e.g. no resolve/connect for pooled connections),
+ *	and transferred bytes
+ */
+typedef struct {
+	long int resolve, connect, handshake, sent, firstByte, headers, done;
+	/* on the wire, including headers and tls records */
+	unsigned long long int bytesSent, bytesReceived;
+	/* passed to the callback, i.e. after decompression */
+	unsigned long long int bodyBytes;
+} WaitressTiming_t;
+
 /*	reusable handle
  */
 typedef struct {
@@ -92,16 +137,50 @@ typedef struct {
 
 	const char *extraHeaders;
 	const char *postData;
+	/* ask for a gzip/deflate compressed response and decompress it before
+	 * it is passed to the callback; requires zlib support */
+	bool acceptEncoding;
 	/* extra data handed over to callback function */
 	void *data;
 	WaitressCbReturn_t (*callback) (void *, size_t, void *);
 	const char *tlsFingerprint;
+	/* requests are aborted (WAITRESS_RET_CB_ABORT) as soon as this fd
+	 * becomes readable, e.g. the read end of a pipe; -1 if unused */
+	int cancelFd;
+	/* WaitressFetchBuf* () responses larger than this (bytes) are aborted
+	 * with WAITRESS_RET_TOO_LARGE, 0 disables the limit */
+	size_t maxBufSize;
 
 	WaitressUrl_t url;
 	WaitressUrl_t proxy;
 
+	/* allocated by the first tls request */
 	gnutls_certificate_credentials_t tlsCred;
 
+	/* seconds idle connections are kept open, 0 disables keep-alive */
+	int idleTimeout;
+	WaitressConnection_t pool[WAITRESS_POOL_SIZE];
+	WaitressTlsSession_t tlsSessions[WAITRESS_POOL_SIZE];
+	size_t tlsSessionsNext;
+
+	/* address family of the last successful connect, per host */
+	struct {
+		char *host; /* NULL if unused */
+		int family;
+	} lastFamily[WAITRESS_POOL_SIZE];
+	size_t lastFamilyNext;
+
+	/* full and abbreviated (resumed) handshakes, time spent in both (ms) */
+	struct {
+		unsigned int handshakes, resumed;
+		unsigned long int time;
+	} tlsStats;
+
+	/* current or last request, see WaitressGetTiming (); WaitressMsNow ()
+	 * when it was started */
+	WaitressTiming_t timing;
+	long long int timingStart;
+
 	/* per-request data */
 	struct {
 		int sockfd;
@@ -111,9 +190,48 @@ typedef struct {
 
 		size_t contentLength, contentReceived, chunkSize;
 		bool contentLengthKnown;
-		enum {CHUNKSIZE = 0, DATA = 1} chunkedState;
+		/* size of the whole resource (Content-Range), 0 if unknown */
+		size_t contentRangeTotal;
+		enum {CHUNKSIZE = 0, DATA = 1, TRAILER = 2} chunkedState;
+		enum {HDRM_HEAD, HDRM_LINES, HDRM_FINISHED} hdrParseMode;
+		/* bytes of unparsed header data in buf */
+		size_t bufFilled;
+
+		/* response body is compressed, zlib stream (z_stream), end of
+		 * the stream seen */
+		bool compressed;
+		void *inflate;
+		bool inflateDone;
+
+		/* connection came from the pool, server did not send
+		 * “Connection: close”, header and body completely received */
+		bool reused, keepAlive, headersReceived, complete;
+
+		/* connection's certificate was checked, its fingerprint */
+		bool tlsVerified;
+		char tlsPeerFingerprint[20];
 
 		char *buf;
+		/* formatted request and number of bytes already sent */
+		char *out;
+		size_t outSize, outSent;
+
+		/* driven by WaitressMultiPerform (): read/write must not wait,
+		 * wouldBlock is set instead */
+		bool nonblocking, wouldBlock;
+
+		/* connection attempts in flight, the last pollfd is reserved */
+		struct {
+			const char *host;
+			struct addrinfo *gares;
+			struct addrinfo *addrs[WAITRESS_CONNECT_MAX];
+			struct pollfd fds[WAITRESS_CONNECT_MAX+1];
+			long long int started[WAITRESS_CONNECT_MAX];
+			size_t addrsN, next, active;
+			long long int nextStart;
+			WaitressReturn_t ret;
+		} connect;
+
 		/* first argument is WaitressHandle_t, but that's not defined yet */
 		WaitressHandlerReturn_t (*dataHandler) (void *, char *, const size_t);
 		WaitressReturn_t (*read) (void *, char *, const size_t, size_t *);
@@ -123,6 +241,61 @@ typedef struct {
 	} request;
 } WaitressHandle_t;
 
+/*	resolver hook, same semantics as getaddrinfo ()/freeaddrinfo ()
+ */
+typedef int (*WaitressResolveFn_t) (const char *, const char *,
+		const struct addrinfo *, struct addrinfo **);
+typedef void (*WaitressFreeAddrFn_t) (struct addrinfo *);
+
+typedef struct {
+	unsigned long int hits, misses;
+	/* time spent in lookups (cache misses), milliseconds */
+	unsigned long long int lookupTime;
+} WaitressDnsStats_t;
+
+typedef struct {
+	char *data;
+	/* bytes used (without \0), bytes allocated */
+	size_t pos, size;
+	const WaitressHandle_t *waith;
+	bool tooLarge;
+} WaitressFetchBufCbBuffer_t;
+
+/*	called once a request added to a WaitressMulti_t is finished
+ *	@param waitress handle
+ *	@param result, like WaitressFetchCall ()
+ *	@param user data
+ */
+typedef void (*WaitressMultiCb_t) (WaitressHandle_t *, WaitressReturn_t,
+		void *);
+
+/*	runs requests of several handles concurrently
+ */
+typedef struct {
+	/* aborts all requests as soon as it becomes readable, -1 if unused */
+	int cancelFd;
+
+	struct {
+		WaitressHandle_t *waith; /* NULL if unused */
+		WaitressMultiCb_t callback;
+		void *data;
+
+		/* WaitressMultiAddBuf () */
+		WaitressFetchBufCbBuffer_t buffer;
+		char **retBuffer;
+		size_t *retSize;
+		WaitressReturn_t *retStatus;
+
+		int state;
+		bool usePool, connected, tunnel;
+		short events;
+		/* WaitressMsNow () */
+		long long int deadline, handshakeStart;
+		/* index of first pollfd, number of them */
+		size_t pollFirst, pollCount;
+	} requests[WAITRESS_MULTI_SIZE];
+} WaitressMulti_t;
+
 void WaitressInit (WaitressHandle_t *);
 void WaitressFree (WaitressHandle_t *);
 bool WaitressSetProxy (WaitressHandle_t *, const char *);
@@ -130,8 +303,21 @@ char *WaitressUrlEncode (const char *);
 bool WaitressSetUrl (WaitressHandle_t *, const char *);
 WaitressReturn_t WaitressFetchBuf (WaitressHandle_t *, char **);
 WaitressReturn_t WaitressFetchBufEx (WaitressHandle_t *, char **, size_t *);
+WaitressReturn_t WaitressFetchBufReuse (WaitressHandle_t *, char **, size_t *,
+		size_t *);
 WaitressReturn_t WaitressFetchCall (WaitressHandle_t *);
 const char *WaitressErrorToStr (WaitressReturn_t);
+void WaitressGetTiming (const WaitressHandle_t *, WaitressTiming_t *);
+void WaitressDnsSetResolver (WaitressResolveFn_t, WaitressFreeAddrFn_t);
+void WaitressDnsSetTtl (unsigned int, unsigned int);
+void WaitressDnsFlush (void);
+void WaitressDnsGetStats (WaitressDnsStats_t *);
+void WaitressMultiInit (WaitressMulti_t *);
+bool WaitressMultiAdd (WaitressMulti_t *, WaitressHandle_t *,
+		WaitressMultiCb_t, void *);
+bool WaitressMultiAddBuf (WaitressMulti_t *, WaitressHandle_t *, char **,
+		size_t *, WaitressReturn_t *);
+WaitressReturn_t WaitressMultiPerform (WaitressMulti_t *);
 
 #endif /* _WAITRESS_H */
 
@@ -56,6 +56,7 @@ THE SOFTWARE.
 #include <piano.h>
 
 #include "main.h"
+#include "pcm.h"
 #include "terminal.h"
 #include "config.h"
 #include "ui.h"
@@ -92,7 +93,7 @@ static bool BarMainLoginUser (BarApp_t *app) {
 	BarUiMsg (&app->settings, MSG_INFO, "Login... ");
 	ret = BarUiPianoCall (app, PIANO_REQUEST_LOGIN, &reqData, &pRet, &wRet);
 	BarUiStartEventCmd (&app->settings, "userlogin", NULL, NULL, &app->player,
-			NULL, pRet, wRet);
+			&app->rpcTiming, NULL, pRet, wRet);
 	return ret;
 }
 
@@ -182,7 +183,7 @@ static bool BarMainGetStations (BarApp_t *app) {
 	BarUiMsg (&app->settings, MSG_INFO, "Get stations... ");
 	ret = BarUiPianoCall (app, PIANO_REQUEST_GET_STATIONS, NULL, &pRet, &wRet);
 	BarUiStartEventCmd (&app->settings, "usergetstations", NULL, NULL, &app->player,
-			app->ph.stations, pRet, wRet);
+			&app->rpcTiming, &app->ph, pRet, wRet);
 	return ret;
 }
 
@@ -191,7 +192,7 @@ static bool BarMainGetStations (BarApp_t *app) {
 static void BarMainGetInitialStation (BarApp_t *app) {
 	/* try to get autostart station */
 	if (app->settings.autostartStation != NULL) {
-		app->curStation = PianoFindStationById (app->ph.stations,
+		app->curStation = PianoFindStationById (&app->ph,
 				app->settings.autostartStation);
 		if (app->curStation == NULL) {
 			BarUiMsg (&app->settings, MSG_ERR,
@@ -240,75 +241,56 @@ static void BarMainGetPlaylist (BarApp_t *app) {
 		}
 	}
 	BarUiStartEventCmd (&app->settings, "stationfetchplaylist",
-			app->curStation, app->playlist, &app->player, app->ph.stations,
-			pRet, wRet);
+			app->curStation, app->playlist, &app->player, &app->rpcTiming,
+			&app->ph, pRet, wRet);
 }
 
-/*	start new player thread
+/*	hand next song over to the player
  */
-static void BarMainStartPlayback (BarApp_t *app, pthread_t *playerThread) {
+static void BarMainStartPlayback (BarApp_t *app) {
 	BarUiPrintSong (&app->settings, app->playlist, app->curStation->isQuickMix ?
-			PianoFindStationById (app->ph.stations,
+			PianoFindStationById (&app->ph,
 			app->playlist->stationId) : NULL);
 
 	if (app->playlist->audioUrl == NULL) {
 		BarUiMsg (&app->settings, MSG_ERR, "Invalid song url.\n");
 	} else {
-		/* setup player */
-		memset (&app->player, 0, sizeof (app->player));
+		BarPlayerSong_t song;
 
-		WaitressInit (&app->player.waith);
-		WaitressSetUrl (&app->player.waith, app->playlist->audioUrl);
-
-		/* set up global proxy, player is NULLed on songfinish */
-		if (app->settings.proxy != NULL) {
-			WaitressSetProxy (&app->player.waith, app->settings.proxy);
-		}
-
-		app->player.gain = app->playlist->fileGain;
-		app->player.scale = BarPlayerCalcScale (app->player.gain + app->settings.volume);
-		app->player.audioFormat = app->playlist->audioFormat;
-		app->player.settings = &app->settings;
-		app->player.songDuration = app->playlist->length * 1000;
-		pthread_mutex_init (&app->player.pauseMutex, NULL);
-		pthread_cond_init (&app->player.pauseCond, NULL);
-		strcpy(app->player.fly.stationName, app->curStation->name);
+		memset (&song, 0, sizeof (song));
+		song.url = app->playlist->audioUrl;
+		song.audioFormat = app->playlist->audioFormat;
+		song.gain = app->playlist->fileGain;
+		song.duration = app->playlist->length * 1000;
+		BarPrefetchFinish (&app->prefetch, &song);
+		strcpy(song.fly.stationName, app->curStation->name);
 
 		/* Open the audio file. */
-		BarFlyOpen (&app->player.fly, app->playlist, &app->settings);
+		BarFlyOpen (&song.fly, app->playlist, &app->settings);
+
+		/* nothing is playing, the engine starts this song right away */
+		if (!BarPlayerEnqueue (&app->player, &song)) {
+			BarFlyClose (&song.fly, &app->settings);
+			return;
+		}
 
 		/* throw event */
 		BarUiStartEventCmd (&app->settings, "songstart",
-				app->curStation, app->playlist, &app->player, app->ph.stations,
-				PIANO_RET_OK, WAITRESS_RET_OK);
-
-		/* prevent race condition, mode must _not_ be FREED if
-		 * thread has been started */
-		app->player.mode = PLAYER_STARTING;
-		/* start player */
-		pthread_create (playerThread, NULL, BarPlayerThread,
-				&app->player);
+				app->curStation, app->playlist, &app->player, &app->rpcTiming,
+				&app->ph, PIANO_RET_OK, WAITRESS_RET_OK);
 	}
 }
 
 /*	player is done, clean up
  */
-static void BarMainPlayerCleanup (BarApp_t *app, pthread_t *playerThread) {
-	void *threadRet;
-
+static void BarMainPlayerCleanup (BarApp_t *app) {
 	BarUiStartEventCmd (&app->settings, "songfinish", app->curStation,
-			app->playlist, &app->player, app->ph.stations, PIANO_RET_OK,
-			WAITRESS_RET_OK);
-
-	/* FIXME: pthread_join blocks everything if network connection
-	 * is hung up e.g. */
-	pthread_join (*playerThread, &threadRet);
-	pthread_cond_destroy (&app->player.pauseCond);
-	pthread_mutex_destroy (&app->player.pauseMutex);
+			app->playlist, &app->player, &app->rpcTiming, &app->ph,
+			PIANO_RET_OK, WAITRESS_RET_OK);
 
-	if (threadRet == (void *) PLAYER_RET_OK) {
+	if (app->player.ret == PLAYER_RET_OK) {
 		app->playerErrors = 0;
-	} else if (threadRet == (void *) PLAYER_RET_SOFTFAIL) {
+	} else if (app->player.ret == PLAYER_RET_SOFTFAIL) {
 		++app->playerErrors;
 		if (app->playerErrors >= app->settings.maxPlayerErrors) {
 			/* don't continue playback if thread reports too many error */
@@ -321,7 +303,33 @@ static void BarMainPlayerCleanup (BarApp_t *app, pthread_t *playerThread) {
 	/* Close the output file. */
 	BarFlyClose (&app->player.fly, &app->settings);
 
-	memset (&app->player, 0, sizeof (app->player));
+	BarPlayerSongDone (&app->player);
+}
+
+/*	download the beginning of the next song shortly before the current one
+ *	ends
+ */
+static void BarMainPrefetch (BarApp_t *app) {
+	const PianoSong_t *next;
+
+	if (app->settings.prefetchTime == 0 ||
+			app->prefetch.mode != PREFETCH_IDLE ||
+			app->player.mode != PLAYER_RECV_DATA || app->playlist == NULL) {
+		return;
+	}
+
+	next = PianoListNextP (app->playlist);
+	if (next == NULL || next->audioUrl == NULL) {
+		return;
+	}
+
+	if (app->player.songPlayed < app->player.songDuration &&
+			app->player.songDuration - app->player.songPlayed >
+			app->settings.prefetchTime * BAR_PLAYER_MS_TO_S_FACTOR) {
+		return;
+	}
+
+	BarPrefetchStart (&app->prefetch, next->audioUrl, &app->settings);
 }
 
 /*	print song duration
@@ -348,8 +356,6 @@ static void BarMainPrintTime (BarApp_t *app) {
 /*	main loop
  */
 static void BarMainLoop (BarApp_t *app) {
-	pthread_t playerThread;
-
 	if (!BarMainGetLoginCredentials (&app->settings, &app->input)) {
 		return;
 	}
@@ -366,14 +372,14 @@ static void BarMainLoop (BarApp_t *app) {
 
 	BarMainGetInitialStation (app);
 
-	/* little hack, needed to signal: hey! we need a playlist, but don't
-	 * free anything (there is nothing to be freed yet) */
-	memset (&app->player, 0, sizeof (app->player));
+	if (!BarPlayerInit (&app->player, &app->settings)) {
+		return;
+	}
 
 	while (!app->doQuit) {
 		/* song finished playing, clean up things/scrobble song */
 		if (app->player.mode == PLAYER_FINISHED_PLAYBACK) {
-			BarMainPlayerCleanup (app, &playerThread);
+			BarMainPlayerCleanup (app);
 		}
 
 		/* check whether player finished playing and start playing new
@@ -382,8 +388,7 @@ static void BarMainLoop (BarApp_t *app) {
 			/* what's next? */
 			if (app->playlist != NULL) {
 				PianoSong_t *histsong = app->playlist;
-				app->playlist = PianoListNextP (app->playlist);
-				histsong->head.next = NULL;
+				app->playlist = PianoListDeleteP (app->playlist, histsong);
 				BarUiHistoryPrepend (app, histsong);
 			}
 			if (app->playlist == NULL) {
@@ -391,21 +396,23 @@ static void BarMainLoop (BarApp_t *app) {
 			}
 			/* song ready to play */
 			if (app->playlist != NULL) {
-				BarMainStartPlayback (app, &playerThread);
+				BarMainStartPlayback (app);
 			}
 		}
 
 		BarMainHandleUserInput (app);
 
+		BarMainPrefetch (app);
+
 		/* show time */
 		if (app->player.mode < PLAYER_FINISHED_PLAYBACK) {
 			BarMainPrintTime (app);
 		}
 	}
 
-	if (app->player.mode != PLAYER_FREED) {
-		pthread_join (playerThread, NULL);
-	}
+	BarPlayerDestroy (&app->player);
+
+	BarPrefetchFinish (&app->prefetch, NULL);
 }
 
 int main (int argc, char **argv) {
@@ -425,6 +432,7 @@ int main (int argc, char **argv) {
 
 	/* init some things */
 	ao_initialize ();
+	BarPcmInit ();
 	gcry_check_version (NULL);
 	gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
 	gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
@@ -501,6 +509,7 @@ int main (int argc, char **argv) {
 	PianoDestroyPlaylist (app.songHistory);
 	PianoDestroyPlaylist (app.playlist);
 	WaitressFree (&app.waith);
+	free (app.responseBuf);
 	ao_shutdown();
 	gnutls_global_deinit ();
 	BarSettingsDestroy (&app.settings);
@@ -34,7 +34,13 @@ THE SOFTWARE.
 typedef struct {
 	PianoHandle_t ph;
 	WaitressHandle_t waith;
+	/* response buffer reused by all rpc calls, allocated size */
+	char *responseBuf;
+	size_t responseBufSize;
+	/* phases of the last rpc's http request */
+	WaitressTiming_t rpcTiming;
 	struct audioPlayer player;
+	BarPrefetch_t prefetch;
 	BarSettings_t settings;
 	/* first item is current song */
 	PianoSong_t *playlist;
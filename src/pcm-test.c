@@ -0,0 +1,242 @@
+/*
+Copyright (c) 2009-2013
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* test cases and benchmarks for pcm conversion; every implementation this
+ * cpu supports must match the scalar one */
+
+#define _POSIX_C_SOURCE 200112L /* clock_gettime() */
+
+/* we're testing this file */
+#include "pcm.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+/* samples per channel of the fixed buffer, not a multiple of any vector
+ * width, so the scalar tails are exercised too */
+#define TEST_SAMPLES (64*1024+7)
+/* passes over the buffer per benchmark */
+#define BENCH_ROUNDS 200
+
+typedef struct {
+	const char *name;
+	BarPcmGainFunc_t gain;
+	BarPcmFixedFunc_t fixed;
+} impl_t;
+
+/* number of failed tests */
+static unsigned int failed = 0;
+
+/*	report test result
+ *	@param test passed?
+ *	@param test name
+ */
+static void report (bool ok, const char *name) {
+	if (ok) {
+		printf ("OK for %s\n", name);
+	} else {
+		printf ("FAILED test(s) for %s\n", name);
+		++failed;
+	}
+}
+
+/*	microseconds, monotonic
+ */
+static long long int usNow (void) {
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (long long int) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*	deterministic pseudo-random numbers, covering the full range
+ */
+static uint32_t nextRandom (void) {
+	static uint32_t state = 2463534242u;
+
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+/*	implementations usable on this cpu
+ *	@param output, room for four entries
+ *	@return number of entries
+ */
+static size_t availableImpls (impl_t *impls) {
+	size_t n = 0;
+
+	impls[n++] = (impl_t) {"scalar", BarPcmGainScalar, BarPcmFixedScalar};
+
+	#ifdef BAR_PCM_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("sse2")) {
+		impls[n++] = (impl_t) {"sse2", BarPcmGainSse2, BarPcmFixedSse2};
+	} else {
+		printf ("SKIPPED sse2, not supported by this cpu\n");
+	}
+	if (__builtin_cpu_supports ("avx2")) {
+		impls[n++] = (impl_t) {"avx2", BarPcmGainAvx2, BarPcmFixedAvx2};
+	} else {
+		printf ("SKIPPED avx2, not supported by this cpu\n");
+	}
+	#endif
+
+	#ifdef BAR_PCM_NEON
+	impls[n++] = (impl_t) {"neon", BarPcmGainNeon, BarPcmFixedNeon};
+	#endif
+
+	return n;
+}
+
+/*	compare implementation against scalar, with attenuation, unity and
+ *	amplification (clipping)
+ *	@param implementation
+ *	@param 16 bit input
+ *	@param 32 bit left channel
+ *	@param 32 bit right channel
+ */
+static void compareImpl (const impl_t *impl, const int16_t *in,
+		const int32_t *left, const int32_t *right) {
+	static const int16_t scales[] = {0, 1, BAR_PCM_SCALE_ONE/3,
+			BAR_PCM_SCALE_ONE, BAR_PCM_SCALE_ONE*4, INT16_MAX};
+	static const unsigned int shifts[] = {0, 13, 16};
+	const size_t size = 2*TEST_SAMPLES*sizeof (int16_t);
+	int16_t *expect = malloc (size), *got = malloc (size);
+	char name[64];
+	bool ok = true;
+
+	for (size_t i = 0; i < sizeof (scales) / sizeof (*scales); i++) {
+		memcpy (expect, in, size);
+		memcpy (got, in, size);
+		BarPcmGainScalar (expect, 2*TEST_SAMPLES, scales[i]);
+		impl->gain (got, 2*TEST_SAMPLES, scales[i]);
+		ok = ok && memcmp (expect, got, size) == 0;
+	}
+	snprintf (name, sizeof (name), "%s gain", impl->name);
+	report (ok, name);
+
+	ok = true;
+	for (size_t i = 0; i < sizeof (scales) / sizeof (*scales); i++) {
+		for (size_t j = 0; j < sizeof (shifts) / sizeof (*shifts); j++) {
+			BarPcmFixedScalar (expect, left, right, TEST_SAMPLES, shifts[j],
+					scales[i]);
+			impl->fixed (got, left, right, TEST_SAMPLES, shifts[j], scales[i]);
+			ok = ok && memcmp (expect, got, size) == 0;
+		}
+	}
+	snprintf (name, sizeof (name), "%s fixed to short", impl->name);
+	report (ok, name);
+
+	free (expect);
+	free (got);
+}
+
+/*	benchmark: samples per second for both conversions
+ *	@param implementation
+ *	@param 16 bit input
+ *	@param 32 bit left channel
+ *	@param 32 bit right channel
+ */
+static void benchImpl (const impl_t *impl, const int16_t *in,
+		const int32_t *left, const int32_t *right) {
+	const size_t size = 2*TEST_SAMPLES*sizeof (int16_t);
+	int16_t *buf = malloc (size);
+	const double samples = 2.0*TEST_SAMPLES*BENCH_ROUNDS;
+	long long int start, gainElapsed, fixedElapsed;
+
+	memcpy (buf, in, size);
+	start = usNow ();
+	for (unsigned int i = 0; i < BENCH_ROUNDS; i++) {
+		/* unity gain, the buffer stays the same across rounds */
+		impl->gain (buf, 2*TEST_SAMPLES, BAR_PCM_SCALE_ONE);
+	}
+	gainElapsed = usNow () - start;
+
+	start = usNow ();
+	for (unsigned int i = 0; i < BENCH_ROUNDS; i++) {
+		impl->fixed (buf, left, right, TEST_SAMPLES, 13, BAR_PCM_SCALE_ONE/2);
+	}
+	fixedElapsed = usNow () - start;
+
+	printf ("  %-6s gain %8.1f Msamples/s, fixed to short %8.1f Msamples/s\n",
+			impl->name,
+			gainElapsed > 0 ? samples / gainElapsed : 0.0,
+			fixedElapsed > 0 ? samples / fixedElapsed : 0.0);
+
+	free (buf);
+}
+
+int main () {
+	int16_t *in = malloc (2*TEST_SAMPLES*sizeof (*in));
+	int32_t *left = malloc (TEST_SAMPLES*sizeof (*left)),
+			*right = malloc (TEST_SAMPLES*sizeof (*right));
+	impl_t impls[4];
+	size_t implCount;
+
+	for (size_t i = 0; i < 2*TEST_SAMPLES; i++) {
+		in[i] = nextRandom ();
+	}
+	for (size_t i = 0; i < TEST_SAMPLES; i++) {
+		/* mostly in range after shifting, some clipping */
+		left[i] = (int32_t) nextRandom () >> 2;
+		right[i] = (int32_t) nextRandom () >> 2;
+	}
+	/* extremes */
+	in[0] = INT16_MIN;
+	in[1] = INT16_MAX;
+	left[0] = INT32_MIN;
+	right[0] = INT32_MAX;
+
+	implCount = availableImpls (impls);
+	for (size_t i = 1; i < implCount; i++) {
+		compareImpl (&impls[i], in, left, right);
+	}
+
+	BarPcmInit ();
+	report (implCount == 1 || strcmp (BarPcmImplName (), "scalar") != 0,
+			"runtime selection");
+	printf ("  selected %s\n", BarPcmImplName ());
+
+	printf ("benchmark, %d samples per channel, %d rounds\n", TEST_SAMPLES,
+			BENCH_ROUNDS);
+	for (size_t i = 0; i < implCount; i++) {
+		benchImpl (&impls[i], in, left, right);
+	}
+
+	free (in);
+	free (left);
+	free (right);
+
+	if (failed > 0) {
+		printf ("%u test(s) FAILED\n", failed);
+		return EXIT_FAILURE;
+	}
+
+	/* done */
+	return EXIT_SUCCESS;
+}
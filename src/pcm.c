@@ -0,0 +1,295 @@
+/*
+Copyright (c) 2008-2013
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* pcm sample conversion, replaygain; vectorized where possible */
+
+#include <assert.h>
+
+#include "pcm.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BAR_PCM_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BAR_PCM_NEON
+#include <arm_neon.h>
+#endif
+
+typedef void (*BarPcmGainFunc_t) (int16_t *, size_t, int16_t);
+typedef void (*BarPcmFixedFunc_t) (int16_t *, const int32_t *,
+		const int32_t *, size_t, unsigned int, int16_t);
+
+/*	saturate to int16 range
+ *	@param value
+ *	@return clipped value
+ */
+static inline int16_t BarPcmSaturate (const int32_t value) {
+	if (value > INT16_MAX) {
+		return INT16_MAX;
+	} else if (value < INT16_MIN) {
+		return INT16_MIN;
+	}
+	return value;
+}
+
+/*	apply replaygain to a single sample
+ *	@param sample
+ *	@param scale, see BAR_PCM_SCALE_SHIFT
+ *	@return scaled sample
+ */
+static inline int16_t BarPcmScale (const int16_t value, const int16_t scale) {
+	return BarPcmSaturate (((int32_t) value * scale) >> BAR_PCM_SCALE_SHIFT);
+}
+
+/* scalar fallback */
+
+static void BarPcmGainScalar (int16_t *samples, size_t n,
+		const int16_t scale) {
+	for (size_t i = 0; i < n; i++) {
+		samples[i] = BarPcmScale (samples[i], scale);
+	}
+}
+
+static void BarPcmFixedScalar (int16_t *out, const int32_t *left,
+		const int32_t *right, size_t n, const unsigned int shift,
+		const int16_t scale) {
+	for (size_t i = 0; i < n; i++) {
+		*(out++) = BarPcmScale (BarPcmSaturate (left[i] >> shift), scale);
+		*(out++) = BarPcmScale (BarPcmSaturate (right[i] >> shift), scale);
+	}
+}
+
+#ifdef BAR_PCM_X86
+
+/* sse2; the compiler knows it's always available on x86_64 */
+
+__attribute__ ((target ("sse2")))
+static inline __m128i BarPcmScaleSse2 (const __m128i v, const __m128i scale) {
+	/* full 32 bit products, then shift and pack with saturation */
+	const __m128i lo = _mm_mullo_epi16 (v, scale);
+	const __m128i hi = _mm_mulhi_epi16 (v, scale);
+	return _mm_packs_epi32 (
+			_mm_srai_epi32 (_mm_unpacklo_epi16 (lo, hi), BAR_PCM_SCALE_SHIFT),
+			_mm_srai_epi32 (_mm_unpackhi_epi16 (lo, hi), BAR_PCM_SCALE_SHIFT));
+}
+
+__attribute__ ((target ("sse2")))
+static void BarPcmGainSse2 (int16_t *samples, size_t n, const int16_t scale) {
+	const __m128i s = _mm_set1_epi16 (scale);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i *p = (__m128i *) (samples + i);
+		_mm_storeu_si128 (p, BarPcmScaleSse2 (_mm_loadu_si128 (p), s));
+	}
+	BarPcmGainScalar (samples + i, n - i, scale);
+}
+
+__attribute__ ((target ("sse2")))
+static void BarPcmFixedSse2 (int16_t *out, const int32_t *left,
+		const int32_t *right, size_t n, const unsigned int shift,
+		const int16_t scale) {
+	const __m128i s = _mm_set1_epi16 (scale);
+	const __m128i sh = _mm_cvtsi32_si128 (shift);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		const __m128i l = BarPcmScaleSse2 (_mm_packs_epi32 (
+				_mm_sra_epi32 (_mm_loadu_si128 ((const __m128i *) (left + i)), sh),
+				_mm_sra_epi32 (_mm_loadu_si128 ((const __m128i *) (left + i + 4)), sh)),
+				s);
+		const __m128i r = BarPcmScaleSse2 (_mm_packs_epi32 (
+				_mm_sra_epi32 (_mm_loadu_si128 ((const __m128i *) (right + i)), sh),
+				_mm_sra_epi32 (_mm_loadu_si128 ((const __m128i *) (right + i + 4)), sh)),
+				s);
+		_mm_storeu_si128 ((__m128i *) (out + 2*i), _mm_unpacklo_epi16 (l, r));
+		_mm_storeu_si128 ((__m128i *) (out + 2*i + 8), _mm_unpackhi_epi16 (l, r));
+	}
+	BarPcmFixedScalar (out + 2*i, left + i, right + i, n - i, shift, scale);
+}
+
+/* avx2, selected at runtime */
+
+__attribute__ ((target ("avx2")))
+static inline __m256i BarPcmScaleAvx2 (const __m256i v, const __m256i scale) {
+	/* unpack/pack work per 128 bit lane, so sample order is preserved */
+	const __m256i lo = _mm256_mullo_epi16 (v, scale);
+	const __m256i hi = _mm256_mulhi_epi16 (v, scale);
+	return _mm256_packs_epi32 (
+			_mm256_srai_epi32 (_mm256_unpacklo_epi16 (lo, hi),
+			BAR_PCM_SCALE_SHIFT),
+			_mm256_srai_epi32 (_mm256_unpackhi_epi16 (lo, hi),
+			BAR_PCM_SCALE_SHIFT));
+}
+
+__attribute__ ((target ("avx2")))
+static void BarPcmGainAvx2 (int16_t *samples, size_t n, const int16_t scale) {
+	const __m256i s = _mm256_set1_epi16 (scale);
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m256i *p = (__m256i *) (samples + i);
+		_mm256_storeu_si256 (p, BarPcmScaleAvx2 (_mm256_loadu_si256 (p), s));
+	}
+	BarPcmGainScalar (samples + i, n - i, scale);
+}
+
+__attribute__ ((target ("avx2")))
+static void BarPcmFixedAvx2 (int16_t *out, const int32_t *left,
+		const int32_t *right, size_t n, const unsigned int shift,
+		const int16_t scale) {
+	const __m256i s = _mm256_set1_epi16 (scale);
+	const __m128i sh = _mm_cvtsi32_si128 (shift);
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		/* packing interleaves 128 bit lanes of both inputs: frames 0-3, 8-11
+		 * end up in the lower, 4-7, 12-15 in the upper lane; unpacking below
+		 * restores the order */
+		const __m256i l = BarPcmScaleAvx2 (_mm256_packs_epi32 (
+				_mm256_sra_epi32 (_mm256_loadu_si256 ((const __m256i *) (left + i)), sh),
+				_mm256_sra_epi32 (_mm256_loadu_si256 ((const __m256i *) (left + i + 8)), sh)),
+				s);
+		const __m256i r = BarPcmScaleAvx2 (_mm256_packs_epi32 (
+				_mm256_sra_epi32 (_mm256_loadu_si256 ((const __m256i *) (right + i)), sh),
+				_mm256_sra_epi32 (_mm256_loadu_si256 ((const __m256i *) (right + i + 8)), sh)),
+				s);
+		_mm256_storeu_si256 ((__m256i *) (out + 2*i),
+				_mm256_unpacklo_epi16 (l, r));
+		_mm256_storeu_si256 ((__m256i *) (out + 2*i + 16),
+				_mm256_unpackhi_epi16 (l, r));
+	}
+	BarPcmFixedScalar (out + 2*i, left + i, right + i, n - i, shift, scale);
+}
+
+#endif /* BAR_PCM_X86 */
+
+#ifdef BAR_PCM_NEON
+
+static inline int16x8_t BarPcmScaleNeon (const int16x8_t v,
+		const int16x4_t scale) {
+	/* widening multiply, narrowing shift saturates */
+	return vcombine_s16 (
+			vqshrn_n_s32 (vmull_s16 (vget_low_s16 (v), scale),
+			BAR_PCM_SCALE_SHIFT),
+			vqshrn_n_s32 (vmull_s16 (vget_high_s16 (v), scale),
+			BAR_PCM_SCALE_SHIFT));
+}
+
+static void BarPcmGainNeon (int16_t *samples, size_t n, const int16_t scale) {
+	const int16x4_t s = vdup_n_s16 (scale);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		vst1q_s16 (samples + i, BarPcmScaleNeon (vld1q_s16 (samples + i), s));
+	}
+	BarPcmGainScalar (samples + i, n - i, scale);
+}
+
+static void BarPcmFixedNeon (int16_t *out, const int32_t *left,
+		const int32_t *right, size_t n, const unsigned int shift,
+		const int16_t scale) {
+	const int16x4_t s = vdup_n_s16 (scale);
+	/* negative shift count shifts right */
+	const int32x4_t sh = vdupq_n_s32 (-(int32_t) shift);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		int16x8x2_t lr;
+
+		lr.val[0] = BarPcmScaleNeon (vcombine_s16 (
+				vqmovn_s32 (vshlq_s32 (vld1q_s32 (left + i), sh)),
+				vqmovn_s32 (vshlq_s32 (vld1q_s32 (left + i + 4), sh))), s);
+		lr.val[1] = BarPcmScaleNeon (vcombine_s16 (
+				vqmovn_s32 (vshlq_s32 (vld1q_s32 (right + i), sh)),
+				vqmovn_s32 (vshlq_s32 (vld1q_s32 (right + i + 4), sh))), s);
+		/* interleaving store */
+		vst2q_s16 (out + 2*i, lr);
+	}
+	BarPcmFixedScalar (out + 2*i, left + i, right + i, n - i, shift, scale);
+}
+
+#endif /* BAR_PCM_NEON */
+
+static BarPcmGainFunc_t gainImpl = BarPcmGainScalar;
+static BarPcmFixedFunc_t fixedImpl = BarPcmFixedScalar;
+static const char *implName = "scalar";
+
+/*	pick fastest implementation supported by this cpu, call once before
+ *	starting any threads
+ */
+void BarPcmInit (void) {
+	#ifdef BAR_PCM_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2")) {
+		gainImpl = BarPcmGainAvx2;
+		fixedImpl = BarPcmFixedAvx2;
+		implName = "avx2";
+	} else if (__builtin_cpu_supports ("sse2")) {
+		gainImpl = BarPcmGainSse2;
+		fixedImpl = BarPcmFixedSse2;
+		implName = "sse2";
+	}
+	#endif
+
+	#ifdef BAR_PCM_NEON
+	gainImpl = BarPcmGainNeon;
+	fixedImpl = BarPcmFixedNeon;
+	implName = "neon";
+	#endif
+}
+
+/*	name of the implementation in use
+ *	@return name
+ */
+const char *BarPcmImplName (void) {
+	return implName;
+}
+
+/*	apply replaygain to 16 bit samples in place, with saturation
+ *	@param samples
+ *	@param number of samples
+ *	@param scale, see BarPlayerCalcScale
+ */
+void BarPcmGain (int16_t *samples, size_t n, unsigned int scale) {
+	assert (scale <= INT16_MAX);
+	gainImpl (samples, n, scale);
+}
+
+/*	convert two channels of fixed point samples to interleaved 16 bit
+ *	samples and apply replaygain, both with saturation
+ *	@param output, 2*n samples
+ *	@param left channel
+ *	@param right channel
+ *	@param number of samples per channel
+ *	@param number of fractional bits of the input, minus 15
+ *	@param scale, see BarPlayerCalcScale
+ */
+void BarPcmFixedToShort (int16_t *out, const int32_t *left,
+		const int32_t *right, size_t n, unsigned int shift,
+		unsigned int scale) {
+	assert (scale <= INT16_MAX);
+	fixedImpl (out, left, right, n, shift, scale);
+}
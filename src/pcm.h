@@ -0,0 +1,41 @@
+/*
+Copyright (c) 2008-2013
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef _PCM_H
+#define _PCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* replaygain scale is a fixed point number with this many fractional bits;
+ * it must not exceed INT16_MAX (~ +30 dB) */
+#define BAR_PCM_SCALE_SHIFT 10
+#define BAR_PCM_SCALE_ONE (1 << BAR_PCM_SCALE_SHIFT)
+
+void BarPcmInit (void);
+const char *BarPcmImplName (void);
+void BarPcmGain (int16_t *, size_t, unsigned int);
+void BarPcmFixedToShort (int16_t *, const int32_t *, const int32_t *, size_t,
+		unsigned int, unsigned int);
+
+#endif /* _PCM_H */
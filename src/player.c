@@ -23,30 +23,183 @@ THE SOFTWARE.
 
 /* receive/play audio stream */
 
+#ifndef __FreeBSD__
+#define _BSD_SOURCE /* strdup() */
+#define _DARWIN_C_SOURCE /* strdup() on OS X */
+#endif
+
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <math.h>
 #include <stdint.h>
 #include <limits.h>
 #include <assert.h>
-#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "player.h"
 #include "config.h"
+#include "pcm.h"
 #include "ui.h"
 #include "ui_types.h"
 
-#define bigToHostEndian32(x) ntohl(x)
+/*	open audio device for player's samplerate and channels; the device
+ *	is kept open if the format did not change
+ *	@param player structure
+ *	@return false on error
+ */
+static bool BarPlayerAoOpen (struct audioPlayer *player) {
+	ao_sample_format format;
+
+	memset (&format, 0, sizeof (format));
+	format.bits = 16;
+	format.channels = player->channels;
+	format.rate = player->samplerate;
+	format.byte_format = AO_FMT_NATIVE;
+
+	if (player->audioOutDevice != NULL) {
+		if (player->aoFormat.bits == format.bits &&
+				player->aoFormat.channels == format.channels &&
+				player->aoFormat.rate == format.rate &&
+				player->aoFormat.byte_format == format.byte_format) {
+			return true;
+		}
+		ao_close (player->audioOutDevice);
+		player->audioOutDevice = NULL;
+	}
+
+	if (player->aoDriver == -1) {
+		player->aoDriver = ao_default_driver_id ();
+	}
+	if ((player->audioOutDevice = ao_open_live (player->aoDriver, &format,
+			NULL)) == NULL) {
+		/* we're not interested in the errno */
+		player->aoError = 1;
+		BarUiMsg (player->settings, MSG_ERR, "Cannot open audio device\n");
+		return false;
+	}
+	player->aoFormat = format;
+
+	return true;
+}
+
+/*	close audio device
+ *	@param player structure
+ */
+static void BarPlayerAoClose (struct audioPlayer *player) {
+	if (player->audioOutDevice != NULL) {
+		ao_close (player->audioOutDevice);
+		player->audioOutDevice = NULL;
+	}
+}
+
+/*	play staged audio
+ *	@param player structure
+ */
+static void BarPlayerPcmFlush (struct audioPlayer *player) {
+	if (player->pcmFilled > 0) {
+		/* ao_play needs bytes: 1 sample = 16 bits = 2 bytes */
+		ao_play (player->audioOutDevice, (char *) player->pcm,
+				player->pcmFilled * 2);
+		player->pcmFilled = 0;
+	}
+	player->songPlayed += player->pcmTime;
+	player->pcmTime = 0;
+}
 
-/* pandora uses float values with 2 digits precision. Scale them by 100 to get
- * a "nice" integer */
-#define RG_SCALE_FACTOR 100
+/*	throw away staged audio, e.g. when skipping
+ *	@param player structure
+ */
+static void BarPlayerPcmDrop (struct audioPlayer *player) {
+	player->pcmFilled = 0;
+	player->pcmTime = 0;
+}
+
+/*	stage decoded audio, it is played once audio_period milliseconds are
+ *	collected
+ *	@param player structure
+ *	@param interleaved samples
+ *	@param number of samples (all channels)
+ *	@param their duration in milliseconds
+ *	@return false on error
+ */
+static bool BarPlayerPcmWrite (struct audioPlayer *player,
+		const int16_t *samples, const size_t n, const unsigned long int ms) {
+	const size_t period = (unsigned long long int) player->aoFormat.rate *
+			(unsigned long long int) player->aoFormat.channels *
+			(unsigned long long int) player->settings->audioPeriod /
+			BAR_PLAYER_MS_TO_S_FACTOR;
+
+	if (player->pcmSize != period) {
+		/* format or setting changed */
+		BarPlayerPcmFlush (player);
+		free (player->pcm);
+		player->pcm = NULL;
+		player->pcmSize = 0;
+		if (period > 0) {
+			if ((player->pcm = malloc (period * sizeof (*player->pcm))) ==
+					NULL) {
+				BarUiMsg (player->settings, MSG_ERR, "Out of memory.\n");
+				return false;
+			}
+			player->pcmSize = period;
+		}
+	}
+
+	if (player->pcmFilled + n > player->pcmSize) {
+		BarPlayerPcmFlush (player);
+	}
+
+	if (n >= player->pcmSize) {
+		/* larger than a period, no need to stage it */
+		ao_play (player->audioOutDevice, (char *) samples, n * 2);
+		player->songPlayed += ms;
+	} else {
+		memcpy (player->pcm + player->pcmFilled, samples,
+				n * sizeof (*samples));
+		player->pcmFilled += n;
+		player->pcmTime += ms;
+		if (player->pcmFilled == player->pcmSize) {
+			BarPlayerPcmFlush (player);
+		}
+	}
+
+	return true;
+}
+
+/*	wait on pauseCond (pauseMutex must be locked); closes the audio device
+ *	if nothing happened for audio_idle_timeout seconds
+ *	@param player structure
+ *	@param deadline, tv_sec must be 0 on the first call of a wait loop
+ */
+static void BarPlayerIdleWait (struct audioPlayer *player,
+		struct timespec *deadline) {
+	const unsigned int timeout = player->settings->audioIdleTimeout;
+
+	if (player->audioOutDevice == NULL || timeout == 0) {
+		pthread_cond_wait (&player->pauseCond, &player->pauseMutex);
+		return;
+	}
+
+	if (deadline->tv_sec == 0) {
+		clock_gettime (CLOCK_REALTIME, deadline);
+		deadline->tv_sec += timeout;
+	}
+	if (pthread_cond_timedwait (&player->pauseCond, &player->pauseMutex,
+			deadline) == ETIMEDOUT) {
+		BarPlayerAoClose (player);
+	}
+}
 
 /*	wait until the pause flag is cleared
  *	@param player structure
  *	@return true if the player should quit
  */
 static bool BarPlayerCheckPauseQuit (struct audioPlayer *player) {
+	struct timespec deadline = {0, 0};
 	bool quit = false;
 
 	pthread_mutex_lock (&player->pauseMutex);
@@ -58,14 +211,79 @@ static bool BarPlayerCheckPauseQuit (struct audioPlayer *player) {
 		if (!player->doPause) {
 			break;
 		}
-		pthread_cond_wait(&player->pauseCond,
-				  &player->pauseMutex);
+		if (player->pcmFilled > 0) {
+			/* play what is staged before going to sleep */
+			pthread_mutex_unlock (&player->pauseMutex);
+			BarPlayerPcmFlush (player);
+			pthread_mutex_lock (&player->pauseMutex);
+			continue;
+		}
+		BarPlayerIdleWait (player, &deadline);
 	}
 	pthread_mutex_unlock (&player->pauseMutex);
 
+	if (quit) {
+		/* skipped, stop right now */
+		BarPlayerPcmDrop (player);
+	}
+
+	/* device was closed while we were paused */
+	if (!quit && player->audioOutDevice == NULL &&
+			player->mode >= PLAYER_AUDIO_INITIALIZED) {
+		quit = !BarPlayerAoOpen (player);
+	}
+
 	return quit;
 }
 
+/*	create pipe used to abort waitress requests, see WaitressHandle_t's
+ *	cancelFd
+ *	@param pipe fds, set to -1 on error
+ *	@return false on error
+ */
+static bool BarPlayerCancelOpen (int fds[2]) {
+	if (pipe (fds) == -1) {
+		fds[0] = fds[1] = -1;
+		return false;
+	}
+	fcntl (fds[0], F_SETFL, O_NONBLOCK);
+	fcntl (fds[1], F_SETFL, O_NONBLOCK);
+	return true;
+}
+
+/*	abort request, can be called from any thread
+ *	@param pipe fds
+ */
+static void BarPlayerCancel (const int fds[2]) {
+	if (fds[1] != -1) {
+		/* if the pipe is full a request is cancelled already */
+		const ssize_t ret = write (fds[1], "", 1);
+		(void) ret;
+	}
+}
+
+/*	take back BarPlayerCancel
+ *	@param pipe fds
+ */
+static void BarPlayerCancelReset (const int fds[2]) {
+	char buf[16];
+
+	if (fds[0] != -1) {
+		while (read (fds[0], buf, sizeof (buf)) > 0);
+	}
+}
+
+/*	close cancel pipe
+ *	@param pipe fds
+ */
+static void BarPlayerCancelClose (int fds[2]) {
+	if (fds[0] != -1) {
+		close (fds[0]);
+		close (fds[1]);
+		fds[0] = fds[1] = -1;
+	}
+}
+
 /*	compute replaygain scale factor
  *	algo taken from here: http://www.dsprelated.com/showmessage/29246/1.php
  *	mpd does the same
@@ -73,102 +291,637 @@ static bool BarPlayerCheckPauseQuit (struct audioPlayer *player) {
  *	@return this * yourvalue = newgain value
  */
 unsigned int BarPlayerCalcScale (const float applyGain) {
-	return pow (10.0, applyGain / 20.0) * RG_SCALE_FACTOR;
-}
-
-/*	apply replaygain to signed short value
- *	@param value
- *	@param replaygain scale (calculated by computeReplayGainScale)
- *	@return scaled value
- */
-static inline signed short int applyReplayGain (const signed short int value,
-		const unsigned int scale) {
-	int tmpReplayBuf = value * (signed int) scale;
-	/* clipping */
-	if (tmpReplayBuf > SHRT_MAX*RG_SCALE_FACTOR) {
-		return SHRT_MAX;
-	} else if (tmpReplayBuf < SHRT_MIN*RG_SCALE_FACTOR) {
-		return SHRT_MIN;
-	} else {
-		return tmpReplayBuf / RG_SCALE_FACTOR;
+	const double scale = pow (10.0, applyGain / 20.0) * BAR_PCM_SCALE_ONE;
+	/* BarPcm* need the scale to fit into a signed 16 bit integer */
+	return scale > INT16_MAX ? INT16_MAX : scale;
+}
+
+/*	number of unread bytes in player's ring buffer; safe to call from both
+ *	the receiver and the decoder thread
+ *	@param player structure
+ *	@return byte count
+ */
+static inline size_t BarPlayerBufferAvail (const struct audioPlayer *player) {
+	return __atomic_load_n (&player->bufferFilled, __ATOMIC_ACQUIRE) -
+			__atomic_load_n (&player->bufferRead, __ATOMIC_ACQUIRE);
+}
+
+/*	wake up the other thread if it is sleeping on pauseCond
+ *	@param player structure
+ *	@param the other thread's waiting flag
+ */
+static void BarPlayerWake (struct audioPlayer *player, bool *waiting) {
+	/* pairs with the fence in BarPlayerBufferWait*: either the sleeper sees
+	 * our update or we see its flag */
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (__atomic_load_n (waiting, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock (&player->pauseMutex);
+		pthread_cond_broadcast (&player->pauseCond);
+		pthread_mutex_unlock (&player->pauseMutex);
 	}
 }
 
-/*	Refill player's buffer with dataSize of data
+/*	wait (receiver thread) until size bytes are free in the ring buffer
+ *	@param player structure
+ *	@param bytes
+ *	@return false if the decoder is gone or the player should quit
+ */
+static bool BarPlayerBufferWaitFree (struct audioPlayer *player,
+		const size_t size) {
+	bool ret = true;
+
+	if (player->bufferSize - BarPlayerBufferAvail (player) >= size) {
+		return true;
+	}
+
+	pthread_mutex_lock (&player->pauseMutex);
+	__atomic_store_n (&player->recvWaiting, true, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	while (player->bufferSize - BarPlayerBufferAvail (player) < size) {
+		if (player->doQuit ||
+				__atomic_load_n (&player->decodeDone, __ATOMIC_ACQUIRE)) {
+			ret = false;
+			break;
+		}
+		pthread_cond_wait (&player->pauseCond, &player->pauseMutex);
+	}
+	__atomic_store_n (&player->recvWaiting, false, __ATOMIC_RELAXED);
+	pthread_mutex_unlock (&player->pauseMutex);
+
+	return ret;
+}
+
+/*	wait (decoder thread) until new data beyond stream offset filled arrived
+ *	and at least need bytes are unread, or the receiver is done
+ *	@param player structure
+ *	@param last bufferFilled seen by the decoder
+ *	@param minimum number of unread bytes
+ *	@return false if the player should quit
+ */
+static bool BarPlayerBufferWaitData (struct audioPlayer *player,
+		const size_t filled, const size_t need) {
+	bool ret = true;
+
+	pthread_mutex_lock (&player->pauseMutex);
+	__atomic_store_n (&player->decodeWaiting, true, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	while (true) {
+		if (player->doQuit) {
+			ret = false;
+			break;
+		}
+		if (__atomic_load_n (&player->recvDone, __ATOMIC_ACQUIRE) ||
+				(__atomic_load_n (&player->bufferFilled, __ATOMIC_ACQUIRE) >
+				filled && BarPlayerBufferAvail (player) >= need)) {
+			break;
+		}
+		pthread_cond_wait (&player->pauseCond, &player->pauseMutex);
+	}
+	__atomic_store_n (&player->decodeWaiting, false, __ATOMIC_RELAXED);
+	pthread_mutex_unlock (&player->pauseMutex);
+
+	return ret;
+}
+
+/*	copy data into ring buffer at absolute stream offset pos, wrapping around
+ *	the end if necessary
+ *	@param ring buffer
+ *	@param ring buffer size (without guard)
+ *	@param absolute stream offset
+ *	@param data
+ *	@param data size, must not exceed ring buffer size
+ */
+static void BarPlayerBufferCopyIn (unsigned char *buffer, const size_t size,
+		const size_t pos, const unsigned char *data, const size_t dataSize) {
+	const size_t off = pos % size;
+	const size_t first = (size - off < dataSize) ? size - off : dataSize;
+
+	assert (dataSize <= size);
+
+	memcpy (buffer + off, data, first);
+	memcpy (buffer, data + first, dataSize - first);
+}
+
+/*	Append dataSize bytes of data to player's ring buffer (receiver thread),
+ *	blocks while the buffer is full
  *	@param player structure
  *	@param new data
  *	@param data size
- *	@return 1 on success, 0 when buffer overflow occured
+ *	@return 1 on success, 0 if the decoder is gone
  */
 static inline int BarPlayerBufferFill (struct audioPlayer *player,
 		const char *data, const size_t dataSize) {
-	/* fill buffer */
-	if (player->bufferFilled + dataSize > BAR_PLAYER_BUFSIZE) {
-		BarUiMsg (player->settings, MSG_ERR, "Buffer overflow!\n");
-		return 0;
-	}
-
 	/* Write the stream to the output file. */
 	if (BarFlyWrite(&player->fly, data, dataSize) != 0) {
 		BarUiMsg (player->settings, MSG_ERR, "Error writting audio file.\n");
 	}
 
-	memcpy (player->buffer+player->bufferFilled, data, dataSize);
-	player->bufferFilled += dataSize;
-	player->bufferRead = 0;
+	if (!BarPlayerBufferWaitFree (player, dataSize)) {
+		return 0;
+	}
+
+	BarPlayerBufferCopyIn (player->buffer, player->bufferSize,
+			player->bufferFilled, (const unsigned char *) data, dataSize);
+	__atomic_store_n (&player->bufferFilled, player->bufferFilled + dataSize,
+			__ATOMIC_RELEASE);
 	player->bytesReceived += dataSize;
+	BarPlayerWake (player, &player->decodeWaiting);
 	return 1;
 }
 
-/*	move data beginning from read pointer to buffer beginning and
- *	overwrite data already read from buffer
+/*	get contiguous view of unread data (decoder thread); if it wraps around
+ *	the ring buffer's end, up to BAR_PLAYER_BUFGUARD bytes from its
+ *	beginning are mirrored into the guard area
+ *	@param player structure
+ *	@param try to make at least this many bytes contiguous
+ *	@param returns number of contiguous bytes
+ *	@return pointer to first unread byte
+ */
+static unsigned char *BarPlayerBufferRead (struct audioPlayer *player,
+		const size_t want, size_t *retLen) {
+	const size_t avail = BarPlayerBufferAvail (player);
+	const size_t off = player->bufferRead % player->bufferSize;
+	size_t len = player->bufferSize - off;
+
+	if (len >= avail) {
+		len = avail;
+	} else if (len < want) {
+		/* wrap-around; the receiver does not touch unread data, so this is
+		 * safe without locking */
+		size_t mirror = avail - len;
+		if (mirror > BAR_PLAYER_BUFGUARD) {
+			mirror = BAR_PLAYER_BUFGUARD;
+		}
+		memcpy (player->buffer + player->bufferSize, player->buffer, mirror);
+		len += mirror;
+	}
+
+	*retLen = len;
+	return player->buffer + off;
+}
+
+/*	get pointer to exactly len contiguous unread bytes (decoder thread)
  *	@param player structure
- *	@return nothing at all
+ *	@param number of bytes, must not be larger than BAR_PLAYER_BUFGUARD
+ *	@return pointer or NULL if not enough data is available yet
  */
-static inline void BarPlayerBufferMove (struct audioPlayer *player) {
-	/* move remaining bytes to buffer beginning */
-	memmove (player->buffer, player->buffer + player->bufferRead,
-			(player->bufferFilled - player->bufferRead));
-	player->bufferFilled -= player->bufferRead;
+static inline unsigned char *BarPlayerBufferPeek (struct audioPlayer *player,
+		const size_t len) {
+	size_t contiguous;
+	unsigned char *p;
+
+	assert (len <= BAR_PLAYER_BUFGUARD);
+
+	if (BarPlayerBufferAvail (player) < len) {
+		return NULL;
+	}
+	p = BarPlayerBufferRead (player, len, &contiguous);
+	assert (contiguous >= len);
+	return p;
+}
+
+/*	mark bytes as read (decoder thread)
+ *	@param player structure
+ *	@param number of bytes
+ */
+static inline void BarPlayerBufferConsume (struct audioPlayer *player,
+		const size_t len) {
+	assert (len <= BarPlayerBufferAvail (player));
+	__atomic_store_n (&player->bufferRead, player->bufferRead + len,
+			__ATOMIC_RELEASE);
+	BarPlayerWake (player, &player->recvWaiting);
 }
 
 #ifdef ENABLE_FAAD
 
-/*	play aac stream
- *	@param streamed data
- *	@param received bytes
- *	@param extra data (player data)
- *	@return received bytes or less on error
+/*	read big endian integers
  */
-static WaitressCbReturn_t BarPlayerAACCb (void *ptr, size_t size,
-		void *stream) {
-	const char *data = ptr;
-	struct audioPlayer *player = stream;
+static inline uint32_t BarPlayerMp4Get32 (const unsigned char *p) {
+	return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+			(uint32_t) p[2] << 8 | (uint32_t) p[3];
+}
 
-	if (BarPlayerCheckPauseQuit (player) ||
-			!BarPlayerBufferFill (player, data, size)) {
-		return WAITRESS_CB_RET_ERR;
+static inline uint64_t BarPlayerMp4Get64 (const unsigned char *p) {
+	return (uint64_t) BarPlayerMp4Get32 (p) << 32 | BarPlayerMp4Get32 (p+4);
+}
+
+/*	read mpeg-4 descriptor header (ISO 14496-1, 8.3.3)
+ *	@param descriptor buffer
+ *	@param buffer size
+ *	@param current position, advanced to the descriptor's payload
+ *	@param expected tag
+ *	@return payload length or -1 if the tag does not match
+ */
+static ssize_t BarPlayerMp4Descriptor (const unsigned char *p,
+		const size_t len, size_t *pos, const unsigned char tag) {
+	size_t i = *pos, dlen = 0;
+	unsigned int n;
+
+	if (i >= len || p[i++] != tag) {
+		return -1;
+	}
+	/* up to four bytes, seven bits each */
+	for (n = 0; n < 4 && i < len; n++) {
+		dlen = dlen << 7 | (p[i] & 0x7f);
+		if (!(p[i++] & 0x80)) {
+			break;
+		}
+	}
+	if (dlen > len - i) {
+		return -1;
+	}
+	*pos = i;
+	return dlen;
+}
+
+/*	set up decoder and audio device from esds box
+ *	@param player structure
+ *	@param box payload
+ *	@param payload size
+ *	@return false on error
+ */
+static bool BarPlayerMp4Esds (struct audioPlayer *player,
+		const unsigned char *p, const size_t len) {
+	/* skip version and flags */
+	size_t pos = 4;
+	ssize_t dlen;
+	char err;
+
+	/* ES_Descriptor */
+	if (BarPlayerMp4Descriptor (p, len, &pos, 0x03) < 3) {
+		goto invalid;
+	} else {
+		const unsigned char flags = p[pos+2];
+
+		/* ES_ID, flags, optional fields */
+		pos += 3;
+		if (flags & 0x80) {
+			pos += 2;
+		}
+		if ((flags & 0x40) && pos < len) {
+			pos += 1 + p[pos];
+		}
+		if (flags & 0x20) {
+			pos += 2;
+		}
+	}
+	/* DecoderConfigDescriptor */
+	if (BarPlayerMp4Descriptor (p, len, &pos, 0x04) < 13) {
+		goto invalid;
+	}
+	pos += 13;
+	/* DecoderSpecificInfo, aac's AudioSpecificConfig */
+	if ((dlen = BarPlayerMp4Descriptor (p, len, &pos, 0x05)) < 2) {
+		goto invalid;
+	}
+
+	err = NeAACDecInit2 (player->aacHandle, (unsigned char *) p + pos,
+			dlen, &player->samplerate, &player->channels);
+	if (err != 0) {
+		BarUiMsg (player->settings, MSG_ERR,
+				"Error while initializing audio decoder (%i)\n", err);
+		return false;
+	}
+	if (!BarPlayerAoOpen (player)) {
+		return false;
+	}
+	player->mode = PLAYER_AUDIO_INITIALIZED;
+	return true;
+
+invalid:
+	BarUiMsg (player->settings, MSG_ERR, "Invalid esds box.\n");
+	return false;
+}
+
+/*	read entries of sample table box as far as they are available
+ *	@param player structure
+ *	@return false on error
+ */
+static bool BarPlayerMp4Table (struct audioPlayer *player) {
+	struct audioPlayerMp4 * const mp4 = &player->mp4;
+	const size_t entrySize = (mp4->table == BAR_PLAYER_MP4_STTS ||
+			mp4->table == BAR_PLAYER_MP4_CO64) ? 8 : 4;
+	size_t n, i;
+	unsigned char *p;
+
+	/* as many entries as available at once */
+	n = BarPlayerBufferAvail (player) / entrySize;
+	if (n > BAR_PLAYER_BUFGUARD / entrySize) {
+		n = BAR_PLAYER_BUFGUARD / entrySize;
+	}
+	if (n > mp4->tableLeft) {
+		n = mp4->tableLeft;
+	}
+	if (n > 0) {
+		p = BarPlayerBufferPeek (player, n * entrySize);
+		assert (p != NULL);
+	}
+
+	for (i = 0; i < n; i++, p += entrySize) {
+		switch (mp4->table) {
+			case BAR_PLAYER_MP4_STSZ:
+				player->sampleSize[player->sampleSizeCurr++] =
+						BarPlayerMp4Get32 (p);
+				break;
+
+			case BAR_PLAYER_MP4_STTS:
+				/* sample count * sample duration */
+				mp4->duration += (uint64_t) BarPlayerMp4Get32 (p) *
+						BarPlayerMp4Get32 (p+4);
+				break;
+
+			case BAR_PLAYER_MP4_STCO:
+				/* we assume chunks are stored back to back, only the first
+				 * one matters */
+				if (mp4->dataOffset == 0) {
+					mp4->dataOffset = BarPlayerMp4Get32 (p);
+				}
+				break;
+
+			case BAR_PLAYER_MP4_CO64:
+				if (mp4->dataOffset == 0) {
+					mp4->dataOffset = BarPlayerMp4Get64 (p);
+				}
+				break;
+
+			default:
+				assert (0);
+				break;
+		}
+	}
+	if (n > 0) {
+		BarPlayerBufferConsume (player, n * entrySize);
+	}
+	mp4->tableLeft -= n;
+
+	if (mp4->tableLeft > 0) {
+		return true;
+	}
+
+	/* table complete */
+	switch (mp4->table) {
+		case BAR_PLAYER_MP4_STSZ:
+			player->sampleSizeCurr = 0;
+			if (player->mode == PLAYER_AUDIO_INITIALIZED) {
+				player->mode = PLAYER_SAMPLESIZE_INITIALIZED;
+			}
+			break;
+
+		case BAR_PLAYER_MP4_STTS:
+			if (mp4->timescale > 0) {
+				player->songDuration = mp4->duration *
+						BAR_PLAYER_MS_TO_S_FACTOR / mp4->timescale;
+			}
+			break;
+
+		default:
+			break;
+	}
+	mp4->table = BAR_PLAYER_MP4_NONE;
+	/* trailing garbage */
+	if (mp4->tableEnd > player->bufferRead) {
+		mp4->skip = mp4->tableEnd - player->bufferRead;
+	}
+
+	return true;
+}
+
+/*	walk mp4 boxes up to the media data, extracting the decoder
+ *	configuration and sample table on the way
+ *	@param player structure
+ *	@return false on error
+ */
+static bool BarPlayerMp4Parse (struct audioPlayer *player) {
+	struct audioPlayerMp4 * const mp4 = &player->mp4;
+	unsigned char *p;
+
+	while (player->mode < PLAYER_RECV_DATA) {
+		const size_t pos = player->bufferRead;
+		uint64_t size;
+		size_t hdr = 8, end;
+
+		if (mp4->skip > 0) {
+			const size_t avail = BarPlayerBufferAvail (player);
+			const size_t n = avail < mp4->skip ? avail : mp4->skip;
+
+			if (n == 0) {
+				break;
+			}
+			BarPlayerBufferConsume (player, n);
+			mp4->skip -= n;
+			continue;
+		}
+
+		if (mp4->table != BAR_PLAYER_MP4_NONE) {
+			const size_t left = mp4->tableLeft;
+
+			if (!BarPlayerMp4Table (player)) {
+				return false;
+			}
+			if (mp4->tableLeft == left && mp4->table != BAR_PLAYER_MP4_NONE) {
+				/* need more data */
+				break;
+			}
+			continue;
+		}
+
+		if (mp4->inData) {
+			/* reached first sample */
+			player->mode = PLAYER_RECV_DATA;
+			break;
+		}
+
+		/* leave containers we are done with */
+		while (mp4->depth > 0 && pos >= mp4->boxEnd[mp4->depth-1]) {
+			--mp4->depth;
+		}
+
+		/* box header */
+		if ((p = BarPlayerBufferPeek (player, hdr)) == NULL) {
+			break;
+		}
+		size = BarPlayerMp4Get32 (p);
+		if (size == 1) {
+			/* 64 bit size follows type */
+			hdr = 16;
+			if ((p = BarPlayerBufferPeek (player, hdr)) == NULL) {
+				break;
+			}
+			size = BarPlayerMp4Get64 (p+8);
+		} else if (size == 0) {
+			/* box extends to end of file, only makes sense for mdat */
+			size = SIZE_MAX - pos;
+		}
+		if (size < hdr || size > SIZE_MAX - pos) {
+			BarUiMsg (player->settings, MSG_ERR, "Invalid mp4 box.\n");
+			return false;
+		}
+		end = pos + size;
+
+		if (memcmp (p+4, "moov", 4) == 0 || memcmp (p+4, "trak", 4) == 0 ||
+				memcmp (p+4, "mdia", 4) == 0 || memcmp (p+4, "minf", 4) == 0 ||
+				memcmp (p+4, "stbl", 4) == 0 || memcmp (p+4, "stsd", 4) == 0 ||
+				memcmp (p+4, "mp4a", 4) == 0) {
+			/* containers; stsd and mp4a have fields before their children */
+			size_t skip = 0;
+			if (memcmp (p+4, "stsd", 4) == 0) {
+				/* version, flags, entry count */
+				skip = 8;
+			} else if (memcmp (p+4, "mp4a", 4) == 0) {
+				/* sample entry and audio sample entry fields */
+				skip = 28;
+			}
+			if (mp4->depth >= BAR_PLAYER_MP4_MAXDEPTH || hdr + skip > size) {
+				BarUiMsg (player->settings, MSG_ERR, "Invalid mp4 box.\n");
+				return false;
+			}
+			mp4->boxEnd[mp4->depth++] = end;
+			BarPlayerBufferConsume (player, hdr);
+			mp4->skip = skip;
+		} else if ((memcmp (p+4, "esds", 4) == 0 &&
+				player->mode == PLAYER_INITIALIZED) ||
+				(memcmp (p+4, "mdhd", 4) == 0 && mp4->timescale == 0)) {
+			/* small boxes, read at once */
+			if (size > BAR_PLAYER_BUFGUARD) {
+				BarUiMsg (player->settings, MSG_ERR, "Invalid mp4 box.\n");
+				return false;
+			}
+			if ((p = BarPlayerBufferPeek (player, size)) == NULL) {
+				break;
+			}
+			if (memcmp (p+4, "esds", 4) == 0) {
+				if (!BarPlayerMp4Esds (player, p + hdr, size - hdr)) {
+					return false;
+				}
+			} else if (size >= hdr + 24) {
+				/* version 1 uses 64 bit creation/modification times */
+				mp4->timescale = BarPlayerMp4Get32 (p + hdr +
+						(p[hdr] == 1 ? 20 : 12));
+			}
+			BarPlayerBufferConsume (player, size);
+		} else if ((memcmp (p+4, "stsz", 4) == 0 &&
+				player->sampleSize == NULL) ||
+				(memcmp (p+4, "stts", 4) == 0 && mp4->duration == 0) ||
+				((memcmp (p+4, "stco", 4) == 0 ||
+				memcmp (p+4, "co64", 4) == 0) && mp4->dataOffset == 0)) {
+			/* sample tables, read incrementally */
+			const bool isStsz = memcmp (p+4, "stsz", 4) == 0;
+			/* version, flags, [sample size,] entry count */
+			const size_t fields = isStsz ? 12 : 8;
+			uint32_t count;
+
+			if (size < hdr + fields) {
+				BarUiMsg (player->settings, MSG_ERR, "Invalid mp4 box.\n");
+				return false;
+			}
+			if ((p = BarPlayerBufferPeek (player, hdr + fields)) == NULL) {
+				break;
+			}
+			count = BarPlayerMp4Get32 (p + hdr + fields - 4);
+
+			if (isStsz) {
+				const uint32_t constSize = BarPlayerMp4Get32 (p + hdr + 4);
+				size_t i;
+
+				if (count == 0 || count > SIZE_MAX / sizeof (*player->sampleSize) ||
+						(player->sampleSize = malloc (count *
+						sizeof (*player->sampleSize))) == NULL) {
+					BarUiMsg (player->settings, MSG_ERR,
+							"Invalid sample table.\n");
+					return false;
+				}
+				player->sampleSizeN = count;
+				player->sampleSizeCurr = 0;
+				if (constSize != 0) {
+					/* all samples have the same size, no table */
+					for (i = 0; i < count; i++) {
+						player->sampleSize[i] = constSize;
+					}
+					count = 0;
+				}
+				mp4->table = BAR_PLAYER_MP4_STSZ;
+
+				/* fallback if stts is missing, assumes HE-AAC's 2048 samples
+				 * per channel and frame */
+				if ((mp4->duration == 0 || mp4->timescale == 0) &&
+						player->samplerate > 0) {
+					player->songDuration = (unsigned long long int) player->sampleSizeN *
+							4096LL * (unsigned long long int) BAR_PLAYER_MS_TO_S_FACTOR /
+							(unsigned long long int) player->samplerate /
+							(unsigned long long int) player->channels;
+				}
+			} else if (memcmp (p+4, "stts", 4) == 0) {
+				mp4->table = BAR_PLAYER_MP4_STTS;
+			} else if (memcmp (p+4, "stco", 4) == 0) {
+				mp4->table = BAR_PLAYER_MP4_STCO;
+			} else {
+				mp4->table = BAR_PLAYER_MP4_CO64;
+			}
+			mp4->tableLeft = count;
+			mp4->tableEnd = end;
+			BarPlayerBufferConsume (player, hdr + fields);
+		} else if (memcmp (p+4, "mdat", 4) == 0) {
+			if (player->mode != PLAYER_SAMPLESIZE_INITIALIZED) {
+				/* we can't seek back */
+				BarUiMsg (player->settings, MSG_ERR,
+						"Unsupported mp4 layout, media data before header.\n");
+				return false;
+			}
+			BarPlayerBufferConsume (player, hdr);
+			if (mp4->dataOffset > player->bufferRead) {
+				mp4->skip = mp4->dataOffset - player->bufferRead;
+			}
+			mp4->inData = true;
+		} else {
+			/* not interested */
+			mp4->skip = size;
+		}
+	}
+
+	return true;
+}
+
+/*	decode and play buffered aac stream
+ *	@param player structure
+ *	@return false on error or if the player should quit
+ */
+static bool BarPlayerAACDecode (struct audioPlayer *player) {
+	unsigned char *p;
+
+	if (BarPlayerCheckPauseQuit (player)) {
+		return false;
+	}
+
+	if (player->mode < PLAYER_RECV_DATA && !BarPlayerMp4Parse (player)) {
+		return false;
 	}
 
 	if (player->mode == PLAYER_RECV_DATA) {
 		short int *aacDecoded;
 		NeAACDecFrameInfo frameInfo;
-		size_t i;
 
-		while (player->sampleSizeCurr < player->sampleSizeN &&
-				(player->bufferFilled - player->bufferRead) >=
-			player->sampleSize[player->sampleSizeCurr]) {
+		while (player->sampleSizeCurr < player->sampleSizeN) {
+			const uint32_t frameSize = player->sampleSize[player->sampleSizeCurr];
+
+			if (frameSize > BAR_PLAYER_BUFGUARD) {
+				BarUiMsg (player->settings, MSG_ERR, "Invalid frame size.\n");
+				return false;
+			}
+			if ((p = BarPlayerBufferPeek (player, frameSize)) == NULL) {
+				/* frame incomplete */
+				break;
+			}
+
 			/* going through this loop can take up to a few seconds =>
 			 * allow earlier thread abort */
 			if (BarPlayerCheckPauseQuit (player)) {
-				return WAITRESS_CB_RET_ERR;
+				return false;
 			}
 
 			/* decode frame */
-			aacDecoded = NeAACDecDecode(player->aacHandle, &frameInfo,
-					&player->buffer[player->bufferRead],
-					player->sampleSize[player->sampleSizeCurr]);
-			player->bufferRead += player->sampleSize[player->sampleSizeCurr];
+			aacDecoded = NeAACDecDecode(player->aacHandle, &frameInfo, p,
+					frameSize);
+			BarPlayerBufferConsume (player, frameSize);
 			++player->sampleSizeCurr;
 
 			if (frameInfo.error != 0) {
@@ -179,295 +932,455 @@ static WaitressCbReturn_t BarPlayerAACCb (void *ptr, size_t size,
 				continue;
 			}
 			/* assuming data in stsz atom is correct */
-			assert (frameInfo.bytesconsumed ==
-					player->sampleSize[player->sampleSizeCurr-1]);
+			assert (frameInfo.bytesconsumed == frameSize);
 
-			for (i = 0; i < frameInfo.samples; i++) {
-				aacDecoded[i] = applyReplayGain (aacDecoded[i], player->scale);
-			}
-			/* ao_play needs bytes: 1 sample = 16 bits = 2 bytes */
-			ao_play (player->audioOutDevice, (char *) aacDecoded,
-					frameInfo.samples * 2);
-			/* add played frame length to played time, explained below */
-			player->songPlayed += (unsigned long long int) frameInfo.samples *
+			BarPcmGain (aacDecoded, frameInfo.samples, player->scale);
+			/* played frame length is added to played time, explained
+			 * below */
+			if (!BarPlayerPcmWrite (player, aacDecoded, frameInfo.samples,
+					(unsigned long long int) frameInfo.samples *
 					(unsigned long long int) BAR_PLAYER_MS_TO_S_FACTOR /
 					(unsigned long long int) player->samplerate /
-					(unsigned long long int) player->channels;
+					(unsigned long long int) player->channels)) {
+				return false;
+			}
 		}
 		if (player->sampleSizeCurr >= player->sampleSizeN) {
 			/* no more frames, drop data */
-			player->bufferRead = player->bufferFilled;
+			BarPlayerBufferConsume (player, BarPlayerBufferAvail (player));
 		}
-	} else {
-		if (player->mode == PLAYER_INITIALIZED) {
-			while (player->bufferRead+4 < player->bufferFilled) {
-				if (memcmp (player->buffer + player->bufferRead, "esds",
-						4) == 0) {
-					player->mode = PLAYER_FOUND_ESDS;
-					player->bufferRead += 4;
-					break;
-				}
-				player->bufferRead++;
+	}
+
+	return true;
+}
+
+#endif /* ENABLE_FAAD */
+
+#ifdef ENABLE_MAD
+
+/*	decode and play buffered mp3 stream
+ *	@param player structure
+ *	@return false on error or if the player should quit
+ */
+static bool BarPlayerMp3Decode (struct audioPlayer *player) {
+	size_t len;
+	unsigned char *p;
+
+	if (BarPlayerCheckPauseQuit (player)) {
+		return false;
+	}
+
+	/* decode in place; frames crossing the ring buffer's end are mirrored */
+	p = BarPlayerBufferRead (player, BAR_PLAYER_BUFGUARD, &len);
+	mad_stream_buffer (&player->mp3Stream, p, len);
+	player->mp3Stream.error = 0;
+	do {
+		/* channels * max samples, found in mad.h */
+		int16_t madDecoded[2*1152];
+
+		if (mad_frame_decode (&player->mp3Frame, &player->mp3Stream) != 0) {
+			if (MAD_RECOVERABLE (player->mp3Stream.error)) {
+				/* lost sync, broken frame, ...; skip it */
+				continue;
+			} else if (player->mp3Stream.error != MAD_ERROR_BUFLEN) {
+				BarUiMsg (player->settings, MSG_ERR,
+						"mp3 decoding error: %s\n",
+						mad_stream_errorstr (&player->mp3Stream));
+				return false;
+			} else {
+				/* rebuffering required => exit loop */
+				break;
 			}
 		}
-		if (player->mode == PLAYER_FOUND_ESDS) {
-			/* FIXME: is this the correct way? */
-			/* we're gonna read 10 bytes */
-			while (player->bufferRead+1+4+5 < player->bufferFilled) {
-				if (memcmp (player->buffer + player->bufferRead,
-						"\x05\x80\x80\x80", 4) == 0) {
-					ao_sample_format format;
-					int audioOutDriver;
-
-					/* +1+4 needs to be replaced by <something>! */
-					player->bufferRead += 1+4;
-					char err = NeAACDecInit2 (player->aacHandle, player->buffer +
-							player->bufferRead, 5, &player->samplerate,
-							&player->channels);
-					player->bufferRead += 5;
-					if (err != 0) {
-						BarUiMsg (player->settings, MSG_ERR,
-								"Error while initializing audio decoder "
-								"(%i)\n", err);
-						return WAITRESS_CB_RET_ERR;
-					}
-					audioOutDriver = ao_default_driver_id();
-					memset (&format, 0, sizeof (format));
-					format.bits = 16;
-					format.channels = player->channels;
-					format.rate = player->samplerate;
-					format.byte_format = AO_FMT_NATIVE;
-					if ((player->audioOutDevice = ao_open_live (audioOutDriver,
-							&format, NULL)) == NULL) {
-						/* we're not interested in the errno */
-						player->aoError = 1;
-						BarUiMsg (player->settings, MSG_ERR,
-								"Cannot open audio device\n");
-						return WAITRESS_CB_RET_ERR;
-					}
-					player->mode = PLAYER_AUDIO_INITIALIZED;
-					break;
-				}
-				player->bufferRead++;
+		mad_synth_frame (&player->mp3Synth, &player->mp3Frame);
+		/* left and right channel, interleaved */
+		BarPcmFixedToShort (madDecoded,
+				(const int32_t *) player->mp3Synth.pcm.samples[0],
+				(const int32_t *) player->mp3Synth.pcm.samples[1],
+				player->mp3Synth.pcm.length, MAD_F_FRACBITS - 15,
+				player->scale);
+		if (player->mode < PLAYER_AUDIO_INITIALIZED) {
+			player->channels = player->mp3Synth.pcm.channels;
+			player->samplerate = player->mp3Synth.pcm.samplerate;
+			if (!BarPlayerAoOpen (player)) {
+				return false;
 			}
+
+			/* calc song length using the framerate of the first decoded frame */
+			player->songDuration = (unsigned long long int) player->contentLength /
+					((unsigned long long int) player->mp3Frame.header.bitrate /
+					(unsigned long long int) BAR_PLAYER_MS_TO_S_FACTOR / 8LL);
+
+			/* must be > PLAYER_SAMPLESIZE_INITIALIZED, otherwise time won't
+			 * be visible to user (ugly, but mp3 decoding != aac decoding) */
+			player->mode = PLAYER_RECV_DATA;
 		}
-		if (player->mode == PLAYER_AUDIO_INITIALIZED) {
-			while (player->bufferRead+4+8 < player->bufferFilled) {
-				if (memcmp (player->buffer + player->bufferRead, "stsz",
-						4) == 0) {
-					player->mode = PLAYER_FOUND_STSZ;
-					player->bufferRead += 4;
-					/* skip version and unknown */
-					player->bufferRead += 8;
-					break;
-				}
-				player->bufferRead++;
-			}
+		/* same calculation as in aac player; don't need to divide by
+		 * channels, length is number of samples for _one_ channel */
+		if (!BarPlayerPcmWrite (player, madDecoded,
+				player->mp3Synth.pcm.length * 2,
+				(unsigned long long int) player->mp3Synth.pcm.length *
+				(unsigned long long int) BAR_PLAYER_MS_TO_S_FACTOR /
+				(unsigned long long int) player->samplerate)) {
+			return false;
 		}
-		/* get frame sizes */
-		if (player->mode == PLAYER_FOUND_STSZ) {
-			while (player->bufferRead+4 < player->bufferFilled) {
-				/* how many frames do we have? */
-				if (player->sampleSizeN == 0) {
-					/* mp4 uses big endian, convert */
-					memcpy (&player->sampleSizeN, player->buffer +
-							player->bufferRead, sizeof (uint32_t));
-					player->sampleSizeN =
-							bigToHostEndian32 (player->sampleSizeN);
-
-					player->sampleSize = malloc (player->sampleSizeN *
-							sizeof (*player->sampleSize));
-					assert (player->sampleSize != NULL);
-					player->bufferRead += sizeof (uint32_t);
-					player->sampleSizeCurr = 0;
-					/* set up song duration (assuming one frame always contains
-					 * the same number of samples)
-					 * calculation: channels * number of frames * samples per
-					 * frame / samplerate */
-					/* FIXME: Hard-coded number of samples per frame */
-					player->songDuration = (unsigned long long int) player->sampleSizeN *
-							4096LL * (unsigned long long int) BAR_PLAYER_MS_TO_S_FACTOR /
-							(unsigned long long int) player->samplerate /
-							(unsigned long long int) player->channels;
-					break;
-				} else {
-					memcpy (&player->sampleSize[player->sampleSizeCurr],
-							player->buffer + player->bufferRead,
-							sizeof (uint32_t));
-					player->sampleSize[player->sampleSizeCurr] =
-							bigToHostEndian32 (
-							player->sampleSize[player->sampleSizeCurr]);
-
-					player->sampleSizeCurr++;
-					player->bufferRead += sizeof (uint32_t);
-				}
-				/* all sizes read, nearly ready for data mode */
-				if (player->sampleSizeCurr >= player->sampleSizeN) {
-					player->mode = PLAYER_SAMPLESIZE_INITIALIZED;
-					break;
-				}
-			}
+
+		if (BarPlayerCheckPauseQuit (player)) {
+			return false;
 		}
-		/* search for data atom and let the show begin... */
-		if (player->mode == PLAYER_SAMPLESIZE_INITIALIZED) {
-			while (player->bufferRead+4 < player->bufferFilled) {
-				if (memcmp (player->buffer + player->bufferRead, "mdat",
-						4) == 0) {
-					player->mode = PLAYER_RECV_DATA;
-					player->sampleSizeCurr = 0;
-					player->bufferRead += 4;
-					break;
-				}
-				player->bufferRead++;
+	} while (player->mp3Stream.error != MAD_ERROR_BUFLEN);
+
+	BarPlayerBufferConsume (player, player->mp3Stream.next_frame - p);
+
+	return true;
+}
+#endif /* ENABLE_MAD */
+
+/*	decode buffered data
+ *	@param player structure
+ *	@return false on error or if the player should quit
+ */
+static bool BarPlayerDecode (struct audioPlayer *player) {
+	switch (player->audioFormat) {
+		#ifdef ENABLE_FAAD
+		case PIANO_AF_AACPLUS:
+			return BarPlayerAACDecode (player);
+		#endif /* ENABLE_FAAD */
+
+		#ifdef ENABLE_MAD
+		case PIANO_AF_MP3:
+			return BarPlayerMp3Decode (player);
+		#endif /* ENABLE_MAD */
+
+		default:
+			/* this should never happen */
+			assert (0);
+			return false;
+	}
+}
+
+/*	decode and play one song, consumer of the ring buffer filled by
+ *	BarPlayerRecvCb
+ *	@param player structure
+ */
+static void BarPlayerDecodeSong (struct audioPlayer *player) {
+	/* bufferFilled before the last decoder pass */
+	size_t filled = 0;
+	/* fill jitter buffer before starting playback */
+	size_t need = player->bufferPrefill;
+
+	while (BarPlayerBufferWaitData (player, filled, need)) {
+		const size_t read = player->bufferRead;
+
+		filled = __atomic_load_n (&player->bufferFilled, __ATOMIC_ACQUIRE);
+		need = 0;
+
+		if (!BarPlayerDecode (player)) {
+			break;
+		}
+
+		if (player->bufferRead == read) {
+			/* decoder needs more data than available */
+			if (__atomic_load_n (&player->recvDone, __ATOMIC_ACQUIRE) &&
+					__atomic_load_n (&player->bufferFilled,
+					__ATOMIC_ACQUIRE) == filled) {
+				/* end of stream */
+				break;
+			}
+			if (player->mode == PLAYER_RECV_DATA) {
+				/* ran dry while playing, refill jitter buffer */
+				++player->underruns;
+				need = player->bufferPrefill;
+				BarPlayerPcmFlush (player);
 			}
+		} else {
+			/* try again with whatever is left */
+			filled = 0;
+		}
+	}
+
+	/* end of track, nothing staged if we were skipped */
+	BarPlayerPcmFlush (player);
+
+	__atomic_store_n (&player->decodeDone, true, __ATOMIC_RELEASE);
+	BarPlayerWake (player, &player->recvWaiting);
+}
+
+/*	decode/output thread, runs as long as the player engine
+ *	@param player structure
+ *	@return NULL
+ */
+static void *BarPlayerDecodeThread (void *data) {
+	struct audioPlayer *player = data;
+
+	pthread_mutex_lock (&player->pauseMutex);
+	while (true) {
+		struct timespec deadline = {0, 0};
+
+		while (!player->engineQuit && !player->decodeStart) {
+			BarPlayerIdleWait (player, &deadline);
+		}
+		/* the receiver waits for a started song to finish */
+		if (!player->decodeStart) {
+			break;
 		}
-	}
+		player->decodeStart = false;
+		pthread_mutex_unlock (&player->pauseMutex);
 
-	BarPlayerBufferMove (player);
+		BarPlayerDecodeSong (player);
 
-	return WAITRESS_CB_RET_OK;
-}
+		pthread_mutex_lock (&player->pauseMutex);
+	}
+	pthread_mutex_unlock (&player->pauseMutex);
 
-#endif /* ENABLE_FAAD */
+	return NULL;
+}
 
-#ifdef ENABLE_MAD
+/*	wait until the decoder is done with the current song
+ *	@param player structure
+ */
+static void BarPlayerDecodeWait (struct audioPlayer *player) {
+	pthread_mutex_lock (&player->pauseMutex);
+	__atomic_store_n (&player->recvWaiting, true, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	while (!__atomic_load_n (&player->decodeDone, __ATOMIC_ACQUIRE)) {
+		pthread_cond_wait (&player->pauseCond, &player->pauseMutex);
+	}
+	__atomic_store_n (&player->recvWaiting, false, __ATOMIC_RELAXED);
+	pthread_mutex_unlock (&player->pauseMutex);
+}
 
-/*	convert mad's internal fixed point format to short int
- *	@param mad fixed
- *	@return short int
+/*	set up ring buffer and wake up decoder thread once the stream's size is
+ *	known
+ *	@param player structure
+ *	@return false on error
  */
-static inline signed short int BarPlayerMadToShort (const mad_fixed_t fixed) {
-	/* Clipping */
-	if (fixed >= MAD_F_ONE) {
-		return SHRT_MAX;
-	} else if (fixed <= -MAD_F_ONE) {
-		return -SHRT_MAX;
+static bool BarPlayerDecodeStart (struct audioPlayer *player) {
+	const unsigned long long int contentLength = player->contentLength;
+	size_t size;
+
+	/* derive jitter buffer size from the average bitrate */
+	if (contentLength > 0 && player->songDuration > 0) {
+		player->bufferPrefill = contentLength *
+				(unsigned long long int) player->settings->jitterBuffer /
+				(unsigned long long int) player->songDuration;
+	} else {
+		player->bufferPrefill = BAR_PLAYER_BUFSIZE / 2;
+	}
+
+	size = player->bufferPrefill * 2 + BAR_PLAYER_BUFSIZE;
+	/* the previous song's buffer is reused if it is large enough */
+	if (player->ringSize < size) {
+		free (player->ringBuffer);
+		if ((player->ringBuffer = malloc (size + BAR_PLAYER_BUFGUARD)) ==
+				NULL) {
+			player->ringSize = 0;
+			BarUiMsg (player->settings, MSG_ERR, "Out of memory.\n");
+			return false;
+		}
+		player->ringSize = size;
 	}
+	player->buffer = player->ringBuffer;
+	player->bufferSize = size;
 
-	/* Conversion */
-	return (signed short int) (fixed >> (MAD_F_FRACBITS - 15));
+	pthread_mutex_lock (&player->pauseMutex);
+	player->decodeStart = true;
+	pthread_cond_broadcast (&player->pauseCond);
+	pthread_mutex_unlock (&player->pauseMutex);
+
+	return true;
 }
 
-/*	mp3 playback callback
+/*	receive audio stream, producer of the ring buffer
+ *	@param streamed data
+ *	@param received bytes
+ *	@param extra data (player data)
+ *	@return WAITRESS_CB_RET_ERR if the decoder is gone
  */
-static WaitressCbReturn_t BarPlayerMp3Cb (void *ptr, size_t size,
+static WaitressCbReturn_t BarPlayerRecvCb (void *ptr, size_t size,
 		void *stream) {
 	const char *data = ptr;
 	struct audioPlayer *player = stream;
-	size_t i;
 
-	if (BarPlayerCheckPauseQuit (player) ||
-			!BarPlayerBufferFill (player, data, size)) {
+	/* Range requests only report what is left */
+	if (player->contentLength == 0 && player->bytesReceived == 0) {
+		player->contentLength = player->waith.request.contentLength;
+	}
+
+	if (player->buffer == NULL && !BarPlayerDecodeStart (player)) {
 		return WAITRESS_CB_RET_ERR;
 	}
 
-	/* some "prebuffering" */
-	if (player->mode < PLAYER_RECV_DATA &&
-			player->bufferFilled < BAR_PLAYER_BUFSIZE / 2) {
-		return WAITRESS_CB_RET_OK;
+	if (__atomic_load_n (&player->decodeDone, __ATOMIC_ACQUIRE) ||
+			!BarPlayerBufferFill (player, data, size)) {
+		return WAITRESS_CB_RET_ERR;
 	}
 
-	mad_stream_buffer (&player->mp3Stream, player->buffer,
-			player->bufferFilled);
-	player->mp3Stream.error = 0;
-	do {
-		/* channels * max samples, found in mad.h */
-		signed short int madDecoded[2*1152], *madPtr = madDecoded;
+	return WAITRESS_CB_RET_OK;
+}
 
-		if (mad_frame_decode (&player->mp3Frame, &player->mp3Stream) != 0) {
-			if (player->mp3Stream.error != MAD_ERROR_BUFLEN) {
-				BarUiMsg (player->settings, MSG_ERR,
-						"mp3 decoding error: %s\n",
-						mad_stream_errorstr (&player->mp3Stream));
-				return WAITRESS_CB_RET_ERR;
-			} else {
-				/* rebuffering required => exit loop */
-				break;
-			}
-		}
-		mad_synth_frame (&player->mp3Synth, &player->mp3Frame);
-		for (i = 0; i < player->mp3Synth.pcm.length; i++) {
-			/* left channel */
-			*(madPtr++) = applyReplayGain (BarPlayerMadToShort (
-					player->mp3Synth.pcm.samples[0][i]), player->scale);
+/*	size of an id3v2 tag
+ *	@param at least 10 bytes of data
+ *	@return size including header and footer or 0 if there is no tag
+ */
+static size_t BarPlayerId3Size (const unsigned char *p) {
+	size_t size;
+
+	if (memcmp (p, "ID3", 3) != 0) {
+		return 0;
+	}
+	/* synchsafe integer, seven bits per byte */
+	size = (size_t) (p[6] & 0x7f) << 21 | (size_t) (p[7] & 0x7f) << 14 |
+			(size_t) (p[8] & 0x7f) << 7 | (size_t) (p[9] & 0x7f);
+	/* header, footer flag */
+	return size + 10 + ((p[5] & 0x10) ? 10 : 0);
+}
 
-			/* right channel */
-			*(madPtr++) = applyReplayGain (BarPlayerMadToShort (
-					player->mp3Synth.pcm.samples[1][i]), player->scale);
+/*	sanity check for a previously recorded song
+ *	@param player structure
+ *	@param file contents
+ *	@param file size
+ *	@return true if the file looks complete
+ */
+static bool BarPlayerLocalCheck (const struct audioPlayer *player,
+		const unsigned char *data, const size_t size) {
+	switch (player->audioFormat) {
+		case PIANO_AF_AACPLUS: {
+			/* top level boxes must cover the whole file */
+			bool haveMoov = false, haveMdat = false;
+			size_t pos = 0;
+
+			while (pos + 8 <= size) {
+				uint64_t boxSize = (uint64_t) data[pos] << 24 |
+						(uint64_t) data[pos+1] << 16 |
+						(uint64_t) data[pos+2] << 8 | data[pos+3];
+				if (boxSize == 0) {
+					/* extends to end of file */
+					boxSize = size - pos;
+				}
+				if (boxSize < 8 || boxSize > size - pos) {
+					return false;
+				}
+				if (memcmp (data + pos + 4, "moov", 4) == 0) {
+					haveMoov = true;
+				} else if (memcmp (data + pos + 4, "mdat", 4) == 0) {
+					haveMdat = true;
+				}
+				pos += boxSize;
+			}
+			return pos == size && haveMoov && haveMdat;
 		}
-		if (player->mode < PLAYER_AUDIO_INITIALIZED) {
-			ao_sample_format format;
-			int audioOutDriver;
 
-			player->channels = player->mp3Synth.pcm.channels;
-			player->samplerate = player->mp3Synth.pcm.samplerate;
-			audioOutDriver = ao_default_driver_id();
-			memset (&format, 0, sizeof (format));
-			format.bits = 16;
-			format.channels = player->channels;
-			format.rate = player->samplerate;
-			format.byte_format = AO_FMT_NATIVE;
-			if ((player->audioOutDevice = ao_open_live (audioOutDriver,
-					&format, NULL)) == NULL) {
-				player->aoError = 1;
-				BarUiMsg (player->settings, MSG_ERR,
-						"Cannot open audio device\n");
-				return WAITRESS_CB_RET_ERR;
+		case PIANO_AF_MP3: {
+			/* mpeg 1 layer 3, kbit/s */
+			static const unsigned short bitrates[] = {0, 32, 40, 48, 56, 64, 80,
+					96, 112, 128, 160, 192, 224, 256, 320, 0};
+			size_t pos = size >= 10 ? BarPlayerId3Size (data) : 0;
+			unsigned int bitrate;
+
+			if (pos + 4 > size || data[pos] != 0xff ||
+					(data[pos+1] & 0xe0) != 0xe0) {
+				/* no frame right after the tag */
+				return false;
 			}
+			/* only check length of mpeg 1 layer 3 files, everything else is
+			 * not sent by pandora */
+			if ((data[pos+1] & 0x1e) != 0x1a || player->songDuration == 0) {
+				return true;
+			}
+			bitrate = bitrates[data[pos+2] >> 4];
+			/* allow some slack, pandora's song length is not exact */
+			return bitrate == 0 || (unsigned long long int) (size - pos) * 8 /
+					bitrate >= (unsigned long long int) player->songDuration *
+					9 / 10;
+		}
 
-			/* calc song length using the framerate of the first decoded frame */
-			player->songDuration = (unsigned long long int) player->waith.request.contentLength /
-					((unsigned long long int) player->mp3Frame.header.bitrate /
-					(unsigned long long int) BAR_PLAYER_MS_TO_S_FACTOR / 8LL);
+		default:
+			return false;
+	}
+}
 
-			/* must be > PLAYER_SAMPLESIZE_INITIALIZED, otherwise time won't
-			 * be visible to user (ugly, but mp3 decoding != aac decoding) */
-			player->mode = PLAYER_RECV_DATA;
-		}
-		/* samples * length * channels */
-		ao_play (player->audioOutDevice, (char *) madDecoded,
-				player->mp3Synth.pcm.length * 2 * 2);
+/*	play a previously recorded copy of the song, decoding straight from the
+ *	mapped file
+ *	@param player structure
+ *	@return true if the song was played from disk, false if it should be
+ *			streamed instead
+ */
+static bool BarPlayerLocalPlay (struct audioPlayer *player) {
+	struct stat st;
+	void *data;
+	int fd;
+
+	if (player->fly.status != NOT_RECORDING_EXIST ||
+			player->fly.audio_file_path == NULL) {
+		return false;
+	}
 
-		/* avoid division by 0 */
-		if (player->mode == PLAYER_RECV_DATA) {
-			/* same calculation as in aac player; don't need to divide by
-			 * channels, length is number of samples for _one_ channel */
-			player->songPlayed += (unsigned long long int) player->mp3Synth.pcm.length *
-					(unsigned long long int) BAR_PLAYER_MS_TO_S_FACTOR /
-					(unsigned long long int) player->samplerate;
-		}
+	if ((fd = open (player->fly.audio_file_path, O_RDONLY)) == -1) {
+		return false;
+	}
+	if (fstat (fd, &st) == -1 || st.st_size <= 0 ||
+			(uintmax_t) st.st_size > SIZE_MAX) {
+		close (fd);
+		return false;
+	}
+	data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
 
-		if (BarPlayerCheckPauseQuit (player)) {
-			return WAITRESS_CB_RET_ERR;
-		}
-	} while (player->mp3Stream.error != MAD_ERROR_BUFLEN);
+	if (!BarPlayerLocalCheck (player, data, st.st_size)) {
+		BarUiMsg (player->settings, MSG_INFO,
+				"Recorded file is incomplete, streaming.\n");
+		munmap (data, st.st_size);
+		return false;
+	}
+	#ifdef POSIX_MADV_SEQUENTIAL
+	posix_madvise (data, st.st_size, POSIX_MADV_SEQUENTIAL);
+	#endif
 
-	player->bufferRead += player->mp3Stream.next_frame - player->buffer;
+	/* the whole file is "received" already and never wraps around, so the
+	 * ring buffer code works on the mapping as is */
+	player->buffer = data;
+	player->bufferSize = st.st_size;
+	player->bufferMapped = true;
+	player->bufferFilled = player->bytesReceived = player->contentLength =
+			st.st_size;
+	player->recvDone = true;
+	if (player->audioFormat == PIANO_AF_MP3) {
+		/* skip id3 tag written by BarFlyTag */
+		const size_t tag = player->bufferSize >= 10 ?
+				BarPlayerId3Size (player->buffer) : 0;
+		player->bufferRead = tag < player->bufferSize ? tag : 0;
+	}
 
-	BarPlayerBufferMove (player);
+	/* audio output is the decoder thread's business */
+	pthread_mutex_lock (&player->pauseMutex);
+	player->decodeStart = true;
+	pthread_cond_broadcast (&player->pauseCond);
+	pthread_mutex_unlock (&player->pauseMutex);
+	BarPlayerDecodeWait (player);
 
-	return WAITRESS_CB_RET_OK;
+	return true;
 }
-#endif /* ENABLE_MAD */
 
-/*	player thread; for every song a new thread is started
- *	@param audioPlayer structure
+/*	play the song set up by BarPlayerSongStart
+ *	@param player structure
  *	@return PLAYER_RET_*
  */
-void *BarPlayerThread (void *data) {
-	struct audioPlayer *player = data;
+static int BarPlayerPlaySong (struct audioPlayer *player) {
 	char extraHeaders[32];
-	void *ret = PLAYER_RET_OK;
+	int ret = PLAYER_RET_OK;
 	#ifdef ENABLE_FAAD
 	NeAACDecConfigurationPtr conf;
 	#endif
 	WaitressReturn_t wRet = WAITRESS_RET_ERR;
 
-	/* init handles */
-	player->waith.data = (void *) player;
 	/* extraHeaders will be initialized later */
 	player->waith.extraHeaders = extraHeaders;
-	player->buffer = malloc (BAR_PLAYER_BUFSIZE);
+	player->fetchTiming = (WaitressTiming_t) {-1, -1, -1, -1, -1, -1, -1,
+			0, 0, 0};
 
 	switch (player->audioFormat) {
 		#ifdef ENABLE_FAAD
@@ -478,8 +1391,6 @@ void *BarPlayerThread (void *data) {
 			conf->outputFormat = FAAD_FMT_16BIT;
 		    conf->downMatrix = 1;
 			NeAACDecSetConfiguration(player->aacHandle, conf);
-
-			player->waith.callback = BarPlayerAACCb;
 			break;
 		#endif /* ENABLE_FAAD */
 
@@ -488,28 +1399,73 @@ void *BarPlayerThread (void *data) {
 			mad_stream_init (&player->mp3Stream);
 			mad_frame_init (&player->mp3Frame);
 			mad_synth_init (&player->mp3Synth);
-
-			player->waith.callback = BarPlayerMp3Cb;
+			/* BarPcmFixedToShort expects 32 bit samples */
+			assert (sizeof (mad_fixed_t) == sizeof (int32_t));
 			break;
 		#endif /* ENABLE_MAD */
 
 		default:
 			BarUiMsg (player->settings, MSG_ERR, "Unsupported audio format!\n");
-			ret = (void *) PLAYER_RET_HARDFAIL;
+			ret = PLAYER_RET_HARDFAIL;
 			goto cleanup;
 			break;
 	}
 	
 	player->mode = PLAYER_INITIALIZED;
 
-	/* This loop should work around song abortions by requesting the
-	 * missing part of the song */
-	do {
-		snprintf (extraHeaders, sizeof (extraHeaders), "Range: bytes=%zu-\r\n",
-				player->bytesReceived);
-		wRet = WaitressFetchCall (&player->waith);
-	} while (wRet == WAITRESS_RET_PARTIAL_FILE || wRet == WAITRESS_RET_TIMEOUT
-			|| wRet == WAITRESS_RET_READ_ERR);
+	if (player->settings->recordOnly) {
+		/* nobody is listening, download as fast as possible; songs that
+		 * were recorded already are skipped */
+		BarFlyDownload (&player->fly, player->waith.url.url,
+				player->cancelPipe[0], &wRet, player->settings);
+	} else if (BarPlayerLocalPlay (player)) {
+		/* tagging is skipped for existing files anyway */
+		wRet = player->aoError ? WAITRESS_RET_CB_ABORT : WAITRESS_RET_OK;
+	} else if (player->prefetchBuffer != NULL) {
+		/* start with the prefetched part of the stream */
+		size_t off = 0;
+
+		player->contentLength = player->prefetchLength;
+		/* same chunk size waitress uses, must fit into the ring buffer */
+		while (off < player->prefetchFilled) {
+			const size_t chunk = player->prefetchFilled - off >
+					WAITRESS_BUFFER_SIZE ? WAITRESS_BUFFER_SIZE :
+					player->prefetchFilled - off;
+			if (BarPlayerRecvCb (player->prefetchBuffer + off, chunk,
+					player) != WAITRESS_CB_RET_OK) {
+				wRet = WAITRESS_RET_CB_ABORT;
+				break;
+			}
+			off += chunk;
+		}
+		free (player->prefetchBuffer);
+		player->prefetchBuffer = NULL;
+	}
+
+	if (player->contentLength > 0 &&
+			player->bytesReceived >= player->contentLength) {
+		/* prefetch got the whole song or it was played from disk */
+		if (wRet == WAITRESS_RET_ERR) {
+			wRet = WAITRESS_RET_OK;
+		}
+	} else if (wRet != WAITRESS_RET_CB_ABORT && !player->settings->recordOnly) {
+		/* This loop should work around song abortions by requesting the
+		 * missing part of the song */
+		do {
+			snprintf (extraHeaders, sizeof (extraHeaders),
+					"Range: bytes=%zu-\r\n", player->bytesReceived);
+			wRet = WaitressFetchCall (&player->waith);
+		} while (wRet == WAITRESS_RET_PARTIAL_FILE ||
+				wRet == WAITRESS_RET_TIMEOUT || wRet == WAITRESS_RET_READ_ERR);
+		WaitressGetTiming (&player->waith, &player->fetchTiming);
+	}
+
+	/* let the decoder drain the buffer */
+	if (player->buffer != NULL && !player->bufferMapped) {
+		__atomic_store_n (&player->recvDone, true, __ATOMIC_RELEASE);
+		BarPlayerWake (player, &player->decodeWaiting);
+		BarPlayerDecodeWait (player);
+	}
 
 	/* If the song was played all the way through tag it. */
 	if (wRet == WAITRESS_RET_OK) {
@@ -539,22 +1495,456 @@ void *BarPlayerThread (void *data) {
 	}
 
 	if (player->aoError) {
-		ret = (void *) PLAYER_RET_HARDFAIL;
+		ret = PLAYER_RET_HARDFAIL;
 	}
 
 	/* Pandora sends broken audio url’s sometimes (“bad request”). ignore them. */
 	if (wRet != WAITRESS_RET_OK && wRet != WAITRESS_RET_CB_ABORT) {
 		BarUiMsg (player->settings, MSG_ERR, "Cannot access audio file: %s\n",
 				WaitressErrorToStr (wRet));
-		ret = (void *) PLAYER_RET_SOFTFAIL;
+		ret = PLAYER_RET_SOFTFAIL;
 	}
 
 cleanup:
-	ao_close (player->audioOutDevice);
+	/* audio device, waitress handle and ring buffer are kept for the next
+	 * song */
+	player->waith.extraHeaders = NULL;
+	if (player->bufferMapped) {
+		munmap (player->buffer, player->bufferSize);
+	}
+	player->buffer = NULL;
+	free (player->prefetchBuffer);
+	player->prefetchBuffer = NULL;
+
+	return ret;
+}
+
+/*	load song into player, resetting all per-song state; the engine thread
+ *	must be idle and pauseMutex locked
+ *	@param player structure
+ *	@param song, url is copied, everything else is owned by the player now
+ *	@return false if the url is invalid
+ */
+static bool BarPlayerSongStart (struct audioPlayer *player,
+		const BarPlayerSong_t *song) {
+	if (!WaitressSetUrl (&player->waith, song->url)) {
+		BarUiMsg (player->settings, MSG_ERR, "Invalid audio url.\n");
+		free (song->prefetchBuffer);
+		return false;
+	}
+
+	player->doQuit = false;
+	player->doPause = false;
+	BarPlayerCancelReset (player->cancelPipe);
+	player->aoError = 0;
+	player->audioFormat = song->audioFormat;
+	player->gain = song->gain;
+	player->scale = BarPlayerCalcScale (song->gain +
+			player->settings->volume);
+	player->songDuration = song->duration;
+	player->songPlayed = 0;
+	player->bufferFilled = 0;
+	player->bufferRead = 0;
+	player->bufferSize = 0;
+	player->bufferMapped = false;
+	player->bytesReceived = 0;
+	player->contentLength = 0;
+	player->prefetchBuffer = song->prefetchBuffer;
+	player->prefetchFilled = song->prefetchFilled;
+	player->prefetchLength = song->prefetchLength;
+	player->bufferPrefill = 0;
+	player->underruns = 0;
+	player->pcmFilled = 0;
+	player->pcmTime = 0;
+	player->recvDone = false;
+	player->decodeDone = false;
+	player->recvWaiting = false;
+	player->decodeWaiting = false;
+	#ifdef ENABLE_FAAD
+	memset (&player->mp4, 0, sizeof (player->mp4));
+	player->sampleSizeN = 0;
+	player->sampleSizeCurr = 0;
+	player->sampleSize = NULL;
+	#endif
+	player->buffer = NULL;
+	player->fly = song->fly;
+	player->ret = PLAYER_RET_OK;
+
+	player->mode = PLAYER_STARTING;
+
+	return true;
+}
+
+/*	engine thread, plays one song after another
+ *	@param player structure
+ *	@return NULL
+ */
+static void *BarPlayerEngineThread (void *data) {
+	struct audioPlayer *player = data;
+	int ret;
+
+	pthread_mutex_lock (&player->pauseMutex);
+	while (true) {
+		while (!player->engineQuit && player->mode != PLAYER_STARTING) {
+			pthread_cond_wait (&player->pauseCond, &player->pauseMutex);
+		}
+		if (player->engineQuit) {
+			break;
+		}
+		pthread_mutex_unlock (&player->pauseMutex);
+
+		ret = BarPlayerPlaySong (player);
+
+		pthread_mutex_lock (&player->pauseMutex);
+		player->ret = ret;
+		player->mode = PLAYER_FINISHED_PLAYBACK;
+	}
+	pthread_mutex_unlock (&player->pauseMutex);
+
+	return NULL;
+}
+
+/*	set up player and start the engine and decoder thread
+ *	@param player structure
+ *	@param settings
+ *	@return false on error
+ */
+bool BarPlayerInit (struct audioPlayer *player,
+		const BarSettings_t *settings) {
+	assert (player != NULL);
+	assert (settings != NULL);
+
+	/* the recording (player->fly) is owned by the caller */
+	memset (player, 0, sizeof (*player));
+	player->settings = settings;
+	player->aoDriver = -1;
+
+	WaitressInit (&player->waith);
+	if (settings->proxy != NULL) {
+		WaitressSetProxy (&player->waith, settings->proxy);
+	}
+	player->waith.data = player;
+	/* ring buffer is set up by BarPlayerRecvCb */
+	player->waith.callback = BarPlayerRecvCb;
+	/* without it skipping has to wait for the network */
+	BarPlayerCancelOpen (player->cancelPipe);
+	player->waith.cancelFd = player->cancelPipe[0];
+
+	pthread_mutex_init (&player->pauseMutex, NULL);
+	pthread_cond_init (&player->pauseCond, NULL);
+
+	if (pthread_create (&player->thread, NULL, BarPlayerEngineThread,
+			player) != 0) {
+		goto error;
+	}
+	if (pthread_create (&player->decodeThread, NULL, BarPlayerDecodeThread,
+			player) != 0) {
+		pthread_mutex_lock (&player->pauseMutex);
+		player->engineQuit = true;
+		pthread_cond_broadcast (&player->pauseCond);
+		pthread_mutex_unlock (&player->pauseMutex);
+		pthread_join (player->thread, NULL);
+		goto error;
+	}
+
+	return true;
+
+error:
+	BarUiMsg (settings, MSG_ERR, "Cannot start player.\n");
+	BarPlayerCancelClose (player->cancelPipe);
+	pthread_cond_destroy (&player->pauseCond);
+	pthread_mutex_destroy (&player->pauseMutex);
 	WaitressFree (&player->waith);
-	free (player->buffer);
+	return false;
+}
+
+/*	stop playback, the engine and decoder thread and free all resources
+ *	except the current recording (player->fly)
+ *	@param player structure
+ */
+void BarPlayerDestroy (struct audioPlayer *player) {
+	BarPlayerSong_t *song;
 
-	player->mode = PLAYER_FINISHED_PLAYBACK;
+	assert (player != NULL);
 
-	return ret;
+	pthread_mutex_lock (&player->pauseMutex);
+	player->doQuit = true;
+	player->engineQuit = true;
+	pthread_cond_broadcast (&player->pauseCond);
+	pthread_mutex_unlock (&player->pauseMutex);
+	BarPlayerCancel (player->cancelPipe);
+
+	pthread_join (player->thread, NULL);
+	pthread_join (player->decodeThread, NULL);
+
+	while ((song = player->queue) != NULL) {
+		player->queue = song->next;
+		BarFlyClose (&song->fly, player->settings);
+		free (song->prefetchBuffer);
+		free (song->url);
+		free (song);
+	}
+
+	BarPlayerAoClose (player);
+	free (player->pcm);
+	free (player->ringBuffer);
+	WaitressFree (&player->waith);
+	BarPlayerCancelClose (player->cancelPipe);
+	pthread_cond_destroy (&player->pauseCond);
+	pthread_mutex_destroy (&player->pauseMutex);
+	player->mode = PLAYER_FREED;
+}
+
+/*	hand song over to the player; it starts right away if nothing is
+ *	playing, otherwise it is queued
+ *	@param player structure
+ *	@param song, url is copied, everything else is owned by the player now
+ *	@return false on error
+ */
+bool BarPlayerEnqueue (struct audioPlayer *player,
+		const BarPlayerSong_t *song) {
+	BarPlayerSong_t *item, **last;
+
+	assert (player != NULL);
+	assert (song != NULL);
+
+	pthread_mutex_lock (&player->pauseMutex);
+	if (player->mode == PLAYER_FREED && player->queue == NULL) {
+		const bool started = BarPlayerSongStart (player, song);
+		if (started) {
+			pthread_cond_broadcast (&player->pauseCond);
+		}
+		pthread_mutex_unlock (&player->pauseMutex);
+		return started;
+	}
+	pthread_mutex_unlock (&player->pauseMutex);
+
+	if ((item = malloc (sizeof (*item))) == NULL) {
+		return false;
+	}
+	*item = *song;
+	item->next = NULL;
+	if ((item->url = strdup (song->url)) == NULL) {
+		free (item);
+		return false;
+	}
+
+	last = &player->queue;
+	while (*last != NULL) {
+		last = &(*last)->next;
+	}
+	*last = item;
+
+	return true;
+}
+
+/*	acknowledge PLAYER_FINISHED_PLAYBACK and start the next queued song,
+ *	if any
+ *	@param player structure
+ */
+void BarPlayerSongDone (struct audioPlayer *player) {
+	assert (player != NULL);
+	assert (player->mode == PLAYER_FINISHED_PLAYBACK);
+
+	pthread_mutex_lock (&player->pauseMutex);
+	player->mode = PLAYER_FREED;
+	pthread_mutex_unlock (&player->pauseMutex);
+	memset (&player->fly, 0, sizeof (player->fly));
+
+	while (player->queue != NULL) {
+		BarPlayerSong_t *song = player->queue;
+		bool started;
+
+		player->queue = song->next;
+		pthread_mutex_lock (&player->pauseMutex);
+		started = BarPlayerSongStart (player, song);
+		if (started) {
+			pthread_cond_broadcast (&player->pauseCond);
+		}
+		pthread_mutex_unlock (&player->pauseMutex);
+		if (!started) {
+			BarFlyClose (&song->fly, player->settings);
+		}
+		free (song->url);
+		free (song);
+
+		if (started) {
+			break;
+		}
+	}
+}
+
+/*	stop playing the current song
+ *	@param player structure
+ */
+void BarPlayerSkip (struct audioPlayer *player) {
+	assert (player != NULL);
+
+	pthread_mutex_lock (&player->pauseMutex);
+	player->doQuit = true;
+	pthread_cond_broadcast (&player->pauseCond);
+	pthread_mutex_unlock (&player->pauseMutex);
+	/* don't wait for the network */
+	BarPlayerCancel (player->cancelPipe);
+}
+
+/*	pause or resume playback
+ *	@param player structure
+ *	@param pause
+ */
+void BarPlayerSetPause (struct audioPlayer *player, const bool pause) {
+	assert (player != NULL);
+
+	pthread_mutex_lock (&player->pauseMutex);
+	player->doPause = pause;
+	pthread_cond_broadcast (&player->pauseCond);
+	pthread_mutex_unlock (&player->pauseMutex);
+}
+
+/*	toggle pause
+ *	@param player structure
+ */
+void BarPlayerTogglePause (struct audioPlayer *player) {
+	assert (player != NULL);
+
+	pthread_mutex_lock (&player->pauseMutex);
+	player->doPause = !player->doPause;
+	pthread_cond_broadcast (&player->pauseCond);
+	pthread_mutex_unlock (&player->pauseMutex);
+}
+
+
+/*	receive beginning of the prefetched stream
+ *	@param streamed data
+ *	@param received bytes
+ *	@param extra data (prefetch data)
+ *	@return WAITRESS_CB_RET_ERR if the budget is exhausted or prefetching
+ *			was cancelled
+ */
+static WaitressCbReturn_t BarPrefetchCb (void *ptr, size_t size,
+		void *stream) {
+	BarPrefetch_t *pf = stream;
+	size_t copy;
+
+	if (__atomic_load_n (&pf->doQuit, __ATOMIC_ACQUIRE)) {
+		return WAITRESS_CB_RET_ERR;
+	}
+
+	if (pf->buffer == NULL) {
+		pf->contentLength = pf->waith.request.contentLength;
+		pf->bufferSize = pf->settings->prefetchSize;
+		if (pf->contentLength > 0 && pf->contentLength < pf->bufferSize) {
+			pf->bufferSize = pf->contentLength;
+		}
+		if ((pf->buffer = malloc (pf->bufferSize)) == NULL) {
+			return WAITRESS_CB_RET_ERR;
+		}
+	}
+
+	copy = pf->bufferSize - pf->bufferFilled;
+	if (copy > size) {
+		copy = size;
+	}
+	memcpy (pf->buffer + pf->bufferFilled, ptr, copy);
+	pf->bufferFilled += copy;
+
+	if (pf->bufferFilled >= pf->bufferSize) {
+		/* budget exhausted, the player fetches the rest */
+		return WAITRESS_CB_RET_ERR;
+	}
+
+	return WAITRESS_CB_RET_OK;
+}
+
+/*	prefetch thread
+ *	@param prefetch data
+ *	@return NULL
+ */
+static void *BarPrefetchThread (void *data) {
+	BarPrefetch_t *pf = data;
+
+	WaitressFetchCall (&pf->waith);
+	WaitressFree (&pf->waith);
+
+	return NULL;
+}
+
+/*	start downloading the beginning of an audio stream in the background
+ *	@param prefetch data, must be idle
+ *	@param audio url
+ *	@param settings
+ *	@return true if the prefetch thread was started
+ */
+bool BarPrefetchStart (BarPrefetch_t *pf, const char *url,
+		const BarSettings_t *settings) {
+	assert (pf != NULL);
+	assert (pf->mode == PREFETCH_IDLE);
+	assert (url != NULL);
+
+	memset (pf, 0, sizeof (*pf));
+	pf->settings = settings;
+
+	WaitressInit (&pf->waith);
+	if (!WaitressSetUrl (&pf->waith, url)) {
+		WaitressFree (&pf->waith);
+		return false;
+	}
+	if (settings->proxy != NULL) {
+		WaitressSetProxy (&pf->waith, settings->proxy);
+	}
+	pf->waith.data = pf;
+	pf->waith.callback = BarPrefetchCb;
+	/* BarPrefetchFinish could not abort a stalled download */
+	if (!BarPlayerCancelOpen (pf->cancelPipe)) {
+		goto error;
+	}
+	pf->waith.cancelFd = pf->cancelPipe[0];
+
+	if ((pf->url = strdup (url)) == NULL) {
+		goto error;
+	}
+	if (pthread_create (&pf->thread, NULL, BarPrefetchThread, pf) != 0) {
+		goto error;
+	}
+	pf->mode = PREFETCH_RUNNING;
+
+	return true;
+
+error:
+	WaitressFree (&pf->waith);
+	BarPlayerCancelClose (pf->cancelPipe);
+	free (pf->url);
+	memset (pf, 0, sizeof (*pf));
+	return false;
+}
+
+/*	stop prefetching and hand the data over to a song that is about to be
+ *	played
+ *	@param prefetch data
+ *	@param song or NULL to just discard the data
+ */
+void BarPrefetchFinish (BarPrefetch_t *pf, BarPlayerSong_t *song) {
+	assert (pf != NULL);
+
+	if (pf->mode == PREFETCH_IDLE) {
+		return;
+	}
+
+	/* whatever we got so far is good enough */
+	__atomic_store_n (&pf->doQuit, true, __ATOMIC_RELEASE);
+	BarPlayerCancel (pf->cancelPipe);
+	pthread_join (pf->thread, NULL);
+	BarPlayerCancelClose (pf->cancelPipe);
+
+	if (song != NULL && song->url != NULL && pf->buffer != NULL &&
+			strcmp (pf->url, song->url) == 0) {
+		song->prefetchBuffer = pf->buffer;
+		song->prefetchFilled = pf->bufferFilled;
+		song->prefetchLength = pf->contentLength;
+		pf->buffer = NULL;
+	}
+
+	free (pf->buffer);
+	free (pf->url);
+	memset (pf, 0, sizeof (*pf));
 }
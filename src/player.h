@@ -47,7 +47,53 @@ THE SOFTWARE.
 #include "settings.h"
 
 #define BAR_PLAYER_MS_TO_S_FACTOR 1000
+/* minimum ring buffer size, the jitter buffer is added on top */
 #define BAR_PLAYER_BUFSIZE (WAITRESS_BUFFER_SIZE*2)
+/* slack behind the ring buffer's end, frames wrapping around are mirrored
+ * into it; must be larger than the biggest aac/mp3 frame */
+#define BAR_PLAYER_BUFGUARD WAITRESS_BUFFER_SIZE
+
+#define BAR_PLAYER_MP4_MAXDEPTH 8
+
+/* streaming mp4 parser state */
+struct audioPlayerMp4 {
+	/* absolute stream offsets where the boxes we descended into end */
+	size_t boxEnd[BAR_PLAYER_MP4_MAXDEPTH];
+	unsigned int depth;
+	/* bytes to skip before the next box header */
+	size_t skip;
+	/* sample table box being read, entries left, where the box ends */
+	enum {
+		BAR_PLAYER_MP4_NONE = 0,
+		BAR_PLAYER_MP4_STSZ,
+		BAR_PLAYER_MP4_STTS,
+		BAR_PLAYER_MP4_STCO,
+		BAR_PLAYER_MP4_CO64,
+	} table;
+	size_t tableLeft, tableEnd;
+	/* mdhd time scale, sum of stts sample durations */
+	uint32_t timescale;
+	uint64_t duration;
+	/* offset of the first chunk (stco) */
+	uint64_t dataOffset;
+	/* inside mdat */
+	bool inData;
+};
+
+/* song waiting to be played by the player engine */
+typedef struct BarPlayerSong {
+	char *url;
+	PianoAudioFormat_t audioFormat;
+	float gain;
+	/* milliseconds */
+	unsigned long int duration;
+	/* recording, handed over to the player */
+	BarFly_t fly;
+	/* beginning of the stream, see BarPrefetchFinish */
+	char *prefetchBuffer;
+	size_t prefetchFilled, prefetchLength;
+	struct BarPlayerSong *next;
+} BarPlayerSong_t;
 
 struct audioPlayer {
 	bool doQuit; /* protected by pauseMutex */
@@ -56,13 +102,11 @@ struct audioPlayer {
 	unsigned char aoError;
 
 	enum {
-		PLAYER_FREED = 0, /* thread is not running */
-		PLAYER_STARTING, /* thread is starting */
+		PLAYER_FREED = 0, /* no song loaded */
+		PLAYER_STARTING, /* song handed over to the engine thread */
 		PLAYER_INITIALIZED, /* decoder/waitress initialized */
-		PLAYER_FOUND_ESDS,
 		PLAYER_AUDIO_INITIALIZED, /* audio device opened */
-		PLAYER_FOUND_STSZ,
-		PLAYER_SAMPLESIZE_INITIALIZED,
+		PLAYER_SAMPLESIZE_INITIALIZED, /* aac sample table complete */
 		PLAYER_RECV_DATA, /* playing track */
 		PLAYER_FINISHED_PLAYBACK
 	} mode;
@@ -77,12 +121,32 @@ struct audioPlayer {
 
 	unsigned long samplerate;
 
+	/* ring buffer positions, absolute stream offsets (i.e. they never wrap);
+	 * use bufferX % bufferSize to get the index into buffer. bufferFilled is
+	 * only written by the receiver, bufferRead only by the decoder thread */
 	size_t bufferFilled;
 	size_t bufferRead;
+	size_t bufferSize;
+	/* buffer is a read-only mapping of a recorded file */
+	bool bufferMapped;
 	size_t bytesReceived;
+	/* size of the whole stream, 0 if unknown */
+	size_t contentLength;
+	/* beginning of the stream downloaded by BarPrefetch*, owned by the
+	 * player */
+	char *prefetchBuffer;
+	size_t prefetchFilled, prefetchLength;
+	/* jitter buffer, decoding (re)starts after this many bytes are buffered */
+	size_t bufferPrefill;
+	/* number of times the decoder ran out of data while playing */
+	unsigned int underruns;
+	bool recvDone, decodeDone;
+	/* receiver/decoder thread sleeps on pauseCond */
+	bool recvWaiting, decodeWaiting;
 
 	/* aac */
 	#ifdef ENABLE_FAAD
+	struct audioPlayerMp4 mp4;
 	/* stsz atom: sample sizes */
 	size_t sampleSizeN;
 	size_t sampleSizeCurr;
@@ -97,15 +161,41 @@ struct audioPlayer {
 	struct mad_synth mp3Synth;
 	#endif
 
-	/* audio out */
+	/* audio out, kept open across songs while the format does not change;
+	 * only touched by the decoder thread */
 	ao_device *audioOutDevice;
+	ao_sample_format aoFormat;
+	/* libao driver, -1 if not looked up yet */
+	int aoDriver;
+	/* decoded audio waiting to be played, see BarPlayerPcmWrite; in
+	 * samples (all channels) */
+	int16_t *pcm;
+	size_t pcmFilled, pcmSize;
+	/* its duration in milliseconds, added to songPlayed once played */
+	unsigned long int pcmTime;
 	const BarSettings_t *settings;
 
 	unsigned char *buffer;
+	/* ring buffer memory, reused by subsequent songs */
+	unsigned char *ringBuffer;
+	size_t ringSize;
+
+	/* engine state, protected by pauseMutex */
+	bool engineQuit, decodeStart;
+	/* songs to be played after the current one */
+	BarPlayerSong_t *queue;
+	/* PLAYER_RET_* of the last song, valid in PLAYER_FINISHED_PLAYBACK */
+	int ret;
 
 	pthread_mutex_t pauseMutex;
 	pthread_cond_t pauseCond;
+	pthread_t thread, decodeThread;
 	WaitressHandle_t waith;
+	/* writing to cancelPipe[1] aborts waith's current request */
+	int cancelPipe[2];
+	/* last audio request of the current song, phases are -1 if the song
+	 * was not fetched by waith (prefetched or local file) */
+	WaitressTiming_t fetchTiming;
 
 	/* File stream for writing out the audio file. */
 	BarFly_t fly;
@@ -113,7 +203,34 @@ struct audioPlayer {
 
 enum {PLAYER_RET_OK = 0, PLAYER_RET_HARDFAIL = 1, PLAYER_RET_SOFTFAIL = 2};
 
-void *BarPlayerThread (void *data);
+/* beginning of the next song's audio stream, downloaded while the current
+ * one is playing */
+typedef struct {
+	enum {
+		PREFETCH_IDLE = 0, /* thread is not running */
+		PREFETCH_RUNNING, /* thread is running or must be joined */
+	} mode;
+	bool doQuit;
+	char *url;
+	char *buffer;
+	size_t bufferFilled, bufferSize;
+	/* size of the whole stream, 0 if unknown */
+	size_t contentLength;
+	const BarSettings_t *settings;
+	WaitressHandle_t waith;
+	int cancelPipe[2];
+	pthread_t thread;
+} BarPrefetch_t;
+
+bool BarPlayerInit (struct audioPlayer *, const BarSettings_t *);
+void BarPlayerDestroy (struct audioPlayer *);
+bool BarPlayerEnqueue (struct audioPlayer *, const BarPlayerSong_t *);
+void BarPlayerSongDone (struct audioPlayer *);
+void BarPlayerSkip (struct audioPlayer *);
+void BarPlayerSetPause (struct audioPlayer *, bool);
+void BarPlayerTogglePause (struct audioPlayer *);
 unsigned int BarPlayerCalcScale (float);
+bool BarPrefetchStart (BarPrefetch_t *, const char *, const BarSettings_t *);
+void BarPrefetchFinish (BarPrefetch_t *, BarPlayerSong_t *);
 
 #endif /* _PLAYER_H */
@@ -131,6 +131,11 @@ void BarSettingsRead (BarSettings_t *settings) {
 	settings->history = 5;
 	settings->volume = 0;
 	settings->maxPlayerErrors = 5;
+	settings->jitterBuffer = 2000;
+	settings->prefetchTime = 10;
+	settings->prefetchSize = 256*1024;
+	settings->audioIdleTimeout = 60;
+	settings->audioPeriod = 100;
 	settings->sortOrder = BAR_SORT_NAME_AZ;
 	settings->loveIcon = strdup (" <3");
 	settings->banIcon = strdup (" </3");
@@ -169,6 +174,8 @@ void BarSettingsRead (BarSettings_t *settings) {
 	settings->msgFormat[MSG_LIST].postfix = NULL;
 	settings->useSpaces = false;
 	settings->embedCover = true;
+	settings->recordOnly = false;
+	settings->downloadSegments = 4;
 
 	for (size_t i = 0; i < BAR_KS_COUNT; i++) {
 		settings->keys[i] = dispatchActions[i].defaultKey;
@@ -253,6 +260,16 @@ void BarSettingsRead (BarSettings_t *settings) {
 				settings->eventCmd = strdup (val);
 			} else if (streq ("history", key)) {
 				settings->history = atoi (val);
+			} else if (streq ("jitter_buffer", key)) {
+				settings->jitterBuffer = atoi (val);
+			} else if (streq ("prefetch_time", key)) {
+				settings->prefetchTime = atoi (val);
+			} else if (streq ("prefetch_size", key)) {
+				settings->prefetchSize = atoi (val);
+			} else if (streq ("audio_idle_timeout", key)) {
+				settings->audioIdleTimeout = atoi (val);
+			} else if (streq ("audio_period", key)) {
+				settings->audioPeriod = atoi (val);
 			} else if (streq ("max_player_errors", key)) {
 				settings->maxPlayerErrors = atoi (val);
 			} else if (streq ("audio_file_dir", key)) {
@@ -269,6 +286,10 @@ void BarSettingsRead (BarSettings_t *settings) {
 				if (!streq ("true", val)) {
 					settings->embedCover = false;
 				}
+			} else if (streq ("record_only", key)) {
+				settings->recordOnly = streq ("true", val);
+			} else if (streq ("download_segments", key)) {
+				settings->downloadSegments = atoi (val);
 			} else if (streq ("sort", key)) {
 				size_t i;
 				static const char *mapping[] = {"name_az",
@@ -86,6 +86,11 @@ typedef struct {
 typedef struct {
 	bool autoselect;
 	unsigned int history, maxPlayerErrors;
+	unsigned int jitterBuffer; /* ms */
+	unsigned int prefetchTime; /* s */
+	unsigned int audioIdleTimeout; /* s */
+	unsigned int audioPeriod; /* ms */
+	size_t prefetchSize;
 	int volume;
 	BarStationSorting_t sortOrder;
 	PianoAudioQuality_t audioQuality;
@@ -93,6 +98,9 @@ typedef struct {
 	char *audioFileName;
 	int useSpaces;
 	int embedCover;
+	/* don't play, just record songs using that many concurrent requests */
+	bool recordOnly;
+	unsigned int downloadSegments;
 	char *username;
 	char *password, *passwordCmd;
 	char *controlProxy; /* non-american listeners need this */
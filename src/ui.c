@@ -132,18 +132,29 @@ void BarUiMsg (const BarSettings_t *settings, const BarUiMsg_t type,
 }
 
 /*	fetch http resource (post request)
- *	@param waitress handle
+ *	@param app handle
  *	@param piano request (initialized by PianoRequest())
  */
-static WaitressReturn_t BarPianoHttpRequest (WaitressHandle_t *waith,
+static WaitressReturn_t BarPianoHttpRequest (BarApp_t * const app,
 		PianoRequest_t *req) {
+	WaitressHandle_t * const waith = &app->waith;
+	WaitressReturn_t wRet;
+
 	waith->extraHeaders = "Content-Type: text/plain\r\n";
 	waith->postData = req->postData;
 	waith->method = WAITRESS_METHOD_POST;
 	waith->url.path = req->urlPath;
 	waith->url.tls = req->secure;
-
-	return WaitressFetchBuf (waith, &req->responseData);
+	/* station lists are large and compress well */
+	waith->acceptEncoding = req->type == PIANO_REQUEST_GET_STATIONS ||
+			req->type == PIANO_REQUEST_GET_GENRE_STATIONS;
+
+	/* the response buffer is owned by app and reused */
+	wRet = WaitressFetchBufReuse (waith, &app->responseBuf,
+			&app->responseBufSize, NULL);
+	req->responseData = app->responseBuf;
+	WaitressGetTiming (waith, &app->rpcTiming);
+	return wRet;
 }
 
 /*	piano wrapper: prepare/execute http request and pass result back to
@@ -172,12 +183,9 @@ int BarUiPianoCall (BarApp_t * const app, PianoRequestType_t type,
 			return 0;
 		}
 
-		*wRet = BarPianoHttpRequest (&app->waith, &req);
+		*wRet = BarPianoHttpRequest (app, &req);
 		if (*wRet != WAITRESS_RET_OK) {
 			BarUiMsg (&app->settings, MSG_NONE, "Network error: %s\n", WaitressErrorToStr (*wRet));
-			if (req.responseData != NULL) {
-				free (req.responseData);
-			}
 			PianoDestroyRequest (&req);
 			return 0;
 		}
@@ -200,9 +208,6 @@ int BarUiPianoCall (BarApp_t * const app, PianoRequestType_t type,
 						&authwRet)) {
 					*pRet = authpRet;
 					*wRet = authwRet;
-					if (req.responseData != NULL) {
-						free (req.responseData);
-					}
 					PianoDestroyRequest (&req);
 					return 0;
 				} else {
@@ -212,9 +217,6 @@ int BarUiPianoCall (BarApp_t * const app, PianoRequestType_t type,
 				}
 			} else if (*pRet != PIANO_RET_OK) {
 				BarUiMsg (&app->settings, MSG_NONE, "Error: %s\n", PianoErrorToStr (*pRet));
-				if (req.responseData != NULL) {
-					free (req.responseData);
-				}
 				PianoDestroyRequest (&req);
 				return 0;
 			} else {
@@ -223,10 +225,7 @@ int BarUiPianoCall (BarApp_t * const app, PianoRequestType_t type,
 		}
 		/* we can destroy the request at this point, even when this call needs
 		 * more than one http request. persistent data (step counter, e.g.) is
-		 * stored in req.data */
-		if (req.responseData != NULL) {
-			free (req.responseData);
-		}
+		 * stored in req.data; responseData is app's buffer and not freed */
 		PianoDestroyRequest (&req);
 	} while (*pRet == PIANO_RET_CONTINUE_REQUEST);
 
@@ -674,18 +673,52 @@ size_t BarUiListSongs (const BarSettings_t *settings,
 	return i;
 }
 
+/*	write http request phases to eventcmd pipe
+ *	@param pipe
+ *	@param key prefix
+ *	@param timing
+ */
+static void BarUiPrintTiming (FILE *fd, const char *prefix,
+		const WaitressTiming_t *timing) {
+	fprintf (fd,
+			"%sResolveTime=%ld\n"
+			"%sConnectTime=%ld\n"
+			"%sHandshakeTime=%ld\n"
+			"%sSentTime=%ld\n"
+			"%sFirstByteTime=%ld\n"
+			"%sHeadersTime=%ld\n"
+			"%sDoneTime=%ld\n"
+			"%sBytesSent=%llu\n"
+			"%sBytesReceived=%llu\n"
+			"%sBodyBytes=%llu\n",
+			prefix, timing->resolve,
+			prefix, timing->connect,
+			prefix, timing->handshake,
+			prefix, timing->sent,
+			prefix, timing->firstByte,
+			prefix, timing->headers,
+			prefix, timing->done,
+			prefix, timing->bytesSent,
+			prefix, timing->bytesReceived,
+			prefix, timing->bodyBytes);
+}
+
 /*	Excute external event handler
  *	@param settings containing the cmdline
  *	@param event type
  *	@param current station
  *	@param current song
+ *	@param player, its last audio request is reported
+ *	@param phases of the last rpc
+ *	@param piano handle, its stations are reported (may be NULL)
  *	@param piano error-code (PIANO_RET_OK if not applicable)
  *	@param waitress error-code (WAITRESS_RET_OK if not applicable)
  */
 void BarUiStartEventCmd (const BarSettings_t *settings, const char *type,
 		const PianoStation_t *curStation, const PianoSong_t *curSong,
-		const struct audioPlayer *player, PianoStation_t *stations,
-                PianoReturn_t pRet, WaitressReturn_t wRet) {
+		const struct audioPlayer *player, const WaitressTiming_t *rpcTiming,
+		const PianoHandle_t *ph, PianoReturn_t pRet, WaitressReturn_t wRet) {
+	PianoStation_t * const stations = ph == NULL ? NULL : ph->stations;
 	pid_t chld;
 	int pipeFd[2];
 
@@ -721,7 +754,7 @@ void BarUiStartEventCmd (const BarSettings_t *settings, const char *type,
 		pipeWriteFd = fdopen (pipeFd[1], "w");
 
 		if (curSong != NULL && stations != NULL && curStation->isQuickMix) {
-			songStation = PianoFindStationById (stations, curSong->stationId);
+			songStation = PianoFindStationById (ph, curSong->stationId);
 		}
 
 		fprintf (pipeWriteFd,
@@ -737,6 +770,10 @@ void BarUiStartEventCmd (const BarSettings_t *settings, const char *type,
 				"wRetStr=%s\n"
 				"songDuration=%lu\n"
 				"songPlayed=%lu\n"
+				"songUnderruns=%u\n"
+				"tlsHandshakes=%u\n"
+				"tlsResumed=%u\n"
+				"tlsHandshakeTime=%lu\n"
 				"rating=%i\n"
 				"detailUrl=%s\n"
 				"songExplorerUrl=%s\n"
@@ -755,6 +792,10 @@ void BarUiStartEventCmd (const BarSettings_t *settings, const char *type,
 				WaitressErrorToStr (wRet),
 				player->songDuration,
 				player->songPlayed,
+				player->underruns,
+				player->waith.tlsStats.handshakes,
+				player->waith.tlsStats.resumed,
+				player->waith.tlsStats.time,
 				curSong == NULL ? PIANO_RATE_NONE : curSong->rating,
 				curSong == NULL ? "" : curSong->detailUrl,
 				curSong == NULL ? "" : curSong->songExplorerUrl,
@@ -762,6 +803,8 @@ void BarUiStartEventCmd (const BarSettings_t *settings, const char *type,
 				curSong == NULL ? "" : settings->audioFileDir,
 				curSong == NULL ? "" : player->fly.audio_file_path
 				);
+		BarUiPrintTiming (pipeWriteFd, "audio", &player->fetchTiming);
+		BarUiPrintTiming (pipeWriteFd, "rpc", rpcTiming);
 
 		if (stations != NULL) {
 			/* send station list */
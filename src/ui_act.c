@@ -35,26 +35,14 @@ THE SOFTWARE.
 /*	standard eventcmd call
  */
 #define BarUiActDefaultEventcmd(name) BarUiStartEventCmd (&app->settings, \
-		name, selStation, selSong, &app->player, app->ph.stations, \
-		pRet, wRet)
+		name, selStation, selSong, &app->player, &app->rpcTiming, \
+		&app->ph, pRet, wRet)
 
 /*	standard piano call
  */
 #define BarUiActDefaultPianoCall(call, arg) BarUiPianoCall (app, \
 		call, arg, &pRet, &wRet)
 
-/*	helper to _really_ skip a song (unlock mutex, quit player)
- *	@param player handle
- */
-static inline void BarUiDoSkipSong (struct audioPlayer *player) {
-	assert (player != NULL);
-
-	pthread_mutex_lock (&player->pauseMutex);
-	player->doQuit = true;
-	pthread_cond_broadcast (&player->pauseCond);
-	pthread_mutex_unlock (&player->pauseMutex);
-}
-
 /*	transform station if necessary to allow changes like rename, rate, ...
  *	@param piano handle
  *	@param transform this station
@@ -128,7 +116,7 @@ BarUiActCallback(BarUiActBanSong) {
 	assert (selSong != NULL);
 	assert (selSong->stationId != NULL);
 
-	if ((realStation = PianoFindStationById (app->ph.stations,
+	if ((realStation = PianoFindStationById (&app->ph,
 			selSong->stationId)) == NULL) {
 		assert (0);
 		return;
@@ -144,7 +132,7 @@ BarUiActCallback(BarUiActBanSong) {
 	BarUiMsg (&app->settings, MSG_INFO, "Banning song... ");
 	if (BarUiActDefaultPianoCall (PIANO_REQUEST_RATE_SONG, &reqData) &&
 			selSong == app->playlist) {
-		BarUiDoSkipSong (&app->player);
+		BarPlayerSkip (&app->player);
 	}
 	BarUiActDefaultEventcmd ("songban");
 }
@@ -231,9 +219,9 @@ BarUiActCallback(BarUiActDeleteStation) {
 		BarUiMsg (&app->settings, MSG_INFO, "Deleting station... ");
 		if (BarUiActDefaultPianoCall (PIANO_REQUEST_DELETE_STATION,
 				selStation) && selStation == app->curStation) {
-			BarUiDoSkipSong (&app->player);
-			PianoDestroyPlaylist (PianoListNextP (app->playlist));
-			app->playlist->head.next = NULL;
+			BarPlayerSkip (&app->player);
+			PianoDestroyPlaylist (PianoListDeleteP (app->playlist,
+					app->playlist));
 			BarUiHistoryPrepend (app, app->playlist);
 			app->playlist = NULL;
 			app->curStation = NULL;
@@ -334,7 +322,7 @@ BarUiActCallback(BarUiActSongInfo) {
 	/* print real station if quickmix */
 	BarUiPrintSong (&app->settings, selSong,
 			selStation->isQuickMix ?
-			PianoFindStationById (app->ph.stations, selSong->stationId) :
+			PianoFindStationById (&app->ph, selSong->stationId) :
 			NULL);
 }
 
@@ -382,7 +370,7 @@ BarUiActCallback(BarUiActLoveSong) {
 	assert (selSong != NULL);
 	assert (selSong->stationId != NULL);
 
-	if ((realStation = PianoFindStationById (app->ph.stations,
+	if ((realStation = PianoFindStationById (&app->ph,
 			selSong->stationId)) == NULL) {
 		assert (0);
 		return;
@@ -403,34 +391,25 @@ BarUiActCallback(BarUiActLoveSong) {
 /*	skip song
  */
 BarUiActCallback(BarUiActSkipSong) {
-	BarUiDoSkipSong (&app->player);
+	BarPlayerSkip (&app->player);
 }
 
 /*	play
  */
 BarUiActCallback(BarUiActPlay) {
-	pthread_mutex_lock (&app->player.pauseMutex);
-	app->player.doPause = false;
-	pthread_cond_broadcast (&app->player.pauseCond);
-	pthread_mutex_unlock (&app->player.pauseMutex);
+	BarPlayerSetPause (&app->player, false);
 }
 
 /*	pause
  */
 BarUiActCallback(BarUiActPause) {
-	pthread_mutex_lock (&app->player.pauseMutex);
-	app->player.doPause = true;
-	pthread_cond_broadcast (&app->player.pauseCond);
-	pthread_mutex_unlock (&app->player.pauseMutex);
+	BarPlayerSetPause (&app->player, true);
 }
 
 /*	toggle pause
  */
 BarUiActCallback(BarUiActTogglePause) {
-	pthread_mutex_lock (&app->player.pauseMutex);
-	app->player.doPause = !app->player.doPause;
-	pthread_cond_broadcast (&app->player.pauseCond);
-	pthread_mutex_unlock (&app->player.pauseMutex);
+	BarPlayerTogglePause (&app->player);
 }
 
 /*	rename current station
@@ -466,10 +445,10 @@ BarUiActCallback(BarUiActSelectStation) {
 	if (newStation != NULL) {
 		app->curStation = newStation;
 		BarUiPrintStation (&app->settings, app->curStation);
-		BarUiDoSkipSong (&app->player);
+		BarPlayerSkip (&app->player);
 		if (app->playlist != NULL) {
-			PianoDestroyPlaylist (PianoListNextP (app->playlist));
-			app->playlist->head.next = NULL;
+			PianoDestroyPlaylist (PianoListDeleteP (app->playlist,
+					app->playlist));
 			BarUiHistoryPrepend (app, app->playlist);
 			app->playlist = NULL;
 		}
@@ -487,7 +466,7 @@ BarUiActCallback(BarUiActTempBanSong) {
 	BarUiMsg (&app->settings, MSG_INFO, "Putting song on shelf... ");
 	if (BarUiActDefaultPianoCall (PIANO_REQUEST_ADD_TIRED_SONG, selSong) &&
 			selSong == app->playlist) {
-		BarUiDoSkipSong (&app->player);
+		BarPlayerSkip (&app->player);
 	}
 	BarUiActDefaultEventcmd ("songshelf");
 }
@@ -571,7 +550,7 @@ BarUiActCallback(BarUiActSelectQuickMix) {
  */
 BarUiActCallback(BarUiActQuit) {
 	app->doQuit = true;
-	BarUiDoSkipSong (&app->player);
+	BarPlayerSkip (&app->player);
 }
 
 /*	song history
@@ -585,7 +564,7 @@ BarUiActCallback(BarUiActHistory) {
 				&app->input);
 		if (histSong != NULL) {
 			BarKeyShortcutId_t action;
-			PianoStation_t *songStation = PianoFindStationById (app->ph.stations,
+			PianoStation_t *songStation = PianoFindStationById (&app->ph,
 					histSong->stationId);
 
 			if (songStation == NULL) {